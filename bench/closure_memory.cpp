@@ -0,0 +1,67 @@
+// Keeps callbacks made by a procedure that built a large list while it ran, and
+// prints the cells and scopes still in use while they are alive, with closures
+// that keep their whole defining scope and with flat ones. Flat closures keep
+// only the number each callback uses.
+// Usage: bench_closure_memory [callbacks] [list-length]
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "../closure.h"
+#include "../scheme.h"
+
+namespace {
+
+long ReadStatusKb(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field + ":", 0) == 0) {
+            return std::atol(line.c_str() + field.size() + 1);
+        }
+    }
+    return -1;
+}
+
+uint64_t SlotsInUse(const std::string& pool) {
+    for (const auto& stats : CollectSlabStats()) {
+        if (stats.name == pool) {
+            return stats.in_use;
+        }
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string callbacks = argc > 1 ? argv[1] : "1000";
+    std::string length = argc > 2 ? argv[2] : "1000";
+    Interpreter interpreter;
+    interpreter.Run(
+        "(define (build n) (do ((i 0 (+ i 1)) (acc '() (cons i acc))) ((= i n) acc)))");
+    interpreter.Run(
+        "(define (make-callback k n) (define data (build n)) (define first (car data)) "
+        "(lambda () (+ k first)))");
+    interpreter.Run(
+        "(define (collect k n acc) (if (= k 0) acc "
+        "(collect (- k 1) n (cons (make-callback k n) acc))))");
+    interpreter.Run(
+        "(define (call-all fs acc) (if (null? fs) acc (call-all (cdr fs) (+ acc ((car fs))))))");
+    // Flat closures last: the slab pools keep their chunks, so the resident
+    // memory only grows.
+    for (bool flat : {false, true}) {
+        SetClosureFlattening(flat);
+        uint64_t cells = SlotsInUse("cell");
+        uint64_t scopes = SlotsInUse("scope");
+        interpreter.Run("(define callbacks (collect " + callbacks + " " + length + " '()))");
+        std::string sum = interpreter.Run("(call-all callbacks 0)");
+        std::cout << (flat ? "flat:    " : "chained: ") << "sum: " << sum
+                  << "  cells kept: " << SlotsInUse("cell") - cells
+                  << "  scopes kept: " << SlotsInUse("scope") - scopes
+                  << "  rss: " << ReadStatusKb("VmRSS") << " kB" << std::endl;
+        interpreter.Run("(set! callbacks '())");
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Compares two scheme_bench JSON files and flags regressions.
+
+Usage: compare.py BASELINE.json CURRENT.json [--threshold 0.10] [--metric min_ns]
+
+A benchmark regressed when its time grew by more than the threshold (a
+fraction). The fastest repetition is compared by default, since it is the least
+disturbed by the rest of the machine. Exits with status 1 if any benchmark
+regressed.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {b["name"]: b for b in json.load(f)["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10)
+    parser.add_argument("--metric", choices=["min_ns", "median_ns", "mean_ns"], default="min_ns")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    print(f"{'benchmark':40} {'baseline':>14} {'current':>14} {'change':>8}")
+    for name in sorted(set(baseline) | set(current)):
+        if name not in baseline or name not in current:
+            where = "baseline" if name not in baseline else "current"
+            print(f"{name:40} missing in the {where} run")
+            continue
+        before = baseline[name][args.metric]
+        after = current[name][args.metric]
+        change = (after - before) / before if before else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            mark = "  improved"
+        print(f"{name:40} {before / 1e6:11.3f} ms {after / 1e6:11.3f} ms {change:+8.1%}{mark}")
+    if regressions:
+        print(f"{regressions} benchmark(s) regressed by more than {args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,57 @@
+// Streams values from a generator into a tail-recursive green thread and prints
+// the resident memory after each run. Flat numbers mean constant memory.
+// Usage: bench_generator_memory [count...]
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../scheme.h"
+
+namespace {
+
+long ReadStatusKb(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field + ":", 0) == 0) {
+            return std::atol(line.c_str() + field.size() + 1);
+        }
+    }
+    return -1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> counts;
+    for (int i = 1; i < argc; ++i) {
+        counts.push_back(argv[i]);
+    }
+    if (counts.empty()) {
+        counts = {"1000000", "10000000", "100000000"};
+    }
+    Interpreter interpreter;
+    interpreter.Run(
+        "(define (upto n) (lambda () (define (loop i) (if (< i n) (yield i)) "
+        "(if (< i n) (loop (+ i 1)))) (loop 0)))");
+    interpreter.Run(
+        "(define (consume g acc) (if (generator-done? g) acc "
+        "(begin-count g acc)))");
+    interpreter.Run("(define (begin-count g acc) (generator-next g) (consume g (+ acc 1)))");
+    interpreter.Run("(define result (make-channel))");
+    for (const auto& count : counts) {
+        auto start = std::chrono::steady_clock::now();
+        // `define` keeps the consumer loop in a suspendable position, so its tail
+        // calls run in one frame.
+        interpreter.Run("(spawn (lambda () (define n (consume (make-generator (upto " + count +
+                        ")) 0)) (channel-send result n)))");
+        std::string consumed = interpreter.Run("(channel-receive result)");
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "values: " << consumed << "  time: " << elapsed.count()
+                  << " s  rss: " << ReadStatusKb("VmRSS") << " kB  peak: " << ReadStatusKb("VmHWM")
+                  << " kB" << std::endl;
+    }
+    return 0;
+}
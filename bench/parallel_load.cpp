@@ -0,0 +1,72 @@
+// Times reading a generated source file of independent top-level data forms
+// with 1, 2, 4, ... workers, up to the number of cores.
+// Usage: bench_parallel_load [megabytes] [max-workers]
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "../parallel.h"
+#include "../source_cache.h"
+
+namespace {
+
+void WriteSource(const std::string& path, size_t bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::string form;
+    size_t written = 0;
+    for (size_t i = 0; written < bytes; ++i) {
+        std::string id = std::to_string(i % 100000);
+        form = "(record " + id + " \"item-" + id + "\" (tags a b c) '(1 2 3 4)) ; entry\n";
+        out << form;
+        written += form.size();
+    }
+}
+
+double Measure(const std::string& path, size_t* forms) {
+    auto start = std::chrono::steady_clock::now();
+    *forms = ReadSourceFile(path).size();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = 500;
+    size_t max_workers = std::thread::hardware_concurrency();
+    if (argc > 1) {
+        megabytes = std::atoi(argv[1]);
+    }
+    if (argc > 2) {
+        max_workers = std::atoi(argv[2]);
+    }
+    if (max_workers == 0) {
+        max_workers = 1;
+    }
+    // Every run has to parse, not decode a cache written by the one before.
+    setenv("SCHEME_CACHE_DIR", "", 1);
+    std::string path = "/tmp/bench_parallel_load." + std::to_string(getpid()) + ".scm";
+    WriteSource(path, megabytes << 20);
+
+    double single = 0;
+    for (size_t workers = 1;; workers = std::min(workers * 2, max_workers)) {
+        ThreadPool::Instance().SetWorkerCount(workers);
+        size_t forms;
+        double seconds = Measure(path, &forms);
+        if (workers == 1) {
+            single = seconds;
+        }
+        std::cout << "workers: " << workers << "  forms: " << forms << "  time: " << seconds
+                  << " s  speedup: " << single / seconds << "x" << std::endl;
+        if (workers == max_workers) {
+            break;
+        }
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Compares (parallel-map f lst) against a sequential recursive map.
+// Usage: bench_parallel_map [elements] [workers]
+#include <pthread.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "../scheme.h"
+
+namespace {
+
+// Reading, walking and freeing a long Cell chain recurses once per element.
+constexpr size_t kStackSize = size_t{2} << 30;
+
+struct BenchArgs {
+    int elements;
+    int workers;
+};
+
+double Measure(Interpreter& interpreter, const std::string& expr) {
+    auto start = std::chrono::steady_clock::now();
+    interpreter.Run(expr);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void* RunBench(void* raw_args) {
+    auto* args = static_cast<BenchArgs*>(raw_args);
+    Interpreter interpreter;
+    std::string data = "(define lst '(";
+    for (int i = 0; i < args->elements; ++i) {
+        data += std::to_string(i % 100);
+        data += ' ';
+    }
+    data += "))";
+    interpreter.Run(data);
+    interpreter.Run("(define (work-loop n acc) (if (= n 0) acc (work-loop (- n 1) (+ acc n))))");
+    interpreter.Run("(define (work x) (work-loop 4 x))");
+    interpreter.Run(
+        "(define (seq-map f l) (if (null? l) '() (cons (f (car l)) (seq-map f (cdr l)))))");
+    interpreter.Run("(parallel-workers " + std::to_string(args->workers) + ")");
+
+    double sequential = Measure(interpreter, "(define seq-result (seq-map work lst))");
+    double parallel = Measure(interpreter, "(define par-result (parallel-map work lst))");
+
+    std::cout << "elements:   " << args->elements << "\n";
+    std::cout << "workers:    " << args->workers << "\n";
+    std::cout << "sequential: " << sequential << " s\n";
+    std::cout << "parallel:   " << parallel << " s\n";
+    std::cout << "speedup:    " << sequential / parallel << "x" << std::endl;
+    return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchArgs args{1000000, 8};
+    if (argc > 1) {
+        args.elements = std::atoi(argv[1]);
+    }
+    if (argc > 2) {
+        args.workers = std::atoi(argv[2]);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, kStackSize);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, RunBench, &args) != 0) {
+        std::cerr << "Can't start the benchmark thread" << std::endl;
+        return 1;
+    }
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+    return 0;
+}
@@ -0,0 +1,536 @@
+// Micro- and macro-benchmarks of the interpreter, printed as JSON so two runs
+// can be compared with bench/compare.py.
+// Usage: scheme_bench [--filter SUBSTRING] [--repetitions N] [--output FILE] [--list] [--trace]
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../closure.h"
+#include "../packed_list.h"
+#include "../quicken.h"
+#include "../scheme.h"
+
+namespace {
+
+// Reading, walking and freeing a long Cell chain recurses once per element.
+constexpr size_t kStackSize = size_t{2} << 30;
+
+// Does the measured work once and returns the number of items it processed.
+using BenchmarkRun = std::function<size_t()>;
+
+struct Benchmark {
+    std::string name;
+    // Builds the input only when the benchmark is about to run.
+    std::function<BenchmarkRun()> setup;
+};
+
+struct Result {
+    std::string name;
+    size_t items;
+    std::vector<double> seconds;
+};
+
+struct BenchArgs {
+    std::string filter;
+    int repetitions = 5;
+    std::string output;
+    bool list = false;
+    // Runs with event tracing on, to measure what it costs.
+    bool trace = false;
+};
+
+// A fixed pseudo-random source, so every run measures the same input.
+std::string GenerateSource(size_t forms) {
+    static const char* kNames[] = {"alpha", "beta", "gamma", "delta", "x", "y", "list-ref", "+"};
+    uint32_t state = 12345;
+    auto next = [&state]() {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) & 0x7fff;
+    };
+    std::string source;
+    for (size_t i = 0; i < forms; ++i) {
+        source += "(define (f" + std::to_string(i) + " x y) (if (< x y) '(";
+        size_t length = 2 + next() % 6;
+        for (size_t j = 0; j < length; ++j) {
+            if (next() % 2) {
+                source += std::to_string(next() % 1000);
+            } else {
+                source += kNames[next() % 8];
+            }
+            source += ' ';
+        }
+        source += ") (cons x y)))\n";
+    }
+    return source;
+}
+
+size_t TokenizeAll(const std::string& source) {
+    Tokenizer tokenizer{std::string_view(source)};
+    size_t tokens = 0;
+    while (!tokenizer.IsEnd()) {
+        tokenizer.Next();
+        ++tokens;
+    }
+    return tokens;
+}
+
+std::shared_ptr<Object> MakeList(size_t length) {
+    std::shared_ptr<Object> list;
+    for (size_t i = length; i > 0; --i) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(MakeSlabShared<Number>(static_cast<int>(i)));
+        cell->SetSecond(list);
+        list = cell;
+    }
+    return list;
+}
+
+std::shared_ptr<Object> ParseOne(const std::string& expr) {
+    Tokenizer tokenizer{std::string_view(expr)};
+    return Read(&tokenizer);
+}
+
+// A program benchmark: defines its functions once, then times one expression,
+// whose result is checked so a broken interpreter can't look fast. quicken
+// false runs it on the generic evaluator, without call site specialization;
+// limits apply to the timed expression.
+Benchmark Program(const std::string& name, std::vector<std::string> definitions,
+                  std::string expr, std::string expected, size_t items, bool quicken = true,
+                  EvaluationLimits limits = {}) {
+    return {name, [=]() -> BenchmarkRun {
+                SetQuickening(quicken);
+                auto interpreter = std::make_shared<Interpreter>();
+                for (const auto& definition : definitions) {
+                    interpreter->Run(definition);
+                }
+                interpreter->SetLimits(limits);
+                return [=]() {
+                    std::string result = interpreter->Run(expr);
+                    if (result != expected) {
+                        std::cerr << name << ": got " << result << ", expected " << expected
+                                  << std::endl;
+                        std::abort();
+                    }
+                    return items;
+                };
+            }};
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+    InitializeFunctionKeeper();
+    std::vector<Benchmark> benchmarks;
+
+    benchmarks.push_back({"tokenizer/next", []() -> BenchmarkRun {
+                              auto source = GenerateSource(2000);
+                              return [source]() { return TokenizeAll(source); };
+                          }});
+    benchmarks.push_back({"parser/read", []() -> BenchmarkRun {
+                              auto source = GenerateSource(2000);
+                              return [source]() {
+                                  Tokenizer tokenizer{std::string_view(source)};
+                                  return ReadAll(&tokenizer).size();
+                              };
+                          }});
+
+    for (size_t depth : {1, 8, 64}) {
+        benchmarks.push_back({"scope/get-variable-depth-" + std::to_string(depth),
+                              [depth]() -> BenchmarkRun {
+                                  auto leaf = MakeSlabShared<Scope>();
+                                  leaf->AddVariable("target", MakeSlabShared<Number>(1));
+                                  for (size_t i = 1; i < depth; ++i) {
+                                      auto child = MakeSlabShared<Scope>();
+                                      child->GetParentScope() = leaf;
+                                      child->AddVariable("other" + std::to_string(i),
+                                                         MakeSlabShared<Number>(0));
+                                      leaf = child;
+                                  }
+                                  return [leaf]() {
+                                      constexpr size_t kLookups = 100000;
+                                      for (size_t i = 0; i < kLookups; ++i) {
+                                          leaf->GetVariable("target");
+                                      }
+                                      return kLookups;
+                                  };
+                              }});
+    }
+
+    for (std::string call : {"(+ 1 2)", "(car '(1 2))", "(number? 5)"}) {
+        benchmarks.push_back({"builtin/" + call, [call]() -> BenchmarkRun {
+                                  auto expr = ParseOne(call);
+                                  auto scope = MakeSlabShared<Scope>();
+                                  return [expr, scope]() {
+                                      constexpr size_t kCalls = 20000;
+                                      for (size_t i = 0; i < kCalls; ++i) {
+                                          expr->Evaluate(scope);
+                                      }
+                                      return kCalls;
+                                  };
+                              }});
+    }
+
+    // Many small requests, one Run each or one RunBatch for all of them.
+    constexpr size_t kRequests = 1000;
+    benchmarks.push_back({"embed/run-1000", []() -> BenchmarkRun {
+                              auto interpreter = std::make_shared<Interpreter>();
+                              interpreter->Run("(define (sq x) (* x x))");
+                              return [interpreter]() {
+                                  for (size_t i = 0; i < kRequests; ++i) {
+                                      interpreter->Run("(sq 12)");
+                                  }
+                                  return kRequests;
+                              };
+                          }});
+    benchmarks.push_back({"embed/batch-1000", []() -> BenchmarkRun {
+                              auto interpreter = std::make_shared<Interpreter>();
+                              interpreter->Run("(define (sq x) (* x x))");
+                              std::vector<std::string_view> items(kRequests, "(sq 12)");
+                              auto results = std::make_shared<std::vector<EvalResult>>();
+                              return [interpreter, items, results]() {
+                                  interpreter->RunBatch(items, results.get());
+                                  return results->size();
+                              };
+                          }});
+
+    // What-if evaluations: each fork of a large global environment changes a
+    // few bindings, reads one and is thrown away.
+    constexpr size_t kBindings = 50000;
+    constexpr size_t kForks = 100000;
+    benchmarks.push_back({"fork/what-if-100000", []() -> BenchmarkRun {
+                              auto interpreter = std::make_shared<Interpreter>();
+                              std::string source;
+                              for (size_t i = 0; i < kBindings; ++i) {
+                                  source += "(define v" + std::to_string(i) + " " +
+                                            std::to_string(i) + ")";
+                              }
+                              interpreter->Eval(source);
+                              return [interpreter]() {
+                                  for (size_t i = 0; i < kForks; ++i) {
+                                      auto fork = interpreter->Fork();
+                                      fork->Eval("(define what-if 1) (set! v4242 what-if) v4242");
+                                  }
+                                  return kForks;
+                              };
+                          }});
+
+    benchmarks.push_back({"serialize/list-20000", []() -> BenchmarkRun {
+                              auto list = MakeList(20000);
+                              return [list]() {
+                                  list->Serialize();
+                                  return size_t{20000};
+                              };
+                          }});
+
+    // The call-heavy programs also run generic, to compare with quickened.
+    for (bool quicken : {true, false}) {
+        std::string group = quicken ? "program/" : "generic/";
+        benchmarks.push_back(
+            Program(group + "fib-20",
+                    {"(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"},
+                    "(fib 20)", "6765", 1, quicken));
+        benchmarks.push_back(Program(
+            group + "tak-18-12-6",
+            {"(define (tak x y z) (if (not (< y x)) z (tak (tak (- x 1) y z) (tak (- y 1) z x) "
+             "(tak (- z 1) x y))))"},
+            "(tak 18 12 6)", "7", 1, quicken));
+        benchmarks.push_back(Program(
+            group + "nqueens-7",
+            {"(define (safe? col dist placed) (if (null? placed) #t (if (= (car placed) col) #f "
+             "(if (= (car placed) (+ col dist)) #f (if (= (car placed) (- col dist)) #f "
+             "(safe? col (+ dist 1) (cdr placed)))))))",
+             "(define (place n k placed) (if (= k n) 1 (try-cols n k 0 placed)))",
+             "(define (try-cols n k col placed) (if (= col n) 0 (+ (if (safe? col 1 placed) "
+             "(place n (+ k 1) (cons col placed)) 0) (try-cols n k (+ col 1) placed))))"},
+            "(place 7 0 '())", "40", 1, quicken));
+    }
+    // A closure made two lets deep, called many times and made many times:
+    // flat, the variables it uses are in one scope; chained, in three.
+    for (bool flat : {true, false}) {
+        std::string group = flat ? "closure/flat-" : "closure/chained-";
+        std::vector<std::string> definitions = {
+            "(define (make a b c) (let ((d (+ a b))) (let ((e (+ d c))) "
+            "(lambda (x) (+ x (+ a (+ b (+ c (+ d e)))))))))",
+            "(define f (make 1 2 3))",
+            "(define (call n acc) (if (= n 0) acc (call (- n 1) (f acc))))",
+            "(define (remake n acc) (if (= n 0) acc (remake (- n 1) ((make n 2 3) acc))))"};
+        for (Benchmark program :
+             {Program(group + "call-5000", definitions, "(call 5000 0)", "75000", 5000),
+              Program(group + "make-5000", definitions, "(remake 5000 0)", "37567500", 5000)}) {
+            benchmarks.push_back({program.name, [flat, setup = program.setup]() -> BenchmarkRun {
+                                      SetClosureFlattening(flat);
+                                      BenchmarkRun run = setup();
+                                      return [flat, run]() {
+                                          SetClosureFlattening(flat);
+                                          size_t items = run();
+                                          SetClosureFlattening(true);
+                                          return items;
+                                      };
+                                  }});
+        }
+    }
+    // With every limit set, far above what the programs use, to show their cost.
+    EvaluationLimits limits;
+    limits.max_steps = uint64_t{1} << 40;
+    limits.max_heap_bytes = uint64_t{1} << 40;
+    limits.timeout = std::chrono::hours(1);
+    benchmarks.push_back(
+        Program("limited/fib-20",
+                {"(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"},
+                "(fib 20)", "6765", 1, true, limits));
+    benchmarks.push_back(Program(
+        "limited/build-list-5000",
+        {"(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"},
+        "(car (build 5000 '()))", "1", 5000, true, limits));
+    // A procedure a library exports, called from outside it.
+    benchmarks.push_back(Program(
+        "library/call-imported-5000",
+        {"(define-library (bench arith) (export inc) (begin (define (inc x) (+ x 1))))",
+         "(import (bench arith))",
+         "(define (count n acc) (if (= n 0) acc (count (- n 1) (inc acc))))"},
+        "(count 5000 0)", "5000", 5000));
+    benchmarks.push_back(Program(
+        "program/build-list-5000",
+        {"(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"},
+        "(car (build 5000 '()))", "1", 5000));
+    benchmarks.push_back(
+        Program("program/deep-recursion-5000",
+                {"(define (sum-to n) (if (= n 0) 0 (+ n (sum-to (- n 1)))))"},
+                "(sum-to 5000)", "12502500", 5000));
+    benchmarks.push_back(Program(
+        "program/named-let-5000",
+        {"(define (build n) (let loop ((n n) (acc '())) (if (= n 0) acc (loop (- n 1) "
+         "(cons n acc)))))"},
+        "(car (build 5000))", "1", 5000));
+    benchmarks.push_back(Program(
+        "program/do-5000",
+        {"(define (build n) (do ((n n (- n 1)) (acc '() (cons n acc))) ((= n 0) acc)))"},
+        "(car (build 5000))", "1", 5000));
+    benchmarks.push_back(Program(
+        "program/stream-5000",
+        {"(define (integers n) (cons-stream n (integers (+ n 1))))"},
+        "(stream-ref (stream-filter (lambda (x) (> x 10)) (stream-map (lambda (x) (* x 2)) "
+        "(integers 1))) 5000)",
+        "10012", 5000));
+
+    // Pseudo-random numbers sorted with the builtin <, which takes the integer
+    // path, and with a lambda, which is called for every comparison; a lambda
+    // over 10^7 elements would take minutes.
+    for (size_t size : {size_t{1000}, size_t{100000}, size_t{10000000}}) {
+        for (std::string less : {"<", "(lambda (a b) (< a b))"}) {
+            if (less != "<" && size > 100000) {
+                continue;
+            }
+            std::string name = (less == "<" ? "sort/builtin-" : "sort/lambda-") +
+                               std::to_string(size);
+            benchmarks.push_back({name, [size, less]() -> BenchmarkRun {
+                                      ObjectVectorBase items;
+                                      items.reserve(size);
+                                      uint32_t state = 12345;
+                                      for (size_t i = 0; i < size; ++i) {
+                                          state = state * 1103515245 + 12345;
+                                          items.push_back(MakeSlabShared<Number>(state >> 8));
+                                      }
+                                      auto scope = MakeSlabShared<Scope>();
+                                      scope->AddVariable("xs", MakePackedList(std::move(items)));
+                                      auto expr = Quicken(ParseOne("(sort xs " + less + ")"));
+                                      return [expr, scope, size]() {
+                                          expr->Evaluate(scope);
+                                          return size;
+                                      };
+                                  }});
+        }
+    }
+    // The same 1000 distinct numbers sorted by hand, as sorting was done
+    // before sort, and by sort.
+    std::string numbers =
+        "(define xs (do ((n 1000 (- n 1)) (acc '() (cons (- (* n 7919) (* 1009 (/ (* n 7919) "
+        "1009))) acc))) ((= n 0) acc)))";
+    benchmarks.push_back(Program(
+        "program/insertion-sort-1000",
+        {numbers,
+         "(define (insert x sorted) (if (null? sorted) (list x) (if (< x (car sorted)) "
+         "(cons x sorted) (cons (car sorted) (insert x (cdr sorted))))))",
+         "(define (isort l) (if (null? l) '() (insert (car l) (isort (cdr l)))))"},
+        "(car (isort xs))", "1", 1000));
+    benchmarks.push_back(
+        Program("program/sort-1000", {numbers}, "(car (sort xs <))", "1", 1000));
+    return benchmarks;
+}
+
+std::string Escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+std::string ToJson(const std::vector<Result>& results) {
+    std::ostringstream out;
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto seconds = results[i].seconds;
+        std::sort(seconds.begin(), seconds.end());
+        double mean = 0;
+        for (double s : seconds) {
+            mean += s;
+        }
+        mean /= seconds.size();
+        double median = seconds[seconds.size() / 2];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << Escape(results[i].name) << "\""
+            << ", \"repetitions\": " << seconds.size() << ", \"items\": " << results[i].items
+            << ", \"min_ns\": " << static_cast<long long>(seconds.front() * 1e9)
+            << ", \"median_ns\": " << static_cast<long long>(median * 1e9)
+            << ", \"mean_ns\": " << static_cast<long long>(mean * 1e9)
+            << ", \"ns_per_item\": " << static_cast<long long>(median * 1e9 / results[i].items)
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+Result Measure(const Benchmark& benchmark, int repetitions, bool trace) {
+    if (trace) {
+        Tracer::Start();
+    }
+    BenchmarkRun run = benchmark.setup();
+    // One untimed run warms the caches and the allocator.
+    Result result{benchmark.name, run(), {}};
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.seconds.push_back(elapsed.count());
+    }
+    return result;
+}
+
+// The interpreter never frees cyclic scopes, so a benchmark would inherit the
+// heap every earlier one left behind. Each runs in a child process instead and
+// reports its timings through a pipe.
+bool MeasureIsolated(const Benchmark& benchmark, int repetitions, bool trace, Result* result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        Result measured = Measure(benchmark, repetitions, trace);
+        std::string out;
+        out.append(reinterpret_cast<const char*>(&measured.items), sizeof(measured.items));
+        out.append(reinterpret_cast<const char*>(measured.seconds.data()),
+                   measured.seconds.size() * sizeof(double));
+        size_t written = 0;
+        while (written < out.size()) {
+            ssize_t n = write(fds[1], out.data() + written, out.size() - written);
+            if (n <= 0) {
+                _exit(1);
+            }
+            written += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    std::string in;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        in.append(buffer, n);
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    size_t expected = sizeof(size_t) + repetitions * sizeof(double);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || in.size() != expected) {
+        return false;
+    }
+    result->name = benchmark.name;
+    std::memcpy(&result->items, in.data(), sizeof(size_t));
+    result->seconds.resize(repetitions);
+    std::memcpy(result->seconds.data(), in.data() + sizeof(size_t), repetitions * sizeof(double));
+    return true;
+}
+
+void* RunBench(void* raw_args) {
+    auto* args = static_cast<BenchArgs*>(raw_args);
+    std::vector<Result> results;
+    for (auto& benchmark : MakeBenchmarks()) {
+        if (args->list) {
+            std::cout << benchmark.name << "\n";
+            continue;
+        }
+        if (benchmark.name.find(args->filter) == std::string::npos) {
+            continue;
+        }
+        Result result;
+        if (!MeasureIsolated(benchmark, args->repetitions, args->trace, &result)) {
+            std::cerr << benchmark.name << ": failed" << std::endl;
+            std::exit(1);
+        }
+        std::cerr << benchmark.name << ": " << result.seconds.back() * 1e3 << " ms" << std::endl;
+        results.push_back(std::move(result));
+    }
+    if (args->list) {
+        return nullptr;
+    }
+    std::string json = ToJson(results);
+    if (args->output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(args->output) << json;
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchArgs args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--list") {
+            args.list = true;
+        } else if (arg == "--trace") {
+            args.trace = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            args.filter = argv[++i];
+        } else if (arg == "--repetitions" && i + 1 < argc) {
+            args.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--output" && i + 1 < argc) {
+            args.output = argv[++i];
+        } else {
+            std::cerr << "Usage: scheme_bench [--filter SUBSTRING] [--repetitions N]"
+                         " [--output FILE] [--list] [--trace]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, kStackSize);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, RunBench, &args) != 0) {
+        std::cerr << "Can't start the benchmark thread" << std::endl;
+        return 1;
+    }
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Reports how fast a large data literal is classified into structural masks
+// at every SIMD level this CPU supports, and how fast it is tokenized.
+// Usage: bench_tokenizer_throughput [megabytes]
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../tokenizer.h"
+
+namespace {
+
+std::string MakeLiteral(size_t bytes) {
+    std::string text = "'(";
+    for (size_t i = 0; text.size() < bytes; ++i) {
+        std::string id = std::to_string(i % 100000);
+        text += "(item " + id + " \"name-" + id + "\" (tag-a tag-b) (1 -2 3 . 4)) ";
+    }
+    text += ")";
+    return text;
+}
+
+template <class F>
+double GigabytesPerSecond(size_t bytes, F&& run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return bytes / elapsed.count() / 1e9;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = 256;
+    if (argc > 1) {
+        megabytes = std::atoi(argv[1]);
+    }
+    std::string text = MakeLiteral(megabytes << 20);
+    std::cout << "literal: " << text.size() << " bytes" << std::endl;
+
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (GetSimdLevel() >= SimdLevel::SSE2) {
+        levels.push_back(SimdLevel::SSE2);
+    }
+    if (GetSimdLevel() >= SimdLevel::AVX2) {
+        levels.push_back(SimdLevel::AVX2);
+    }
+    for (SimdLevel level : levels) {
+        uint64_t starts = 0;
+        double speed = GigabytesPerSecond(text.size(), [&]() {
+            for (size_t offset = 0; offset < text.size(); offset += 64) {
+                starts += __builtin_popcountll(
+                    ClassifyBlock(level, text.data(), text.size(), offset).token_start);
+            }
+        });
+        std::cout << "classify " << GetSimdLevelName(level) << ": " << speed << " GB/s ("
+                  << starts << " token starts)" << std::endl;
+    }
+
+    size_t tokens = 0;
+    double speed = GigabytesPerSecond(text.size(), [&]() {
+        Tokenizer tokenizer{std::string_view(text)};
+        while (!tokenizer.IsEnd()) {
+            tokenizer.Next();
+            ++tokens;
+        }
+    });
+    std::cout << "tokenize (" << GetSimdLevelName(GetSimdLevel()) << "): " << speed << " GB/s ("
+              << tokens << " tokens)" << std::endl;
+    return 0;
+}
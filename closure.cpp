@@ -0,0 +1,333 @@
+#include "closure.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "expander.h"
+
+namespace {
+
+bool DefaultFlattening() {
+    const char* env = std::getenv("SCHEME_FLAT_CLOSURES");
+    return !env || std::strcmp(env, "0") != 0;
+}
+
+std::atomic<bool> flattening{DefaultFlattening()};
+
+using NameSet = std::unordered_set<std::string>;
+
+const std::string* HeadName(const std::shared_ptr<Object>& form) {
+    if (!Is<Cell>(form)) {
+        return nullptr;
+    }
+    std::shared_ptr<Object> head = As<Cell>(form)->GetFirst();
+    return Is<Symbol>(head) ? &As<Symbol>(head)->GetName() : nullptr;
+}
+
+// The elements of a list, with a dotted tail as the last one.
+ObjectVectorBase Elements(const std::shared_ptr<Object>& list) {
+    ObjectVectorBase items;
+    std::shared_ptr<Object> tail = list;
+    while (Is<Cell>(tail)) {
+        auto cell = As<Cell>(tail);
+        items.push_back(cell->GetFirst());
+        tail = cell->GetSecond();
+    }
+    if (tail) {
+        items.push_back(tail);
+    }
+    return items;
+}
+
+NameSet SymbolNames(const ObjectVectorBase& items) {
+    NameSet names;
+    for (const auto& item : items) {
+        if (Is<Symbol>(item)) {
+            names.insert(As<Symbol>(item)->GetName());
+        }
+    }
+    return names;
+}
+
+// Walks the body of one closure. Parameters and let variables are bound from
+// the start of their bodies; a define binds its name only once it runs, so the
+// names of defines stay free.
+class Analyzer {
+public:
+    Analyzer(ClosureShape* shape, NameSet params) : shape_(shape) {
+        layers_.push_back(std::move(params));
+    }
+
+    // call_level: form runs in the scope of the call, not in one of a let,
+    // loop or future.
+    void Walk(const std::shared_ptr<Object>& form, bool call_level) {
+        if (Is<Symbol>(form)) {
+            Refer(As<Symbol>(form)->GetName());
+            return;
+        }
+        if (!Is<Cell>(form)) {
+            return;
+        }
+        DepthGuard depth_guard;
+        ObjectVectorBase items = Elements(form);
+        const std::string* head = HeadName(form);
+        if (!head) {
+            WalkAll(items, 0, call_level);
+        } else if (*head == "quote" || *head == "define-library" || *head == "import") {
+            return;
+        } else if (*head == "lambda" && items.size() >= 2) {
+            AddNested(items[1], SymbolNames(Elements(items[1])), items);
+        } else if ((*head == "define" || *head == "define-memoized") && items.size() >= 2 &&
+                   Is<Cell>(items[1])) {
+            // (define (name var ...) body ...)
+            ObjectVectorBase signature = Elements(items[1]);
+            if (Is<Symbol>(signature[0])) {
+                Define(As<Symbol>(signature[0])->GetName(), call_level);
+            }
+            signature.erase(signature.begin());
+            AddNested(items[1], SymbolNames(signature), items);
+        } else if (*head == "define" && items.size() >= 2 && Is<Symbol>(items[1])) {
+            Define(As<Symbol>(items[1])->GetName(), call_level);
+            WalkAll(items, 2, call_level);
+        } else if (*head == "set!" && items.size() >= 2 && Is<Symbol>(items[1])) {
+            Refer(As<Symbol>(items[1])->GetName());
+            shape_->assigned.insert(As<Symbol>(items[1])->GetName());
+            WalkAll(items, 2, call_level);
+        } else if ((*head == "let" || *head == kLoopForm) && items.size() >= 2) {
+            NameSet bound;
+            for (const auto& binding : Elements(items[1])) {
+                ObjectVectorBase parts = Is<Cell>(binding) ? Elements(binding) : ObjectVectorBase{};
+                if (!parts.empty() && Is<Symbol>(parts[0])) {
+                    bound.insert(As<Symbol>(parts[0])->GetName());
+                }
+                WalkAll(parts, 1, call_level);
+            }
+            layers_.push_back(std::move(bound));
+            WalkAll(items, 2, false);
+            layers_.pop_back();
+        } else if (*head == "future") {
+            Refer(*head);
+            WalkAll(items, 1, false);
+        } else {
+            WalkAll(items, 0, call_level);
+        }
+    }
+
+    // The variables the calls box: parameters and inner defines that closures
+    // made by the body use, if anything may change them.
+    void Finish() {
+        auto box = [&](const std::string& name) {
+            if (nested_free_.count(name) &&
+                (call_defines_.count(name) || shape_->assigned.count(name))) {
+                shape_->boxed.push_back(name);
+            }
+        };
+        for (const auto& name : layers_.front()) {
+            box(name);
+        }
+        for (const auto& name : call_defines_) {
+            if (!layers_.front().count(name)) {
+                box(name);
+            }
+        }
+    }
+
+private:
+    void WalkAll(const ObjectVectorBase& items, size_t begin, bool call_level) {
+        for (size_t i = begin; i < items.size(); ++i) {
+            Walk(items[i], call_level);
+        }
+    }
+
+    void Refer(const std::string& name) {
+        for (const auto& layer : layers_) {
+            if (layer.count(name)) {
+                return;
+            }
+        }
+        if (seen_.insert(name).second) {
+            shape_->free.push_back(name);
+        }
+    }
+
+    void Define(const std::string& name, bool call_level) {
+        shape_->assigned.insert(name);
+        (call_level ? call_defines_ : shape_->block_defines).insert(name);
+    }
+
+    // A closure with the body items[2..].
+    void AddNested(const std::shared_ptr<Object>& params_form, NameSet params,
+                   const ObjectVectorBase& items) {
+        ObjectVectorBase body(items.begin() + 2, items.end());
+        auto nested = std::make_shared<ClosureShape>();
+        Analyzer analyzer(nested.get(), std::move(params));
+        analyzer.WalkAll(body, 0, true);
+        analyzer.Finish();
+        for (const auto& name : nested->free) {
+            Refer(name);
+            nested_free_.insert(name);
+        }
+        shape_->assigned.insert(nested->assigned.begin(), nested->assigned.end());
+        if (!body.empty() && body[0]) {
+            shape_->nested.emplace(body[0].get(),
+                                   ClosureShape::Nested{params_form.get(), body.size(), nested});
+        }
+    }
+
+    ClosureShape* shape_;
+    // The names bound where the walk is: the parameters, then those of each
+    // let it is in.
+    std::vector<NameSet> layers_;
+    NameSet seen_;
+    NameSet call_defines_;
+    NameSet nested_free_;
+};
+
+// A scope below the global one, with the analysis of the call it belongs to:
+// a block belongs to the nearest call above it.
+struct Link {
+    Scope* scope;
+    const ClosureShape* governing;
+};
+
+// Whether a scope of chain from from on binds name, or may bind it before the
+// global scope gets to.
+bool MayBindAbove(const std::vector<Link>& chain, size_t from, const std::string& name) {
+    for (size_t i = from; i < chain.size(); ++i) {
+        const Link& link = chain[i];
+        Scope::Kind kind = link.scope->GetKind();
+        if (link.scope->FindEntry(name)) {
+            return true;
+        }
+        if (kind != Scope::Kind::CLOSURE &&
+            (!link.governing ||
+             (kind != Scope::Kind::CALL && link.governing->block_defines.count(name)))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+bool IsClosureFlattening() {
+    return flattening.load(std::memory_order_relaxed);
+}
+
+void SetClosureFlattening(bool enabled) {
+    flattening.store(enabled, std::memory_order_relaxed);
+}
+
+std::shared_ptr<const ClosureShape> AnalyzeClosure(const ObjectVectorBase& params,
+                                                   const ObjectVectorBase& body) {
+    auto shape = std::make_shared<ClosureShape>();
+    Analyzer analyzer(shape.get(), SymbolNames(params));
+    for (const auto& form : body) {
+        analyzer.Walk(form, true);
+    }
+    analyzer.Finish();
+    return shape;
+}
+
+std::shared_ptr<const ClosureShape> FindClosureShape(const std::shared_ptr<Scope>& scope,
+                                                     const std::shared_ptr<Object>& params_form,
+                                                     const ObjectVectorBase& params,
+                                                     const ObjectVectorBase& body) {
+    if (!IsClosureFlattening()) {
+        return nullptr;
+    }
+    Scope* call = scope.get();
+    while (call && (call->GetKind() == Scope::Kind::BLOCK ||
+                    call->GetKind() == Scope::Kind::FUTURE)) {
+        call = call->GetParentScope().get();
+    }
+    if (call && call->GetKind() == Scope::Kind::CALL && call->GetShape() && !body.empty()) {
+        const auto& nested = call->GetShape()->nested;
+        auto iter = nested.find(body[0].get());
+        if (iter != nested.end() && iter->second.params == params_form.get() &&
+            iter->second.body_size == body.size()) {
+            return iter->second.shape;
+        }
+    }
+    return AnalyzeClosure(params, body);
+}
+
+std::shared_ptr<Scope> CaptureScope(const std::shared_ptr<Scope>& scope,
+                                    const std::shared_ptr<const ClosureShape>& shape) {
+    if (!shape || !scope->GetParentScope()) {
+        return scope;
+    }
+    std::vector<Link> chain;
+    const std::shared_ptr<Scope>* global = &scope;
+    while ((*global)->GetParentScope()) {
+        chain.push_back({global->get(), nullptr});
+        global = &(*global)->GetParentScope();
+    }
+    const ClosureShape* governing = nullptr;
+    for (auto iter = chain.rbegin(); iter != chain.rend(); ++iter) {
+        if (iter->scope->GetKind() == Scope::Kind::CALL) {
+            governing = iter->scope->GetShape().get();
+        } else if (iter->scope->GetKind() == Scope::Kind::CLOSURE) {
+            governing = nullptr;
+        }
+        iter->governing = governing;
+    }
+
+    std::vector<std::pair<const std::string*, std::shared_ptr<Object>>> captured;
+    captured.reserve(shape->free.size());
+    for (const auto& name : shape->free) {
+        // Past a future's scope, another thread may be using the scopes, so
+        // none of them is changed.
+        bool shared = false;
+        for (size_t i = 0; i < chain.size(); ++i) {
+            const Link& link = chain[i];
+            Scope::Kind kind = link.scope->GetKind();
+            shared = shared || kind == Scope::Kind::FUTURE;
+            const std::shared_ptr<Object>* entry = link.scope->FindEntry(name);
+            if (entry && link.scope->HasBoxes() && Is<Box>(*entry)) {
+                // Until its define runs, an inner define's box passes the name
+                // on to the scopes above, which the record wouldn't keep.
+                if (!As<Box>(*entry)->IsBound() && MayBindAbove(chain, i + 1, name)) {
+                    return scope;
+                }
+                captured.emplace_back(&name, *entry);
+                break;
+            }
+            if (kind == Scope::Kind::CLOSURE) {
+                if (entry) {
+                    captured.emplace_back(&name, *entry);
+                    break;
+                }
+                continue;
+            }
+            if (!link.governing) {
+                return scope;
+            }
+            if (!entry) {
+                if (kind != Scope::Kind::CALL && link.governing->block_defines.count(name)) {
+                    return scope;
+                }
+                continue;
+            }
+            if (!link.governing->assigned.count(name)) {
+                captured.emplace_back(&name, *entry);
+            } else if (!shared) {
+                captured.emplace_back(&name, link.scope->BoxVariable(name));
+            } else {
+                return scope;
+            }
+            break;
+        }
+    }
+    if (captured.empty()) {
+        return *global;
+    }
+    auto record = MakeSlabShared<Scope>();
+    record->SetKind(Scope::Kind::CLOSURE);
+    record->GetParentScope() = *global;
+    record->Reserve(captured.size());
+    for (auto& [name, value] : captured) {
+        record->AddEntry(*name, std::move(value));
+    }
+    return record;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "object.h"
+
+// Flat closures.
+//
+// A closure keeps only the variables its body uses. The body of a procedure is
+// analyzed once, the closures it makes with it; when a lambda, procedure
+// define or define-memoized runs, each free name of the new closure is looked
+// up in the scopes between the defining one and the global one, and what it is
+// bound to is copied into a closure record: a scope whose parent is the global
+// scope. A closure that uses no local variable gets the global scope itself.
+// Nothing else of the defining scopes stays alive through the closure.
+//
+// A variable that may change once the closure is made is shared instead: it is
+// kept in a Box that both its scope and the record bind. The parameters and
+// inner defines of a procedure that its closures use and that a set! or define
+// changes are boxed as its call starts, an inner define's box unbound until
+// the define runs, so closures may refer to procedures defined after them; a
+// let or loop variable is boxed when the first closure takes it. A loop whose
+// scope holds a box makes a new one for the next iteration.
+//
+// A closure made where the analysis can't tell whether a variable may change
+// or be defined later (in a let or loop outside every procedure, or in a scope
+// whose body defines its free name further on), that would have to box a
+// variable of the scopes a future's body runs below, or that uses an inner
+// define not run yet whose name a scope above binds too (until the define
+// runs, the name means that binding), keeps the defining scope and everything
+// above it, as every closure did before.
+//
+// SCHEME_FLAT_CLOSURES=0 turns this off; SetClosureFlattening does it at run
+// time, for closures made after the call.
+
+struct ClosureShape {
+    struct Nested {
+        // The parameter list of the form, and the number of its body forms.
+        const Object* params = nullptr;
+        size_t body_size = 0;
+        std::shared_ptr<const ClosureShape> shape;
+    };
+
+    // Names the body refers to that its parameters don't bind, with those of
+    // the closures it makes.
+    std::vector<std::string> free;
+    // Variables its calls box from the start.
+    std::vector<std::string> boxed;
+    // Names defined in the body of a let, loop or future of the body.
+    std::unordered_set<std::string> block_defines;
+    // Names a set! or define of the body changes, nested closures included.
+    std::unordered_set<std::string> assigned;
+    // The closures the body makes itself, by their first body form.
+    std::unordered_map<const Object*, Nested> nested;
+};
+
+bool IsClosureFlattening();
+void SetClosureFlattening(bool enabled);
+
+// The analysis of a closure with parameters params (symbols) and body.
+std::shared_ptr<const ClosureShape> AnalyzeClosure(const ObjectVectorBase& params,
+                                                   const ObjectVectorBase& body);
+
+// The analysis of the closure a form with parameter list params_form makes in
+// scope: the one made with the enclosing procedure's, or a new one. nullptr
+// if flattening is off.
+std::shared_ptr<const ClosureShape> FindClosureShape(const std::shared_ptr<Scope>& scope,
+                                                     const std::shared_ptr<Object>& params_form,
+                                                     const ObjectVectorBase& params,
+                                                     const ObjectVectorBase& body);
+
+// The scope a closure of shape made in scope keeps: a closure record, the
+// global scope, or scope itself if shape is nullptr or can't be relied on.
+std::shared_ptr<Scope> CaptureScope(const std::shared_ptr<Scope>& scope,
+                                    const std::shared_ptr<const ClosureShape>& shape);
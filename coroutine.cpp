@@ -0,0 +1,361 @@
+#include "coroutine.h"
+
+#include <string>
+#include <vector>
+#include "expander.h"
+
+namespace {
+
+thread_local Coroutine* current_coroutine = nullptr;
+
+thread_local size_t channel_operations = 0;
+
+ObjectVector Arguments(const std::shared_ptr<Cell>& cell) {
+    if (!cell->GetSecond()) {
+        return {};
+    }
+    return EvaluateList(cell->GetSecond());
+}
+
+// (thunk) with the thunk already evaluated.
+std::shared_ptr<Object> MakeCall(std::shared_ptr<FunctionWrapper> thunk) {
+    auto call = MakeSlabShared<Cell>();
+    call->SetFirst(Quoted(thunk));
+    return call;
+}
+
+// The tail of Cell::Evaluate, for a head that is already evaluated.
+std::shared_ptr<Object> ApplyHead(const std::shared_ptr<Cell>& cell,
+                                  const std::shared_ptr<Object>& head,
+                                  const std::shared_ptr<Scope>& scope) {
+    ObjectVector objects;
+    if (Is<Symbol>(cell->GetFirst()) && As<Symbol>(cell->GetFirst())->GetName() == "quote") {
+        objects = ObjectVectorBase({As<Cell>(cell->GetSecond())->GetFirst()});
+    } else if (cell->GetSecond()) {
+        objects = EvaluateList(cell->GetSecond());
+    }
+    objects.GetScope() = scope;
+    return As<FunctionWrapper>(head)->Apply(objects);
+}
+
+// Suspends the current green thread until `ready` holds. Generators aren't
+// scheduled, so they can't wait on a channel.
+bool MustBlock(bool ready) {
+    if (ready) {
+        return false;
+    }
+    if (Coroutine::Current()->GetKind() == Coroutine::Kind::GENERATOR) {
+        throw RuntimeError(" ");
+    }
+    return true;
+}
+
+}  // namespace
+
+EvalTask EvalSuspendable(std::shared_ptr<Object> expr, std::shared_ptr<Scope> scope) {
+    while (true) {
+        if (!Is<Cell>(expr)) {
+            co_return expr ? expr->Evaluate(scope) : nullptr;
+        }
+        auto cell = As<Cell>(expr);
+        if (!cell->GetFirst()) {
+            co_return cell->Evaluate(scope);
+        }
+        std::shared_ptr<Object> head = cell->GetFirst()->Evaluate(scope);
+        if (Is<Lambda>(head)) {
+            auto lambda = As<Lambda>(head);
+            ObjectVector args = Arguments(cell);
+            args.GetScope() = scope;
+            std::shared_ptr<Scope> call_scope = lambda->BindArguments(args);
+            const ObjectVectorBase& body = lambda->GetBody();
+            if (body.empty()) {
+                co_return nullptr;
+            }
+            for (size_t i = 0; i + 1 < body.size(); ++i) {
+                co_await EvalSuspendable(body[i], call_scope);
+            }
+            expr = body.back();
+            scope = std::move(call_scope);
+            continue;
+        }
+        if (!Is<Function>(head) || !Is<Symbol>(cell->GetFirst())) {
+            co_return ApplyHead(cell, head, scope);
+        }
+        const std::string& name = As<Symbol>(cell->GetFirst())->GetName();
+        ObjectVector args = Arguments(cell);
+        if (name == "yield") {
+            if (args.size() > 1) {
+                throw RuntimeError(" ");
+            }
+            std::shared_ptr<Object> value;
+            if (!args.empty() && args[0]) {
+                value = args[0]->Evaluate(scope);
+            }
+            Coroutine::SuspendAwaiter suspend{std::move(value), false};
+            co_await suspend;
+            co_return nullptr;
+        } else if (name == "if") {
+            if (args.size() < 2 || args.size() > 3) {
+                throw SyntaxError(" ");
+            }
+            std::shared_ptr<Object> condition = co_await EvalSuspendable(args[0], scope);
+            if (condition && condition->operator bool()) {
+                expr = args[1];
+            } else if (args.size() == 3) {
+                expr = args[2];
+            } else {
+                co_return nullptr;
+            }
+            continue;
+        } else if ((name == "define" && args.size() == 2 && Is<Symbol>(args[0])) ||
+                   name == "set!") {
+            if (args.size() != 2) {
+                throw SyntaxError(" ");
+            }
+            std::shared_ptr<Object> value = co_await EvalSuspendable(args[1], scope);
+            if (name == "define") {
+                scope->AddVariable(As<Symbol>(args[0])->GetName(), value);
+            } else {
+                scope->SetVariable(As<Symbol>(args[0])->GetName(), value);
+            }
+            co_return nullptr;
+        } else if (name == "begin" || name == "let" || name == kLoopForm) {
+            std::shared_ptr<Scope> block_scope = scope;
+            std::vector<std::string> names;
+            size_t first = 0;
+            if (name != "begin") {
+                if (args.size() < 2) {
+                    throw SyntaxError(" ");
+                }
+                block_scope = MakeSlabShared<Scope>();
+                block_scope->GetParentScope() = scope;
+                for (auto item = args[0]; item; item = As<Cell>(item)->GetSecond()) {
+                    auto binding = As<Cell>(As<Cell>(item)->GetFirst());
+                    names.push_back(As<Symbol>(binding->GetFirst())->GetName());
+                    std::shared_ptr<Object> value =
+                        co_await EvalSuspendable(As<Cell>(binding->GetSecond())->GetFirst(), scope);
+                    block_scope->AddVariable(names.back(), std::move(value));
+                }
+                first = 1;
+            }
+            if (first == args.size()) {
+                co_return nullptr;
+            }
+            if (name != kLoopForm) {
+                for (size_t i = first; i + 1 < args.size(); ++i) {
+                    co_await EvalSuspendable(args[i], block_scope);
+                }
+                expr = args.back();
+                scope = std::move(block_scope);
+                continue;
+            }
+            // The body runs again for as long as it ends in %recur, as in Loop.
+            while (true) {
+                std::shared_ptr<Object> result;
+                for (size_t i = first; i < args.size(); ++i) {
+                    result = co_await EvalSuspendable(args[i], block_scope);
+                }
+                if (!Is<LoopRecur>(result)) {
+                    co_return result;
+                }
+                const ObjectVectorBase& values = As<LoopRecur>(result)->GetValues();
+                if (values.size() != names.size()) {
+                    throw RuntimeError(" ");
+                }
+                if (block_scope.use_count() != 1 || block_scope->HasBoxes()) {
+                    block_scope = MakeSlabShared<Scope>();
+                    block_scope->GetParentScope() = scope;
+                }
+                for (size_t i = 0; i < names.size(); ++i) {
+                    block_scope->AddVariable(names[i], values[i]);
+                }
+            }
+        } else if (name == "channel-send") {
+            if (args.size() != 2) {
+                throw RuntimeError(" ");
+            }
+            auto channel = As<Channel>(args[0]->Evaluate(scope));
+            std::shared_ptr<Object> value = args[1] ? args[1]->Evaluate(scope) : nullptr;
+            while (MustBlock(channel->CanSend())) {
+                Coroutine::SuspendAwaiter suspend{nullptr, true};
+                co_await suspend;
+            }
+            channel->Send(std::move(value));
+            ++channel_operations;
+            co_return nullptr;
+        } else if (name == "channel-receive") {
+            if (args.size() != 1) {
+                throw RuntimeError(" ");
+            }
+            auto channel = As<Channel>(args[0]->Evaluate(scope));
+            while (MustBlock(channel->CanReceive())) {
+                Coroutine::SuspendAwaiter suspend{nullptr, true};
+                co_await suspend;
+            }
+            ++channel_operations;
+            co_return channel->Receive();
+        }
+        co_return ApplyHead(cell, head, scope);
+    }
+}
+
+Coroutine::Coroutine(Kind kind, std::shared_ptr<FunctionWrapper> thunk,
+                     std::shared_ptr<Scope> scope)
+    : kind_(kind),
+      root_(EvalSuspendable(MakeCall(std::move(thunk)), std::move(scope))),
+      resume_point_(root_.GetHandle()),
+      yielded_(),
+      blocked_(false),
+      suspended_(false) {
+}
+
+bool Coroutine::Resume() {
+    if (IsDone()) {
+        return false;
+    }
+    Coroutine* previous = current_coroutine;
+    current_coroutine = this;
+    blocked_ = false;
+    suspended_ = false;
+    while (!suspended_ && !IsDone()) {
+        resume_point_.resume();
+    }
+    current_coroutine = previous;
+    if (IsDone()) {
+        GetResult();
+        return false;
+    }
+    return true;
+}
+
+bool Coroutine::IsDone() const {
+    return root_.GetHandle().done();
+}
+
+Coroutine::Kind Coroutine::GetKind() const {
+    return kind_;
+}
+
+bool Coroutine::IsBlocked() const {
+    return blocked_;
+}
+
+std::shared_ptr<Object> Coroutine::TakeYielded() {
+    return std::move(yielded_);
+}
+
+std::shared_ptr<Object> Coroutine::GetResult() {
+    auto& promise = root_.GetHandle().promise();
+    if (promise.error) {
+        std::rethrow_exception(promise.error);
+    }
+    return promise.result;
+}
+
+Coroutine* Coroutine::Current() {
+    return current_coroutine;
+}
+
+void Coroutine::SuspendAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    Coroutine* coroutine = current_coroutine;
+    coroutine->resume_point_ = handle;
+    coroutine->yielded_ = std::move(value);
+    coroutine->blocked_ = blocked;
+    coroutine->suspended_ = true;
+}
+
+void ContinueWith(std::coroutine_handle<> next) {
+    current_coroutine->resume_point_ = next;
+}
+
+Generator::Generator(std::shared_ptr<FunctionWrapper> thunk, std::shared_ptr<Scope> scope)
+    : coroutine_(Coroutine::Kind::GENERATOR, std::move(thunk), std::move(scope)),
+      has_pending_(false),
+      pending_() {
+}
+
+void Generator::Advance() {
+    if (has_pending_ || coroutine_.IsDone()) {
+        return;
+    }
+    if (coroutine_.Resume()) {
+        pending_ = coroutine_.TakeYielded();
+        has_pending_ = true;
+    }
+}
+
+bool Generator::IsDone() {
+    Advance();
+    return !has_pending_;
+}
+
+std::shared_ptr<Object> Generator::Next() {
+    Advance();
+    if (!has_pending_) {
+        throw RuntimeError(" ");
+    }
+    has_pending_ = false;
+    return std::move(pending_);
+}
+
+GreenThreads& GreenThreads::Instance() {
+    thread_local GreenThreads threads;
+    return threads;
+}
+
+void GreenThreads::Spawn(std::shared_ptr<FunctionWrapper> thunk, std::shared_ptr<Scope> scope) {
+    threads_.push_back(
+        std::make_unique<Coroutine>(Coroutine::Kind::THREAD, std::move(thunk), std::move(scope)));
+}
+
+bool GreenThreads::RunRound() {
+    if (Coroutine::Current()) {
+        // Plain code inside a coroutine can't wait for other threads.
+        throw RuntimeError(" ");
+    }
+    size_t count = threads_.size();
+    size_t operations = channel_operations;
+    bool progress = false;
+    for (size_t i = 0; i < count; ++i) {
+        std::unique_ptr<Coroutine> thread = std::move(threads_.front());
+        threads_.pop_front();
+        if (!thread->Resume()) {
+            progress = true;
+            continue;
+        }
+        if (!thread->IsBlocked()) {
+            progress = true;
+        }
+        threads_.push_back(std::move(thread));
+    }
+    return progress || operations != channel_operations;
+}
+
+void GreenThreads::RunAll() {
+    while (RunRound()) {
+    }
+    if (!threads_.empty()) {
+        threads_.clear();
+        throw RuntimeError(" ");
+    }
+}
+
+void SendWaiting(Channel& channel, std::shared_ptr<Object> value) {
+    while (!channel.CanSend()) {
+        if (Coroutine::Current() || !GreenThreads::Instance().RunRound()) {
+            throw RuntimeError(" ");
+        }
+    }
+    channel.Send(std::move(value));
+    ++channel_operations;
+}
+
+std::shared_ptr<Object> ReceiveWaiting(Channel& channel) {
+    while (!channel.CanReceive()) {
+        if (Coroutine::Current() || !GreenThreads::Instance().RunRound()) {
+            throw RuntimeError(" ");
+        }
+    }
+    ++channel_operations;
+    return channel.Receive();
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include "object.h"
+
+// Generators and green threads.
+//
+// The regular evaluator is plain recursive C++, so it can't be suspended.
+// Generator and thread bodies run on EvalSuspendable instead: a C++20 coroutine
+// that understands the positions where a suspension may happen and hands
+// everything else to Object::Evaluate. Those positions are the forms of a lambda
+// body, the branches and the condition of `if`, the value of `define`/`set!`,
+// and `yield`/`channel-send`/`channel-receive` themselves. A call in tail
+// position reuses the current frame, so a tail-recursive producer loop runs in
+// constant memory.
+
+// Frames never resume each other directly: the awaiting side only records which
+// frame runs next, and Coroutine::Resume keeps resuming from its own loop. This
+// keeps the native stack flat no matter how many calls complete in a row.
+void ContinueWith(std::coroutine_handle<> next);
+
+class EvalTask {
+public:
+    struct promise_type {
+        std::shared_ptr<Object> result;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        EvalTask get_return_object() {
+            return EvalTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                if (h.promise().continuation) {
+                    ContinueWith(h.promise().continuation);
+                }
+            }
+
+            void await_resume() noexcept {
+            }
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_value(std::shared_ptr<Object> value) {
+            result = std::move(value);
+        }
+
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+    };
+
+    EvalTask(EvalTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {
+    }
+
+    EvalTask& operator=(EvalTask&& other) noexcept {
+        if (this != &other) {
+            Destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+
+    EvalTask(const EvalTask&) = delete;
+    EvalTask& operator=(const EvalTask&) = delete;
+
+    ~EvalTask() {
+        Destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation = awaiting;
+        ContinueWith(handle_);
+    }
+
+    std::shared_ptr<Object> await_resume() {
+        if (handle_.promise().error) {
+            std::rethrow_exception(handle_.promise().error);
+        }
+        return std::move(handle_.promise().result);
+    }
+
+    std::coroutine_handle<promise_type> GetHandle() const {
+        return handle_;
+    }
+
+private:
+    explicit EvalTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {
+    }
+
+    void Destroy() {
+        if (handle_) {
+            handle_.destroy();
+            handle_ = {};
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Owns one suspendable evaluation: the root task plus the innermost frame that
+// has to be resumed next.
+class Coroutine {
+public:
+    enum class Kind { GENERATOR, THREAD };
+
+    Coroutine(Kind kind, std::shared_ptr<FunctionWrapper> thunk, std::shared_ptr<Scope> scope);
+
+    // Runs until the next suspension; returns false once the body has finished.
+    bool Resume();
+
+    bool IsDone() const;
+    Kind GetKind() const;
+    std::shared_ptr<Object> TakeYielded();
+    std::shared_ptr<Object> GetResult();
+
+    // The coroutine being resumed on this thread, nullptr in plain evaluation.
+    static Coroutine* Current();
+
+    struct SuspendAwaiter {
+        std::shared_ptr<Object> value;
+        bool blocked;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        void await_resume() const noexcept {
+        }
+    };
+
+    bool IsBlocked() const;
+
+private:
+    friend void ContinueWith(std::coroutine_handle<> next);
+
+    Kind kind_;
+    EvalTask root_;
+    std::coroutine_handle<> resume_point_;
+    std::shared_ptr<Object> yielded_;
+    bool blocked_;
+    bool suspended_;
+};
+
+EvalTask EvalSuspendable(std::shared_ptr<Object> expr, std::shared_ptr<Scope> scope);
+
+class Generator : public Object {
+public:
+    Generator(std::shared_ptr<FunctionWrapper> thunk, std::shared_ptr<Scope> scope);
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    bool IsDone();
+    std::shared_ptr<Object> Next();
+
+private:
+    void Advance();
+
+    Coroutine coroutine_;
+    bool has_pending_;
+    std::shared_ptr<Object> pending_;
+};
+
+class Channel : public Object {
+public:
+    // Capacity 0 means unbounded.
+    explicit Channel(size_t capacity) : capacity_(capacity) {
+    }
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    bool CanSend() const {
+        return capacity_ == 0 || values_.size() < capacity_;
+    }
+
+    bool CanReceive() const {
+        return !values_.empty();
+    }
+
+    void Send(std::shared_ptr<Object> value) {
+        values_.push_back(std::move(value));
+    }
+
+    std::shared_ptr<Object> Receive() {
+        std::shared_ptr<Object> value = std::move(values_.front());
+        values_.pop_front();
+        return value;
+    }
+
+private:
+    size_t capacity_;
+    std::deque<std::shared_ptr<Object>> values_;
+};
+
+// Round-robin scheduler of the green threads started by `spawn`. Each OS thread
+// has its own one; threads only run while plain code waits on them.
+class GreenThreads {
+public:
+    static GreenThreads& Instance();
+
+    void Spawn(std::shared_ptr<FunctionWrapper> thunk, std::shared_ptr<Scope> scope);
+
+    // Resumes every runnable thread once. Returns false if nothing could make
+    // progress: no threads left, or all of them wait on channels.
+    bool RunRound();
+
+    void RunAll();
+
+private:
+    std::deque<std::unique_ptr<Coroutine>> threads_;
+};
+
+// Channel operations from plain code: they run the green threads until the
+// channel is ready and fail if that never happens.
+void SendWaiting(Channel& channel, std::shared_ptr<Object> value);
+std::shared_ptr<Object> ReceiveWaiting(Channel& channel);
@@ -0,0 +1,185 @@
+#include "environment.h"
+
+#include <functional>
+#include "object.h"
+
+namespace {
+
+constexpr int kBits = 5;
+constexpr int kHashBits = 64;
+
+std::atomic<uint64_t> next_owner{0};
+
+uint64_t NewOwner() {
+    return next_owner.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+uint64_t HashName(const std::string& name) {
+    return std::hash<std::string>()(name);
+}
+
+}  // namespace
+
+struct Environment::Binding {
+    std::shared_ptr<Object> value;
+    uint64_t owner;
+};
+
+struct Environment::Leaf {
+    uint64_t hash;
+    std::string name;
+    std::shared_ptr<Binding> binding;
+};
+
+Environment::Environment() : owner_(NewOwner()) {
+}
+
+const Environment::Leaf* Environment::FindLeaf(const std::string& name, uint64_t hash) const {
+    const Node* node = root_.get();
+    for (int shift = 0; node; shift += kBits) {
+        if (shift >= kHashBits) {
+            for (const auto& child : node->children) {
+                if (child.leaf->name == name) {
+                    return child.leaf.get();
+                }
+            }
+            return nullptr;
+        }
+        uint32_t bit = uint32_t{1} << ((hash >> shift) & 31);
+        if (!(node->bitmap & bit)) {
+            return nullptr;
+        }
+        const Child& child = node->children[__builtin_popcount(node->bitmap & (bit - 1))];
+        if (child.leaf) {
+            return child.leaf->name == name ? child.leaf.get() : nullptr;
+        }
+        node = child.node.get();
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object>* Environment::Find(const std::string& name) const {
+    const Leaf* leaf = FindLeaf(name, HashName(name));
+    return leaf ? &leaf->binding->value : nullptr;
+}
+
+std::shared_ptr<const Environment::Node> Environment::Insert(
+    const std::shared_ptr<const Node>& node, int shift, std::shared_ptr<const Leaf> leaf) {
+    auto copy = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+    if (shift >= kHashBits) {
+        for (auto& child : copy->children) {
+            if (child.leaf->name == leaf->name) {
+                child.leaf = std::move(leaf);
+                return copy;
+            }
+        }
+        copy->children.push_back({nullptr, std::move(leaf)});
+        return copy;
+    }
+    uint32_t bit = uint32_t{1} << ((leaf->hash >> shift) & 31);
+    size_t index = __builtin_popcount(copy->bitmap & (bit - 1));
+    if (!(copy->bitmap & bit)) {
+        copy->bitmap |= bit;
+        copy->children.insert(copy->children.begin() + index, {nullptr, std::move(leaf)});
+        return copy;
+    }
+    Child& child = copy->children[index];
+    if (child.node) {
+        child.node = Insert(child.node, shift + kBits, std::move(leaf));
+    } else if (child.leaf->name == leaf->name) {
+        child.leaf = std::move(leaf);
+    } else {
+        // Two names in one slot: they move one level down.
+        child.node = Insert(Insert(nullptr, shift + kBits, std::move(child.leaf)),
+                            shift + kBits, std::move(leaf));
+        child.leaf = nullptr;
+    }
+    return copy;
+}
+
+void Environment::Rebind(const std::string& name, uint64_t hash, std::shared_ptr<Object> value) {
+    auto binding = std::make_shared<Binding>(Binding{std::move(value), owner_});
+    root_ = Insert(root_, 0, std::make_shared<const Leaf>(Leaf{hash, name, std::move(binding)}));
+    stamp_.store(0, std::memory_order_relaxed);
+}
+
+void Environment::Define(const std::string& name, std::shared_ptr<Object> value) {
+    uint64_t hash = HashName(name);
+    const Leaf* leaf = FindLeaf(name, hash);
+    if (leaf && leaf->binding->owner == owner_) {
+        leaf->binding->value = std::move(value);
+        return;
+    }
+    Rebind(name, hash, std::move(value));
+}
+
+bool Environment::Assign(const std::string& name, std::shared_ptr<Object> value) {
+    uint64_t hash = HashName(name);
+    const Leaf* leaf = FindLeaf(name, hash);
+    if (!leaf) {
+        return false;
+    }
+    if (leaf->binding->owner == owner_) {
+        leaf->binding->value = std::move(value);
+    } else {
+        Rebind(name, hash, std::move(value));
+    }
+    return true;
+}
+
+uint64_t Environment::GetStamp() {
+    uint64_t stamp = stamp_.load(std::memory_order_relaxed);
+    if (stamp == 0) {
+        uint64_t fresh = Scope::NewStamp();
+        stamp = stamp_.compare_exchange_strong(stamp, fresh, std::memory_order_relaxed) ? fresh
+                                                                                           : stamp;
+    }
+    return stamp;
+}
+
+std::shared_ptr<Environment> Environment::Fork() {
+    auto fork = std::make_shared<Environment>();
+    fork->root_ = root_;
+    // The same names in the same bindings, so call sites resolved in one hold
+    // in the other.
+    fork->stamp_.store(GetStamp(), std::memory_order_relaxed);
+    // Neither side may change the bindings they now share.
+    owner_ = NewOwner();
+    return fork;
+}
+
+void Environment::ForEach(
+    FunctionRef<void(const std::string&, const std::shared_ptr<Object>&)> visit) const {
+    std::vector<const Node*> pending;
+    if (root_) {
+        pending.push_back(root_.get());
+    }
+    while (!pending.empty()) {
+        const Node* node = pending.back();
+        pending.pop_back();
+        for (const auto& child : node->children) {
+            if (child.leaf) {
+                visit(child.leaf->name, child.leaf->binding->value);
+            } else {
+                pending.push_back(child.node.get());
+            }
+        }
+    }
+}
+
+EnvironmentScope::EnvironmentScope(const Scope* scope, std::shared_ptr<Environment> environment)
+    : environment_(std::move(environment)), previous_(environment_detail::active) {
+    environment_detail::active = {scope, environment_.get()};
+}
+
+EnvironmentScope::~EnvironmentScope() {
+    environment_detail::active = previous_;
+}
+
+std::pair<const Scope*, std::shared_ptr<Environment>> EnvironmentScope::Current() {
+    const environment_detail::Active& active = environment_detail::active;
+    if (!active.environment) {
+        return {};
+    }
+    return {active.scope, active.environment->shared_from_this()};
+}
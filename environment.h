@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "function_ref.h"
+
+class Object;
+class Scope;
+
+// Persistent global environments.
+//
+// A global scope keeps its bindings in an Environment: a hash array mapped trie
+// from names to bindings whose nodes never change once built. Binding a new
+// name copies the path to it, at most 14 nodes of up to 32 children, and shares
+// everything else, so Fork is O(1): the fork starts from the same trie, and
+// from then on each side copies what it changes. A binding is changed in place
+// only by the environment that made it since its last fork; any other rebinds
+// the name to a binding of its own, which changes its stamp like a new name
+// does.
+//
+// Closures refer to the global Scope object, so the interpreters forked from
+// one share it, and an EnvironmentScope makes a thread see a fork's environment
+// through it.
+class Environment : public std::enable_shared_from_this<Environment> {
+public:
+    Environment();
+
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+
+    // The value of name, or nullptr if it isn't bound. The slot stays put
+    // until this environment's stamp changes.
+    std::shared_ptr<Object>* Find(const std::string& name) const;
+
+    // Binds name to value.
+    void Define(const std::string& name, std::shared_ptr<Object> value);
+
+    // Rebinds name; false if it isn't bound.
+    bool Assign(const std::string& name, std::shared_ptr<Object> value);
+
+    // Changes whenever a name is added or rebound to a binding of its own, and
+    // is shared only with forks that have the same bindings.
+    uint64_t GetStamp();
+
+    // An environment with the same bindings, independent of this one.
+    std::shared_ptr<Environment> Fork();
+
+    void ForEach(FunctionRef<void(const std::string&, const std::shared_ptr<Object>&)> visit) const;
+
+private:
+    struct Binding;
+    struct Leaf;
+    struct Node;
+
+    struct Child {
+        // One of them is set.
+        std::shared_ptr<const Node> node;
+        std::shared_ptr<const Leaf> leaf;
+    };
+
+    struct Node {
+        // Bit i is set if the child for the next 5 bits of hash i is present;
+        // children are kept in the order of their bits. Below the last level
+        // the bitmap is unused and the children are the leaves of names whose
+        // hashes are equal.
+        uint32_t bitmap = 0;
+        std::vector<Child> children;
+    };
+
+    const Leaf* FindLeaf(const std::string& name, uint64_t hash) const;
+    static std::shared_ptr<const Node> Insert(const std::shared_ptr<const Node>& node, int shift,
+                                              std::shared_ptr<const Leaf> leaf);
+    void Rebind(const std::string& name, uint64_t hash, std::shared_ptr<Object> value);
+
+    std::shared_ptr<const Node> root_;
+    // The bindings made under this owner may be changed in place.
+    uint64_t owner_;
+    std::atomic<uint64_t> stamp_{0};
+};
+
+namespace environment_detail {
+
+// The environment the calling thread sees through scope instead of its own.
+struct Active {
+    const Scope* scope = nullptr;
+    Environment* environment = nullptr;
+};
+
+inline thread_local Active active;
+
+}  // namespace environment_detail
+
+// Makes the calling thread see environment through the global scope until it
+// is destroyed.
+class EnvironmentScope {
+public:
+    EnvironmentScope(const Scope* scope, std::shared_ptr<Environment> environment);
+    ~EnvironmentScope();
+
+    EnvironmentScope(const EnvironmentScope&) = delete;
+    EnvironmentScope& operator=(const EnvironmentScope&) = delete;
+
+    // What the calling thread sees now, for handing to another thread; empty if
+    // it sees every scope's own.
+    static std::pair<const Scope*, std::shared_ptr<Environment>> Current();
+
+private:
+    std::shared_ptr<Environment> environment_;
+    environment_detail::Active previous_;
+};
@@ -13,3 +13,9 @@ struct RuntimeError : public std::runtime_error {
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
+
+// An evaluation ran out of the steps, heap bytes or time its limits allow
+// (see eval_limits.h).
+struct LimitError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
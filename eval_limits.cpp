@@ -0,0 +1,127 @@
+#include "eval_limits.h"
+
+#include <algorithm>
+#include "error.h"
+
+namespace {
+
+thread_local std::shared_ptr<Budget> current_budget;
+
+int64_t Allowance(uint64_t limit) {
+    if (limit == 0) {
+        return limits_detail::kUnlimited;
+    }
+    return static_cast<int64_t>(std::min<uint64_t>(limit, limits_detail::kUnlimited));
+}
+
+}  // namespace
+
+Budget::Budget(const EvaluationLimits& limits)
+    : steps_left_(Allowance(limits.max_steps)),
+      heap_left_(Allowance(limits.max_heap_bytes)),
+      has_deadline_(limits.timeout.count() != 0),
+      deadline_(std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(limits.timeout)) {
+}
+
+const std::shared_ptr<Budget>& Budget::Current() {
+    return current_budget;
+}
+
+void Budget::CheckDeadline() const {
+    if (has_deadline_ && std::chrono::steady_clock::now() >= deadline_) {
+        throw LimitError(" ");
+    }
+}
+
+int64_t Budget::Take(std::atomic<int64_t>& left, int64_t wanted) {
+    int64_t available = left.load(std::memory_order_relaxed);
+    while (available > 0) {
+        int64_t taken = std::min(available, wanted);
+        if (left.compare_exchange_weak(available, available - taken,
+                                       std::memory_order_relaxed)) {
+            return taken;
+        }
+    }
+    return 0;
+}
+
+int64_t Budget::TakeSteps(int64_t wanted) {
+    return Take(steps_left_, wanted);
+}
+
+int64_t Budget::TakeHeap(int64_t wanted) {
+    return Take(heap_left_, wanted);
+}
+
+void Budget::ReturnSteps(int64_t steps) {
+    steps_left_.fetch_add(steps, std::memory_order_relaxed);
+}
+
+void Budget::ReturnHeap(int64_t bytes) {
+    heap_left_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+BudgetScope::BudgetScope(std::shared_ptr<Budget> budget)
+    : previous_(std::move(current_budget)),
+      previous_steps_(limits_detail::step_lease),
+      previous_heap_(limits_detail::heap_lease) {
+    current_budget = std::move(budget);
+    // Empty leases: the first step and allocation take them from the budget.
+    limits_detail::step_lease = current_budget ? 0 : limits_detail::kUnlimited;
+    limits_detail::heap_lease = current_budget ? 0 : limits_detail::kUnlimited;
+}
+
+BudgetScope::~BudgetScope() {
+    if (current_budget) {
+        current_budget->ReturnSteps(std::max<int64_t>(limits_detail::step_lease, 0));
+        current_budget->ReturnHeap(limits_detail::heap_lease);
+    }
+    current_budget = std::move(previous_);
+    limits_detail::step_lease = previous_steps_;
+    limits_detail::heap_lease = previous_heap_;
+}
+
+namespace limits_detail {
+
+void RefillSteps() {
+    Budget* budget = current_budget.get();
+    if (!budget) {
+        step_lease = kUnlimited;
+        return;
+    }
+    step_lease = 0;
+    budget->CheckDeadline();
+    int64_t steps = budget->TakeSteps(Budget::kStepLease);
+    if (steps == 0) {
+        throw LimitError(" ");
+    }
+    // One of them is the step being charged.
+    step_lease = steps - 1;
+}
+
+void RefillHeap(int64_t bytes) {
+    Budget* budget = current_budget.get();
+    if (!budget) {
+        heap_lease = kUnlimited;
+        return;
+    }
+    int64_t deficit = -heap_lease;
+    int64_t taken = budget->TakeHeap(deficit + Budget::kHeapLease);
+    if (taken < deficit) {
+        budget->ReturnHeap(taken);
+        // The allocation doesn't happen, so it isn't charged.
+        heap_lease += bytes;
+        throw LimitError(" ");
+    }
+    heap_lease += taken;
+}
+
+void ReturnHeapSurplus() {
+    if (Budget* budget = current_budget.get()) {
+        budget->ReturnHeap(heap_lease - Budget::kHeapLease);
+        heap_lease = Budget::kHeapLease;
+    }
+}
+
+}  // namespace limits_detail
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Evaluation limits.
+//
+// An Interpreter with limits gives every Run call a Budget of evaluation
+// steps (applications evaluated), heap bytes and wall-clock time; running out
+// of any of them throws a LimitError. Threads take steps and bytes from the
+// budget in leases and count against their lease with a thread-local
+// decrement, so a limit costs about as much as a runtime counter. The deadline
+// is checked whenever a thread needs a new lease of steps, that is every
+// kStepLease steps. Tasks a Run hands to the thread pool (futures,
+// parallel-map) draw from its budget too.
+//
+// Heap bytes are those of cells, numbers and scopes, of the arrays of packed
+// lists and of strings, less what is freed while the budget is in force, so
+// the quota bounds how much a call may grow the heap. Blocking operations
+// (touching a future, reading a pipe) don't check the deadline.
+
+struct EvaluationLimits {
+    // 0 means no limit for each of them.
+    uint64_t max_steps = 0;
+    uint64_t max_heap_bytes = 0;
+    std::chrono::nanoseconds timeout{0};
+
+    bool IsSet() const {
+        return max_steps != 0 || max_heap_bytes != 0 || timeout.count() != 0;
+    }
+};
+
+class Budget {
+public:
+    static constexpr int64_t kStepLease = 4096;
+    static constexpr int64_t kHeapLease = 64 * 1024;
+
+    explicit Budget(const EvaluationLimits& limits);
+
+    // The budget the calling thread charges, or nullptr.
+    static const std::shared_ptr<Budget>& Current();
+
+    // Throws a LimitError once the deadline has passed.
+    void CheckDeadline() const;
+
+    // Up to wanted units of what is left; 0 if nothing is.
+    int64_t TakeSteps(int64_t wanted);
+    int64_t TakeHeap(int64_t wanted);
+    void ReturnSteps(int64_t steps);
+    void ReturnHeap(int64_t bytes);
+
+private:
+    static int64_t Take(std::atomic<int64_t>& left, int64_t wanted);
+
+    std::atomic<int64_t> steps_left_;
+    std::atomic<int64_t> heap_left_;
+    bool has_deadline_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+// Makes budget the one the calling thread charges until it is destroyed, and
+// gives back what the thread leased from it then.
+class BudgetScope {
+public:
+    explicit BudgetScope(std::shared_ptr<Budget> budget);
+    ~BudgetScope();
+
+    BudgetScope(const BudgetScope&) = delete;
+    BudgetScope& operator=(const BudgetScope&) = delete;
+
+private:
+    std::shared_ptr<Budget> previous_;
+    int64_t previous_steps_;
+    int64_t previous_heap_;
+};
+
+namespace limits_detail {
+
+// Without a budget the leases are so large they never run out.
+inline constexpr int64_t kUnlimited = INT64_MAX / 4;
+
+inline thread_local int64_t step_lease = kUnlimited;
+inline thread_local int64_t heap_lease = kUnlimited;
+
+void RefillSteps();
+void RefillHeap(int64_t bytes);
+void ReturnHeapSurplus();
+
+}  // namespace limits_detail
+
+// One evaluation step.
+inline void ChargeStep() {
+    if (--limits_detail::step_lease < 0) {
+        limits_detail::RefillSteps();
+    }
+}
+
+inline void ChargeHeap(size_t bytes) {
+    limits_detail::heap_lease -= static_cast<int64_t>(bytes);
+    if (limits_detail::heap_lease < 0) {
+        limits_detail::RefillHeap(bytes);
+    }
+}
+
+inline void CreditHeap(size_t bytes) {
+    limits_detail::heap_lease += static_cast<int64_t>(bytes);
+    if (limits_detail::heap_lease > 4 * Budget::kHeapLease &&
+        limits_detail::heap_lease < limits_detail::kUnlimited / 2) {
+        limits_detail::ReturnHeapSurplus();
+    }
+}
@@ -0,0 +1,398 @@
+#include "expander.h"
+
+#include <vector>
+#include "packed_list.h"
+
+namespace {
+
+std::shared_ptr<Object> MakeSymbol(const std::string& name) {
+    return std::make_shared<Symbol>(name);
+}
+
+std::shared_ptr<Object> MakeList(const ObjectVectorBase& items,
+                                 std::shared_ptr<Object> tail = nullptr) {
+    std::shared_ptr<Object> list = std::move(tail);
+    for (auto iter = items.rbegin(); iter != items.rend(); ++iter) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(*iter);
+        cell->SetSecond(list);
+        list = cell;
+    }
+    return list;
+}
+
+// The elements of a proper list; a dotted one is a syntax error.
+ObjectVectorBase ToVector(const std::shared_ptr<Object>& list) {
+    ObjectVectorBase items;
+    std::shared_ptr<Object> cur = list;
+    while (Is<Cell>(cur)) {
+        auto cell = As<Cell>(cur);
+        items.push_back(cell->GetFirst());
+        cur = cell->GetSecond();
+    }
+    if (cur) {
+        throw SyntaxError(" ");
+    }
+    return items;
+}
+
+bool IsSymbolNamed(const std::shared_ptr<Object>& obj, const std::string& name) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == name;
+}
+
+ObjectVectorBase ExpandAll(const ObjectVectorBase& items, size_t begin = 0) {
+    ObjectVectorBase result;
+    for (size_t i = begin; i < items.size(); ++i) {
+        result.push_back(Expand(items[i]));
+    }
+    return result;
+}
+
+std::shared_ptr<Object> MakeBegin(const ObjectVectorBase& body) {
+    if (body.size() == 1) {
+        return body[0];
+    }
+    ObjectVectorBase form = {MakeSymbol("begin")};
+    form.insert(form.end(), body.begin(), body.end());
+    return MakeList(form);
+}
+
+std::shared_ptr<Object> MakeIf(const std::shared_ptr<Object>& test,
+                               const std::shared_ptr<Object>& consequent,
+                               const std::shared_ptr<Object>& alternative, bool has_alternative) {
+    if (has_alternative) {
+        return MakeList({MakeSymbol("if"), test, consequent, alternative});
+    }
+    return MakeList({MakeSymbol("if"), test, consequent});
+}
+
+struct Binding {
+    std::shared_ptr<Object> name;
+    std::shared_ptr<Object> init;
+    std::shared_ptr<Object> step;
+};
+
+// ((var init) ...), or ((var init [step]) ...) for do. Inits and steps come
+// back expanded; a missing step is the variable itself.
+std::vector<Binding> ParseBindings(const std::shared_ptr<Object>& list, bool with_steps) {
+    std::vector<Binding> bindings;
+    for (const auto& binding : ToVector(list)) {
+        ObjectVectorBase parts = ToVector(binding);
+        if (parts.size() < 2 || parts.size() > (with_steps ? 3 : 2) || !Is<Symbol>(parts[0])) {
+            throw SyntaxError(" ");
+        }
+        bindings.push_back({parts[0], Expand(parts[1]),
+                            parts.size() == 3 ? Expand(parts[2]) : parts[0]});
+    }
+    return bindings;
+}
+
+std::shared_ptr<Object> MakeBindings(const std::vector<Binding>& bindings) {
+    ObjectVectorBase list;
+    for (const auto& binding : bindings) {
+        list.push_back(MakeList({binding.name, binding.init}));
+    }
+    return MakeList(list);
+}
+
+// Rewrites the tail calls (name args ...) of an expanded expression into
+// (%recur args ...). Clears *loopable if name is used in any other way.
+std::shared_ptr<Object> RewriteTailCalls(const std::shared_ptr<Object>& expr,
+                                         const std::string& name, bool tail, bool* loopable);
+
+ObjectVectorBase RewriteSequence(const ObjectVectorBase& items, size_t begin,
+                                 const std::string& name, bool tail, bool* loopable) {
+    ObjectVectorBase result(items.begin(), items.begin() + begin);
+    for (size_t i = begin; i < items.size(); ++i) {
+        result.push_back(
+            RewriteTailCalls(items[i], name, tail && i + 1 == items.size(), loopable));
+    }
+    return result;
+}
+
+std::shared_ptr<Object> RewriteTailCalls(const std::shared_ptr<Object>& expr,
+                                         const std::string& name, bool tail, bool* loopable) {
+    if (IsSymbolNamed(expr, name)) {
+        *loopable = false;
+        return expr;
+    }
+    if (!Is<Cell>(expr) || !*loopable) {
+        return expr;
+    }
+    ObjectVectorBase items;
+    try {
+        items = ToVector(expr);
+    } catch (SyntaxError&) {
+        *loopable = false;
+        return expr;
+    }
+    if (!Is<Symbol>(items[0])) {
+        return MakeList(RewriteSequence(items, 0, name, false, loopable));
+    }
+    const std::string& head = As<Symbol>(items[0])->GetName();
+    if (head == "quote") {
+        return expr;
+    }
+    if (head == name) {
+        if (!tail) {
+            *loopable = false;
+            return expr;
+        }
+        ObjectVectorBase call = RewriteSequence(items, 1, name, false, loopable);
+        call[0] = MakeSymbol(kRecurForm);
+        return MakeList(call);
+    }
+    if (head == "if") {
+        ObjectVectorBase result = {items[0]};
+        for (size_t i = 1; i < items.size(); ++i) {
+            result.push_back(RewriteTailCalls(items[i], name, tail && i >= 2, loopable));
+        }
+        return MakeList(result);
+    }
+    if (head == "begin" || head == "and" || head == "or") {
+        return MakeList(RewriteSequence(items, 1, name, tail, loopable));
+    }
+    if (head == "let" && items.size() >= 3) {
+        // Bindings can't name the loop, or its body would call something else.
+        ObjectVectorBase bindings;
+        for (const auto& binding : ToVector(items[1])) {
+            ObjectVectorBase parts = ToVector(binding);
+            if (IsSymbolNamed(parts[0], name)) {
+                *loopable = false;
+                return expr;
+            }
+            bindings.push_back(
+                MakeList({parts[0], RewriteTailCalls(parts[1], name, false, loopable)}));
+        }
+        ObjectVectorBase result = RewriteSequence(items, 2, name, tail, loopable);
+        result[1] = MakeList(bindings);
+        return MakeList(result);
+    }
+    // Anything else, lambdas and inner loops included, has no tail position
+    // of ours in it.
+    return MakeList(RewriteSequence(items, 0, name, false, loopable));
+}
+
+std::shared_ptr<Object> ExpandNamedLet(const ObjectVectorBase& form) {
+    if (form.size() < 4) {
+        throw SyntaxError(" ");
+    }
+    const std::string& name = As<Symbol>(form[1])->GetName();
+    std::vector<Binding> bindings = ParseBindings(form[2], false);
+    ObjectVectorBase body = ExpandAll(form, 3);
+
+    bool loopable = true;
+    ObjectVectorBase loop_body = RewriteSequence(body, 0, name, true, &loopable);
+    if (loopable) {
+        ObjectVectorBase loop = {MakeSymbol(kLoopForm), MakeBindings(bindings)};
+        loop.insert(loop.end(), loop_body.begin(), loop_body.end());
+        return MakeList(loop);
+    }
+
+    // ((let () (define (name var ...) body ...) name) init ...)
+    ObjectVectorBase signature = {form[1]};
+    ObjectVectorBase inits = {nullptr};
+    for (const auto& binding : bindings) {
+        signature.push_back(binding.name);
+        inits.push_back(binding.init);
+    }
+    ObjectVectorBase define = {MakeSymbol("define"), MakeList(signature)};
+    define.insert(define.end(), body.begin(), body.end());
+    inits[0] = MakeList({MakeSymbol("let"), nullptr, MakeList(define), form[1]});
+    return MakeList(inits);
+}
+
+std::shared_ptr<Object> ExpandLet(const ObjectVectorBase& form) {
+    if (form.size() >= 2 && Is<Symbol>(form[1])) {
+        return ExpandNamedLet(form);
+    }
+    if (form.size() < 3) {
+        throw SyntaxError(" ");
+    }
+    ObjectVectorBase result = {form[0], MakeBindings(ParseBindings(form[1], false))};
+    ObjectVectorBase body = ExpandAll(form, 2);
+    result.insert(result.end(), body.begin(), body.end());
+    return MakeList(result);
+}
+
+// (let* (b1 b2 ...) body ...) is (let (b1) (let* (b2 ...) body ...)).
+std::shared_ptr<Object> ExpandLetStar(const ObjectVectorBase& form) {
+    if (form.size() < 3) {
+        throw SyntaxError(" ");
+    }
+    ObjectVectorBase bindings = ToVector(form[1]);
+    ObjectVectorBase nested = {MakeSymbol("let"), nullptr};
+    nested.insert(nested.end(), form.begin() + 2, form.end());
+    for (auto iter = bindings.rbegin(); iter != bindings.rend(); ++iter) {
+        nested = {MakeSymbol("let"), MakeList({*iter}), MakeList(nested)};
+    }
+    return Expand(MakeList(nested));
+}
+
+// (letrec ((var init) ...) body ...) is (let () (define var init) ... body ...).
+std::shared_ptr<Object> ExpandLetrec(const ObjectVectorBase& form) {
+    if (form.size() < 3) {
+        throw SyntaxError(" ");
+    }
+    ObjectVectorBase result = {MakeSymbol("let"), nullptr};
+    for (const auto& binding : ToVector(form[1])) {
+        ObjectVectorBase parts = ToVector(binding);
+        if (parts.size() != 2 || !Is<Symbol>(parts[0])) {
+            throw SyntaxError(" ");
+        }
+        result.push_back(MakeList({MakeSymbol("define"), parts[0], parts[1]}));
+    }
+    result.insert(result.end(), form.begin() + 2, form.end());
+    return Expand(MakeList(result));
+}
+
+std::shared_ptr<Object> ExpandCond(const ObjectVectorBase& form) {
+    std::shared_ptr<Object> rest;
+    bool has_rest = false;
+    for (size_t i = form.size(); i > 1; --i) {
+        ObjectVectorBase clause = ToVector(form[i - 1]);
+        if (clause.empty()) {
+            throw SyntaxError(" ");
+        }
+        if (IsSymbolNamed(clause[0], "else")) {
+            if (has_rest || clause.size() < 2) {
+                throw SyntaxError(" ");
+            }
+            rest = MakeBegin(ExpandAll(clause, 1));
+        } else if (clause.size() == 1) {
+            std::shared_ptr<Object> test = Expand(clause[0]);
+            rest = has_rest ? MakeList({MakeSymbol("or"), test, rest}) : test;
+        } else if (IsSymbolNamed(clause[1], "=>")) {
+            if (clause.size() != 3) {
+                throw SyntaxError(" ");
+            }
+            // (let ((%test test)) (if %test (receiver %test) rest))
+            auto temp = MakeSymbol("%test");
+            auto call = MakeList({Expand(clause[2]), temp});
+            rest = MakeList({MakeSymbol("let"), MakeList({MakeList({temp, Expand(clause[0])})}),
+                             MakeIf(temp, call, rest, has_rest)});
+        } else {
+            rest = MakeIf(Expand(clause[0]), MakeBegin(ExpandAll(clause, 1)), rest, has_rest);
+        }
+        has_rest = true;
+    }
+    if (!has_rest) {
+        return MakeList({MakeSymbol("begin")});
+    }
+    return rest;
+}
+
+// (case key ((datum ...) expr ...) ... (else expr ...)) is a cond over
+// (%memv key '(datum ...)), with the key bound once unless it's a variable or
+// a constant already.
+std::shared_ptr<Object> ExpandCase(const ObjectVectorBase& form) {
+    if (form.size() < 2) {
+        throw SyntaxError(" ");
+    }
+    std::shared_ptr<Object> key = Expand(form[1]);
+    bool bind_key = Is<Cell>(key);
+    std::shared_ptr<Object> key_ref = bind_key ? MakeSymbol("%key") : key;
+
+    ObjectVectorBase cond = {MakeSymbol("cond")};
+    for (size_t i = 2; i < form.size(); ++i) {
+        ObjectVectorBase clause = ToVector(form[i]);
+        if (clause.size() < 2) {
+            throw SyntaxError(" ");
+        }
+        if (!IsSymbolNamed(clause[0], "else")) {
+            if (!Is<Cell>(clause[0])) {
+                throw SyntaxError(" ");
+            }
+            clause[0] = MakeList({MakeSymbol(kMemvForm), key_ref,
+                                  MakeList({MakeSymbol("quote"), clause[0]})});
+        }
+        cond.push_back(MakeList(clause));
+    }
+    std::shared_ptr<Object> result = ExpandCond(cond);
+    if (bind_key) {
+        result = MakeList(
+            {MakeSymbol("let"), MakeList({MakeList({key_ref, key})}), result});
+    }
+    return result;
+}
+
+// (do ((var init step) ...) (test result ...) body ...) is
+// (%loop ((var init) ...) (if test (begin result ...) (begin body ... (%recur step ...)))).
+std::shared_ptr<Object> ExpandDo(const ObjectVectorBase& form) {
+    if (form.size() < 3) {
+        throw SyntaxError(" ");
+    }
+    std::vector<Binding> bindings = ParseBindings(form[1], true);
+    ObjectVectorBase exit_clause = ToVector(form[2]);
+    if (exit_clause.empty()) {
+        throw SyntaxError(" ");
+    }
+    ObjectVectorBase step = {MakeSymbol(kRecurForm)};
+    for (const auto& binding : bindings) {
+        step.push_back(binding.step);
+    }
+    ObjectVectorBase body = ExpandAll(form, 3);
+    body.push_back(MakeList(step));
+    ObjectVectorBase results = ExpandAll(exit_clause, 1);
+    std::shared_ptr<Object> done =
+        results.empty() ? MakeList({MakeSymbol("begin")}) : MakeBegin(results);
+    return MakeList({MakeSymbol(kLoopForm), MakeBindings(bindings),
+                     MakeIf(Expand(exit_clause[0]), done, MakeBegin(body), true)});
+}
+
+// (lambda (var ...) body ...), (define (name var ...) body ...) and
+// (define name expr): the first operand is left alone.
+std::shared_ptr<Object> ExpandBinder(const ObjectVectorBase& form) {
+    if (form.size() < 2) {
+        throw SyntaxError(" ");
+    }
+    ObjectVectorBase result = {form[0], form[1]};
+    ObjectVectorBase rest = ExpandAll(form, 2);
+    result.insert(result.end(), rest.begin(), rest.end());
+    return MakeList(result);
+}
+
+}  // namespace
+
+std::shared_ptr<Object> Expand(const std::shared_ptr<Object>& form) {
+    if (!Is<Cell>(form)) {
+        return form;
+    }
+    DepthGuard depth_guard;
+    auto cell = As<Cell>(form);
+    if (Is<Symbol>(cell->GetFirst())) {
+        const std::string& head = As<Symbol>(cell->GetFirst())->GetName();
+        if (head == "quote") {
+            if (Is<Cell>(cell->GetSecond())) {
+                auto datum = As<Cell>(cell->GetSecond())->GetFirst();
+                return MakeList({cell->GetFirst(), PackLiteral(datum)});
+            }
+            return form;
+        } else if (head == "lambda" || head == "define" || head == "define-memoized") {
+            return ExpandBinder(ToVector(form));
+        } else if (head == "let") {
+            return ExpandLet(ToVector(form));
+        } else if (head == "let*") {
+            return ExpandLetStar(ToVector(form));
+        } else if (head == "letrec" || head == "letrec*") {
+            return ExpandLetrec(ToVector(form));
+        } else if (head == "cond") {
+            return ExpandCond(ToVector(form));
+        } else if (head == "case") {
+            return ExpandCase(ToVector(form));
+        } else if (head == "do") {
+            return ExpandDo(ToVector(form));
+        }
+    }
+
+    // An application or another core form: every element is an expression.
+    // A dotted tail is kept as it is.
+    ObjectVectorBase items;
+    std::shared_ptr<Object> cur = form;
+    while (Is<Cell>(cur)) {
+        auto item = As<Cell>(cur);
+        items.push_back(Expand(item->GetFirst()));
+        cur = item->GetSecond();
+    }
+    return MakeList(items, cur);
+}
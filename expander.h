@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "object.h"
+
+// Derived forms.
+//
+// Expand rewrites an expression once, right after it is read, so the evaluator
+// only meets core forms:
+//   let*, letrec, letrec*  become nested lets and lets with internal defines,
+//   cond and case          become if, or and let,
+//   do                     becomes %loop.
+// `let` and `begin` are core forms themselves; a let makes one scope and no
+// lambda. A named let whose name is only ever called in tail position becomes
+// a %loop as well, so it runs in constant native stack; any other use of the
+// name keeps the recursive procedure. Quoted data is copied with its long
+// proper lists packed (see packed_list.h).
+std::shared_ptr<Object> Expand(const std::shared_ptr<Object>& form);
+
+// Core forms introduced by Expand. The tokenizer never produces these names,
+// so programs can neither call nor shadow them.
+//
+// (%loop ((var init) ...) body ...) binds the vars like let and evaluates the
+// body; while it evaluates to a LoopRecur, the vars are rebound to its values
+// and the body runs again. (%recur expr ...) makes that LoopRecur. Expand only
+// puts %recur in tail position of the body of its own loop.
+inline const std::string kLoopForm = "%loop";
+inline const std::string kRecurForm = "%recur";
+// (%memv key '(datum ...)): whether key is eqv to one of the data.
+inline const std::string kMemvForm = "%memv";
+
+class LoopRecur : public Object {
+public:
+    explicit LoopRecur(ObjectVectorBase values) : values_(std::move(values)) {
+    }
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    const ObjectVectorBase& GetValues() const {
+        return values_;
+    }
+
+private:
+    ObjectVectorBase values_;
+};
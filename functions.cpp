@@ -1,5 +1,23 @@
 #include "functions.h"
 
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include "closure.h"
+#include "coroutine.h"
+#include "expander.h"
+#include "image.h"
+#include "library.h"
+#include "memo.h"
+#include "packed_list.h"
+#include "parallel.h"
+#include "ports.h"
+#include "sort.h"
+#include "source_cache.h"
+#include "stream.h"
+
 template <typename Exc>
 void AssertFunctionOfLength(ObjectVector& vector, size_t length,
                             FunctionRef<bool(size_t, size_t)> func) {
@@ -35,6 +53,9 @@ std::shared_ptr<Object> IsBoolean(ObjectVector& input) {
 std::shared_ptr<Object> NotBoolean(ObjectVector& input) {
     AssertLength<RuntimeError>(input, 1);
     std::shared_ptr<Object> s = input[0];
+    if (s) {
+        s = s->Evaluate(input.GetScope());
+    }
     if (!s) {
         return std::make_shared<Bool>(true);
     }
@@ -130,7 +151,7 @@ std::shared_ptr<Object> IntegerOperationsWrapper(ObjectVector& list,
                                                  FunctionRef<int(int, int)> operation,
                                                  FunctionRef<int()> default_value) {
     if (list.empty()) {
-        return std::make_shared<Number>(default_value());
+        return MakeSlabShared<Number>(default_value());
     }
     if (!list[0]) {
         throw RuntimeError(" ");
@@ -142,7 +163,7 @@ std::shared_ptr<Object> IntegerOperationsWrapper(ObjectVector& list,
         }
         ans = operation(ans, As<Number>(list[i]->Evaluate(list.GetScope()))->GetValue());
     }
-    return std::make_shared<Number>(ans);
+    return MakeSlabShared<Number>(ans);
 }
 
 std::shared_ptr<Object> PlusInteger(ObjectVector& s) {
@@ -193,7 +214,7 @@ std::shared_ptr<Object> MaxInteger(ObjectVector& s) {
 
 std::shared_ptr<Object> AbsInteger(ObjectVector& s) {
     AssertLength<RuntimeError>(s, 1);
-    return std::make_shared<Number>(std::abs(As<Number>(s[0]->Evaluate(s.GetScope()))->GetValue()));
+    return MakeSlabShared<Number>(std::abs(As<Number>(s[0]->Evaluate(s.GetScope()))->GetValue()));
 }
 
 std::shared_ptr<Object> IsPairList(ObjectVector& list) {
@@ -212,17 +233,17 @@ std::shared_ptr<Object> IsListList(ObjectVector& list) {
     if (!Is<Cell>(s)) {
         return std::make_shared<Bool>(true);
     }
-    auto cell = As<Cell>(s);
-    std::shared_ptr<Cell> cur_elem = cell;
-    while (true) {
-        if (cur_elem->GetSecond() == nullptr) {
-            return std::make_shared<Bool>(true);
-        }
-        if (!Is<Cell>(cur_elem->GetSecond())) {
-            return std::make_shared<Bool>(false);
-        }
-        cur_elem = As<Cell>(cur_elem->GetSecond());
+    size_t length;
+    return std::make_shared<Bool>(ProperListLength(s, &length));
+}
+
+std::shared_ptr<Object> LengthList(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    size_t length;
+    if (!ProperListLength(list[0]->Evaluate(list.GetScope()), &length)) {
+        throw RuntimeError(" ");
     }
+    return MakeSlabShared<Number>(static_cast<int>(length));
 }
 
 std::shared_ptr<Object> IsNullList(ObjectVector& list) {
@@ -237,9 +258,9 @@ std::shared_ptr<Object> IsNullList(ObjectVector& list) {
 
 std::shared_ptr<Object> ConsList(ObjectVector& list) {
     AssertLength<RuntimeError>(list, 2);
-    std::shared_ptr<Cell> ans = std::make_shared<Cell>();
-    ans->GetFirst() = list[0]->Evaluate(list.GetScope());
-    ans->GetSecond() = list[1]->Evaluate(list.GetScope());
+    std::shared_ptr<Cell> ans = MakeSlabShared<Cell>();
+    ans->SetFirst(list[0]->Evaluate(list.GetScope()));
+    ans->SetSecond(list[1]->Evaluate(list.GetScope()));
     return ans;
 }
 
@@ -261,56 +282,49 @@ std::shared_ptr<Object> CdrList(ObjectVector& list) {
 }
 
 std::shared_ptr<Object> ListList(ObjectVector& list) {
-    std::shared_ptr<Cell> ans = std::make_shared<Cell>();
-    std::shared_ptr<Cell> cur_pos = ans;
-    if (list.empty()) {
-        return nullptr;
-    }
-    ans->GetFirst() = list[0]->Evaluate(list.GetScope());
-    ans->GetSecond() = std::make_shared<Cell>();
-    for (size_t j = 1; j < list.size(); ++j) {
-        auto& i = list[j];
-        cur_pos = As<Cell>(cur_pos->GetSecond());
-        cur_pos->GetFirst() = i->Evaluate(list.GetScope());
-        cur_pos->GetSecond() = std::make_shared<Cell>();
+    ObjectVectorBase items;
+    items.reserve(list.size());
+    for (const auto& item : list) {
+        items.push_back(item->Evaluate(list.GetScope()));
     }
-    cur_pos->GetSecond() = nullptr;
-    return ans;
+    return MakePackedList(std::move(items));
 }
 
 std::shared_ptr<Object> ListRefList(ObjectVector& list) {
     AssertLength<RuntimeError>(list, 2);
-    std::shared_ptr<Cell> cell = As<Cell>(list[0]->Evaluate(list.GetScope()));
-    std::shared_ptr<Cell> cur_cell = cell;
-    std::shared_ptr<Number> pos = As<Number>(list[1]->Evaluate(list.GetScope()));
-    int64_t counter = 0;
-    while (counter < pos->GetValue()) {
-        if (cur_cell->GetSecond() == nullptr) {
-            throw RuntimeError(" ");
-        }
-        ++counter;
-        cur_cell = As<Cell>(cur_cell->GetSecond());
-    }
-    if (cur_cell->GetFirst() == nullptr) {
+    std::shared_ptr<Object> cell = As<Cell>(list[0]->Evaluate(list.GetScope()));
+    int pos = As<Number>(list[1]->Evaluate(list.GetScope()))->GetValue();
+    std::shared_ptr<Object> tail = ListTail(cell, std::max(pos, 0));
+    if (!tail || As<Cell>(tail)->GetFirst() == nullptr) {
         throw RuntimeError(" ");
     }
-    return cur_cell->GetFirst();
+    return As<Cell>(tail)->GetFirst();
 }
 
 std::shared_ptr<Object> ListTailList(ObjectVector& list) {
     AssertLength<RuntimeError>(list, 2);
-    std::shared_ptr<Cell> cell = As<Cell>(list[0]->Evaluate(list.GetScope()));
-    std::shared_ptr<Cell> cur_cell = cell;
-    std::shared_ptr<Number> pos = As<Number>(list[1]->Evaluate(list.GetScope()));
-    int64_t counter = 1;
-    while (counter < pos->GetValue()) {
-        if (cur_cell->GetSecond() == nullptr) {
-            throw RuntimeError(" ");
-        }
-        ++counter;
-        cur_cell = As<Cell>(cur_cell->GetSecond());
+    std::shared_ptr<Object> cell = As<Cell>(list[0]->Evaluate(list.GetScope()));
+    int pos = As<Number>(list[1]->Evaluate(list.GetScope()))->GetValue();
+    std::shared_ptr<Object> tail = ListTail(cell, std::max(pos, 1) - 1);
+    if (!tail) {
+        throw RuntimeError(" ");
     }
-    return cur_cell->GetSecond();
+    return As<Cell>(tail)->GetSecond();
+}
+
+std::shared_ptr<Object> SortWith(ObjectVector& list, bool in_place) {
+    AssertLength<RuntimeError>(list, 2);
+    std::shared_ptr<Object> items = list[0]->Evaluate(list.GetScope());
+    auto less = As<FunctionWrapper>(list[1]->Evaluate(list.GetScope()));
+    return SortList(items, less, list.GetScope(), in_place);
+}
+
+std::shared_ptr<Object> SortCopyList(ObjectVector& list) {
+    return SortWith(list, false);
+}
+
+std::shared_ptr<Object> SortInPlaceList(ObjectVector& list) {
+    return SortWith(list, true);
 }
 
 std::shared_ptr<Object> If(ObjectVector& list) {
@@ -333,6 +347,9 @@ std::shared_ptr<Object> Define(ObjectVector& list) {
     if (Is<Symbol>(list[0])) {
         AssertLength<SyntaxError>(list, 2);
         std::shared_ptr<Object> variable = list[1]->Evaluate(list.GetScope());
+        if (Is<Lambda>(variable) && As<Lambda>(variable)->GetName().empty()) {
+            As<Lambda>(variable)->SetName(As<Symbol>(list[0])->GetName());
+        }
         list.GetScope()->AddVariable(As<Symbol>(list[0])->GetName(), variable);
         return nullptr;
     } else if (Is<Cell>(list[0])) {
@@ -341,9 +358,11 @@ std::shared_ptr<Object> Define(ObjectVector& list) {
         std::shared_ptr<Symbol> lambda_name = As<Symbol>(def_list[0]);
         ObjectVector lambda_input = ObjectVectorBase(def_list.begin() + 1, def_list.end());
         ObjectVectorBase lambda_body = ObjectVectorBase(list.begin() + 1, list.end());
+        auto shape = FindClosureShape(list.GetScope(), list[0], lambda_input, lambda_body);
         list.GetScope()->AddVariable(
             lambda_name->GetName(),
-            std::make_shared<LambdaCreator>(list.GetScope(), lambda_input, lambda_body));
+            std::make_shared<LambdaCreator>(CaptureScope(list.GetScope(), shape), lambda_input,
+                                            lambda_body, lambda_name->GetName(), shape));
         return nullptr;
     } else {
         throw SyntaxError(" ");
@@ -361,14 +380,14 @@ std::shared_ptr<Object> Set(ObjectVector& list) {
 std::shared_ptr<Object> SetCar(ObjectVector& list) {
     AssertLength<SyntaxError>(list, 2);
     std::shared_ptr<Cell> variable = As<Cell>(list[0]->Evaluate(list.GetScope()));
-    variable->GetFirst() = list[1]->Evaluate(list.GetScope());
+    variable->SetFirst(list[1]->Evaluate(list.GetScope()));
     return nullptr;
 }
 
 std::shared_ptr<Object> SetCdr(ObjectVector& list) {
     AssertLength<SyntaxError>(list, 2);
     std::shared_ptr<Cell> variable = As<Cell>(list[0]->Evaluate(list.GetScope()));
-    variable->GetSecond() = list[1]->Evaluate(list.GetScope());
+    variable->SetSecond(list[1]->Evaluate(list.GetScope()));
     return nullptr;
 }
 
@@ -377,9 +396,108 @@ std::shared_ptr<Object> CreateLambda(ObjectVector& list) {
         throw SyntaxError(" ");
     }
     ObjectVector obj_vec = EvaluateList(list[0]);
-    obj_vec.GetScope() = list.GetScope();
     ObjectVectorBase base = ObjectVectorBase(list.begin() + 1, list.end());
-    return Lambda::CreateLambda(obj_vec, base);
+    auto shape = FindClosureShape(list.GetScope(), list[0], obj_vec, base);
+    return std::make_shared<Lambda>(CaptureScope(list.GetScope(), shape), obj_vec, base, "",
+                                    shape);
+}
+
+// Evaluates list[begin..] in scope and returns the last value.
+std::shared_ptr<Object> EvaluateBody(ObjectVector& list, size_t begin,
+                                     const std::shared_ptr<Scope>& scope) {
+    std::shared_ptr<Object> result;
+    for (size_t i = begin; i < list.size(); ++i) {
+        result = list[i] ? list[i]->Evaluate(scope) : nullptr;
+    }
+    return result;
+}
+
+// Binds ((var init) ...) in a new child scope of list's, with the inits
+// evaluated in list's own scope. Returns the variable names in order.
+std::vector<std::string> BindLetVariables(ObjectVector& list, const std::shared_ptr<Scope>& scope) {
+    std::vector<std::string> names;
+    std::shared_ptr<Object> bindings = list[0];
+    while (bindings) {
+        auto cell = As<Cell>(bindings);
+        auto binding = As<Cell>(cell->GetFirst());
+        names.push_back(As<Symbol>(binding->GetFirst())->GetName());
+        scope->AddVariable(names.back(),
+                           As<Cell>(binding->GetSecond())->GetFirst()->Evaluate(list.GetScope()));
+        bindings = cell->GetSecond();
+    }
+    return names;
+}
+
+std::shared_ptr<Object> Let(ObjectVector& list) {
+    AssertLengthMoreEq<SyntaxError>(list, 2);
+    auto scope = MakeSlabShared<Scope>();
+    scope->GetParentScope() = list.GetScope();
+    BindLetVariables(list, scope);
+    return EvaluateBody(list, 1, scope);
+}
+
+std::shared_ptr<Object> Begin(ObjectVector& list) {
+    return EvaluateBody(list, 0, list.GetScope());
+}
+
+std::shared_ptr<Object> Loop(ObjectVector& list) {
+    AssertLengthMoreEq<SyntaxError>(list, 2);
+    auto scope = MakeSlabShared<Scope>();
+    scope->GetParentScope() = list.GetScope();
+    std::vector<std::string> names = BindLetVariables(list, scope);
+    while (true) {
+        std::shared_ptr<Object> result = EvaluateBody(list, 1, scope);
+        if (!Is<LoopRecur>(result)) {
+            return result;
+        }
+        const ObjectVectorBase& values = As<LoopRecur>(result)->GetValues();
+        if (values.size() != names.size()) {
+            throw RuntimeError(" ");
+        }
+        // An iteration whose bindings a closure keeps or shares gets a new
+        // scope; otherwise nothing else holds the scope and it is reused.
+        if (scope.use_count() != 1 || scope->HasBoxes()) {
+            scope = MakeSlabShared<Scope>();
+            scope->GetParentScope() = list.GetScope();
+        }
+        for (size_t i = 0; i < names.size(); ++i) {
+            scope->AddVariable(names[i], values[i]);
+        }
+    }
+}
+
+std::shared_ptr<Object> Recur(ObjectVector& list) {
+    ObjectVectorBase values;
+    for (const auto& arg : list) {
+        values.push_back(arg ? arg->Evaluate(list.GetScope()) : nullptr);
+    }
+    return std::make_shared<LoopRecur>(std::move(values));
+}
+
+bool IsEqv(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs) {
+    if (Is<Number>(lhs) && Is<Number>(rhs)) {
+        return As<Number>(lhs)->GetValue() == As<Number>(rhs)->GetValue();
+    }
+    if (Is<Bool>(lhs) && Is<Bool>(rhs)) {
+        return bool(*lhs) == bool(*rhs);
+    }
+    if (Is<Symbol>(lhs) && Is<Symbol>(rhs)) {
+        return As<Symbol>(lhs)->GetName() == As<Symbol>(rhs)->GetName();
+    }
+    return lhs == rhs;
+}
+
+std::shared_ptr<Object> Memv(ObjectVector& list) {
+    AssertLength<SyntaxError>(list, 2);
+    std::shared_ptr<Object> key = list[0]->Evaluate(list.GetScope());
+    std::shared_ptr<Object> data = list[1]->Evaluate(list.GetScope());
+    while (Is<Cell>(data)) {
+        if (IsEqv(key, As<Cell>(data)->GetFirst())) {
+            return std::make_shared<Bool>(true);
+        }
+        data = As<Cell>(data)->GetSecond();
+    }
+    return std::make_shared<Bool>(false);
 }
 
 std::shared_ptr<Object> Quote(ObjectVector& list) {
@@ -392,6 +510,586 @@ std::shared_ptr<Object> IsSymbol(ObjectVector& list) {
     return std::make_shared<Bool>(Is<Symbol>(list[0]->Evaluate(list.GetScope())));
 }
 
+std::shared_ptr<Object> FutureParallel(ObjectVector& list) {
+    AssertLength<SyntaxError>(list, 1);
+    return Future::Spawn(list[0], list.GetScope());
+}
+
+std::shared_ptr<Object> TouchParallel(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    std::shared_ptr<Object> obj = list[0]->Evaluate(list.GetScope());
+    if (Is<Future>(obj)) {
+        return As<Future>(obj)->Touch();
+    }
+    return obj;
+}
+
+std::shared_ptr<Object> MapParallel(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto func = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    std::shared_ptr<Object> items_list = list[1]->Evaluate(list.GetScope());
+    if (!items_list) {
+        return nullptr;
+    }
+    ObjectVector items = EvaluateList(As<Cell>(items_list));
+    ObjectVectorBase results(items.size());
+    std::shared_ptr<Scope> scope = list.GetScope();
+    ThreadPool::Instance().ParallelFor(items.size(), [&](size_t begin, size_t end) {
+        auto task_scope = MakeSlabShared<Scope>();
+        task_scope->GetParentScope() = scope;
+        for (size_t i = begin; i < end; ++i) {
+            results[i] = ApplyToValues(func, {items[i]}, task_scope);
+        }
+    });
+    std::shared_ptr<Cell> ans = MakeSlabShared<Cell>();
+    std::shared_ptr<Cell> cur_pos = ans;
+    ans->SetFirst(results[0]);
+    for (size_t i = 1; i < results.size(); ++i) {
+        auto next = MakeSlabShared<Cell>();
+        next->SetFirst(results[i]);
+        cur_pos->SetSecond(next);
+        cur_pos = next;
+    }
+    return ans;
+}
+
+std::shared_ptr<Object> WorkersParallel(ObjectVector& list) {
+    AssertLengthLessEq<RuntimeError>(list, 1);
+    if (list.empty()) {
+        return MakeSlabShared<Number>(ThreadPool::Instance().GetWorkerCount());
+    }
+    int count = As<Number>(list[0]->Evaluate(list.GetScope()))->GetValue();
+    if (count <= 0) {
+        throw RuntimeError(" ");
+    }
+    ThreadPool::Instance().SetWorkerCount(count);
+    return nullptr;
+}
+
+std::shared_ptr<Object> MakeGenerator(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    auto thunk = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    return std::make_shared<Generator>(thunk, list.GetScope());
+}
+
+std::shared_ptr<Object> NextGenerator(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return As<Generator>(list[0]->Evaluate(list.GetScope()))->Next();
+}
+
+std::shared_ptr<Object> IsDoneGenerator(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return std::make_shared<Bool>(As<Generator>(list[0]->Evaluate(list.GetScope()))->IsDone());
+}
+
+// `yield` and the waiting channel operations are handled by EvalSuspendable;
+// the builtins only run outside of a generator or a green thread.
+std::shared_ptr<Object> YieldCoroutine(ObjectVector& list) {
+    throw RuntimeError(" ");
+}
+
+std::shared_ptr<Object> SpawnCoroutine(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    auto thunk = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    GreenThreads::Instance().Spawn(thunk, list.GetScope());
+    return nullptr;
+}
+
+std::shared_ptr<Object> RunThreadsCoroutine(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 0);
+    GreenThreads::Instance().RunAll();
+    return nullptr;
+}
+
+std::shared_ptr<Object> MakeChannel(ObjectVector& list) {
+    AssertLengthLessEq<RuntimeError>(list, 1);
+    int capacity = 0;
+    if (!list.empty()) {
+        capacity = As<Number>(list[0]->Evaluate(list.GetScope()))->GetValue();
+        if (capacity <= 0) {
+            throw RuntimeError(" ");
+        }
+    }
+    return std::make_shared<Channel>(capacity);
+}
+
+std::shared_ptr<Object> SendChannel(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto channel = As<Channel>(list[0]->Evaluate(list.GetScope()));
+    SendWaiting(*channel, list[1] ? list[1]->Evaluate(list.GetScope()) : nullptr);
+    return nullptr;
+}
+
+std::shared_ptr<Object> ReceiveChannel(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return ReceiveWaiting(*As<Channel>(list[0]->Evaluate(list.GetScope())));
+}
+
+std::shared_ptr<Object> SaveImageFunction(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    std::shared_ptr<Object> path = list[0]->Evaluate(list.GetScope());
+    std::shared_ptr<Scope> global_scope = list.GetScope();
+    while (global_scope->GetParentScope()) {
+        global_scope = global_scope->GetParentScope();
+    }
+    if (Is<String>(path)) {
+        SaveImage(global_scope, As<String>(path)->GetValue());
+    } else {
+        SaveImage(global_scope, As<Symbol>(path)->GetName());
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object> LoadFunction(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    std::shared_ptr<Object> path = list[0]->Evaluate(list.GetScope());
+    std::shared_ptr<Scope> global_scope = list.GetScope();
+    while (global_scope->GetParentScope()) {
+        global_scope = global_scope->GetParentScope();
+    }
+    std::shared_ptr<Object> result;
+    for (const auto& form : ReadSourceFile(As<String>(path)->GetValue())) {
+        result = form->Evaluate(global_scope);
+    }
+    return result;
+}
+
+std::shared_ptr<Object> DefineLibraryFunction(ObjectVector& list) {
+    DeclareLibrary(ParseLibrary(list));
+    return nullptr;
+}
+
+// Binds into the global scope even when not at the top level, like load.
+std::shared_ptr<Object> ImportFunction(ObjectVector& list) {
+    std::shared_ptr<Scope> global_scope = list.GetScope();
+    while (global_scope->GetParentScope()) {
+        global_scope = global_scope->GetParentScope();
+    }
+    for (const auto& import_set : list) {
+        ImportLibrary(import_set, global_scope);
+    }
+    return nullptr;
+}
+
+// (profile expr [file]): evaluates expr with a profiler, prints the report to
+// stderr and writes the collapsed stacks to file if one is given.
+std::shared_ptr<Object> ProfileFunction(ObjectVector& list) {
+    if (list.empty() || list.size() > 2) {
+        throw RuntimeError(" ");
+    }
+    if (Profiler::Active()) {
+        return list[0]->Evaluate(list.GetScope());
+    }
+    std::string path;
+    if (list.size() == 2) {
+        path = As<String>(list[1]->Evaluate(list.GetScope()))->GetValue();
+    }
+    Profiler profiler;
+    std::shared_ptr<Object> result;
+    {
+        Profiler::Activation activation(&profiler);
+        result = list[0]->Evaluate(list.GetScope());
+    }
+    profiler.WriteReport(std::cerr);
+    if (!path.empty()) {
+        std::ofstream out(path);
+        profiler.WriteCollapsedStacks(out);
+        if (!out) {
+            throw RuntimeError(" ");
+        }
+    }
+    return result;
+}
+
+// An association list of the runtime counters, e.g. ((cells-created . 120) ...).
+std::shared_ptr<Object> RuntimeStatsFunction(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 0);
+    auto entries = RuntimeStatsEntries(CollectRuntimeCounters());
+    std::shared_ptr<Object> result;
+    for (auto iter = entries.rbegin(); iter != entries.rend(); ++iter) {
+        auto pair = MakeSlabShared<Cell>();
+        pair->SetFirst(std::make_shared<Symbol>(iter->first));
+        pair->SetSecond(MakeSlabShared<Number>(
+            static_cast<int>(std::min<uint64_t>(iter->second, std::numeric_limits<int>::max()))));
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(pair);
+        cell->SetSecond(result);
+        result = cell;
+    }
+    return result;
+}
+
+// ((cell (slot-size . 80) (chunks . 3) (capacity . 153) (in-use . 120)) ...)
+std::shared_ptr<Object> SlabStatsFunction(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 0);
+    auto entry = [](const char* name, uint64_t value) {
+        auto pair = MakeSlabShared<Cell>();
+        pair->SetFirst(std::make_shared<Symbol>(name));
+        pair->SetSecond(MakeSlabShared<Number>(
+            static_cast<int>(std::min<uint64_t>(value, std::numeric_limits<int>::max()))));
+        return pair;
+    };
+    ObjectVectorBase pools;
+    for (const auto& stats : CollectSlabStats()) {
+        ObjectVectorBase fields = {std::make_shared<Symbol>(stats.name),
+                                   entry("slot-size", stats.slot_size),
+                                   entry("chunks", stats.chunks),
+                                   entry("capacity", stats.capacity),
+                                   entry("in-use", stats.in_use)};
+        std::shared_ptr<Object> pool;
+        for (auto iter = fields.rbegin(); iter != fields.rend(); ++iter) {
+            auto cell = MakeSlabShared<Cell>();
+            cell->SetFirst(*iter);
+            cell->SetSecond(pool);
+            pool = cell;
+        }
+        pools.push_back(pool);
+    }
+    std::shared_ptr<Object> result;
+    for (auto iter = pools.rbegin(); iter != pools.rend(); ++iter) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(*iter);
+        cell->SetSecond(result);
+        result = cell;
+    }
+    return result;
+}
+
+// (max-depth) is the nesting limit of evaluation and of the reader; (max-depth n) sets it.
+std::shared_ptr<Object> MaxDepthFunction(ObjectVector& list) {
+    AssertLengthLessEq<RuntimeError>(list, 1);
+    if (list.empty()) {
+        return MakeSlabShared<Number>(
+            static_cast<int>(std::min<size_t>(DepthGuard::GetMaxDepth(),
+                                              std::numeric_limits<int>::max())));
+    }
+    int depth = As<Number>(list[0]->Evaluate(list.GetScope()))->GetValue();
+    if (depth <= 0) {
+        throw RuntimeError(" ");
+    }
+    DepthGuard::SetMaxDepth(depth);
+    return nullptr;
+}
+
+// (trace-start [events-per-thread]), (trace-stop), (trace-dump "file").
+std::shared_ptr<Object> StartTrace(ObjectVector& list) {
+    AssertLengthLessEq<RuntimeError>(list, 1);
+    if (list.empty()) {
+        Tracer::Start();
+    } else {
+        int events = As<Number>(list[0]->Evaluate(list.GetScope()))->GetValue();
+        if (events <= 0) {
+            throw RuntimeError(" ");
+        }
+        Tracer::Start(events);
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object> StopTrace(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 0);
+    Tracer::Stop();
+    return nullptr;
+}
+
+std::shared_ptr<Object> DumpTrace(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    Tracer::WriteChromeTrace(As<String>(list[0]->Evaluate(list.GetScope()))->GetValue());
+    return nullptr;
+}
+
+// (define-memoized (f args...) body...): like define, but f caches its results.
+// Recursive calls go through the cache too, since f names the memoized function.
+std::shared_ptr<Object> DefineMemoized(ObjectVector& list) {
+    AssertLengthMoreEq<SyntaxError>(list, 2);
+    if (!Is<Cell>(list[0])) {
+        throw SyntaxError(" ");
+    }
+    ObjectVector def_list = EvaluateList(As<Cell>(list[0]));
+    if (!Is<Symbol>(def_list[0])) {
+        throw SyntaxError(" ");
+    }
+    const std::string& name = As<Symbol>(def_list[0])->GetName();
+    ObjectVector lambda_input = ObjectVectorBase(def_list.begin() + 1, def_list.end());
+    ObjectVectorBase lambda_body = ObjectVectorBase(list.begin() + 1, list.end());
+    auto shape = FindClosureShape(list.GetScope(), list[0], lambda_input, lambda_body);
+    auto lambda = std::make_shared<Lambda>(CaptureScope(list.GetScope(), shape), lambda_input,
+                                           lambda_body, name, shape);
+    list.GetScope()->AddVariable(
+        name, std::make_shared<MemoizedFunction>(lambda, MemoizedFunction::kDefaultCapacity));
+    return nullptr;
+}
+
+int EvaluateCapacity(const std::shared_ptr<Object>& obj, const std::shared_ptr<Scope>& scope) {
+    int capacity = As<Number>(obj->Evaluate(scope))->GetValue();
+    if (capacity < 0) {
+        throw RuntimeError(" ");
+    }
+    return capacity;
+}
+
+std::shared_ptr<MemoizedFunction> EvaluateMemoized(ObjectVector& list) {
+    std::shared_ptr<Object> func = list[0]->Evaluate(list.GetScope());
+    if (!Is<MemoizedFunction>(func)) {
+        throw RuntimeError(" ");
+    }
+    return As<MemoizedFunction>(func);
+}
+
+// (memoize f [capacity]): a caching wrapper around the procedure f.
+std::shared_ptr<Object> Memoize(ObjectVector& list) {
+    AssertLengthMoreEq<RuntimeError>(list, 1);
+    AssertLengthLessEq<RuntimeError>(list, 2);
+    std::shared_ptr<Object> func = list[0]->Evaluate(list.GetScope());
+    if (!Is<FunctionWrapper>(func)) {
+        throw RuntimeError(" ");
+    }
+    size_t capacity = MemoizedFunction::kDefaultCapacity;
+    if (list.size() == 2) {
+        capacity = EvaluateCapacity(list[1], list.GetScope());
+    }
+    return std::make_shared<MemoizedFunction>(As<FunctionWrapper>(func), capacity);
+}
+
+// (memo-stats f): ((hits . h) (misses . m) (evictions . e) (size . s) (capacity . c)).
+std::shared_ptr<Object> MemoStats(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    MemoizedFunction::Stats stats = EvaluateMemoized(list)->GetStats();
+    std::pair<const char*, uint64_t> entries[] = {{"hits", stats.hits},
+                                                  {"misses", stats.misses},
+                                                  {"evictions", stats.evictions},
+                                                  {"size", stats.size},
+                                                  {"capacity", stats.capacity}};
+    std::shared_ptr<Object> result;
+    for (auto iter = std::rbegin(entries); iter != std::rend(entries); ++iter) {
+        auto pair = MakeSlabShared<Cell>();
+        pair->SetFirst(std::make_shared<Symbol>(iter->first));
+        pair->SetSecond(MakeSlabShared<Number>(
+            static_cast<int>(std::min<uint64_t>(iter->second, std::numeric_limits<int>::max()))));
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(pair);
+        cell->SetSecond(result);
+        result = cell;
+    }
+    return result;
+}
+
+// (memo-capacity! f n): evicts the least recently used results beyond n.
+std::shared_ptr<Object> SetMemoCapacity(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    EvaluateMemoized(list)->SetCapacity(EvaluateCapacity(list[1], list.GetScope()));
+    return nullptr;
+}
+
+std::shared_ptr<Object> ClearMemo(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    EvaluateMemoized(list)->Clear();
+    return nullptr;
+}
+
+std::shared_ptr<Object> Delay(ObjectVector& list) {
+    AssertLength<SyntaxError>(list, 1);
+    return std::make_shared<Promise>(
+        [expr = list[0], scope = list.GetScope()]() { return expr->Evaluate(scope); });
+}
+
+std::shared_ptr<Object> MakePromise(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    std::shared_ptr<Object> value = list[0]->Evaluate(list.GetScope());
+    if (Is<Promise>(value)) {
+        return value;
+    }
+    return Promise::MakeForced(value);
+}
+
+std::shared_ptr<Object> Force(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return ForceValue(list[0]->Evaluate(list.GetScope()));
+}
+
+std::shared_ptr<Object> IsPromise(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return std::make_shared<Bool>(Is<Promise>(list[0]->Evaluate(list.GetScope())));
+}
+
+// (cons-stream a b): (cons a (delay b)).
+std::shared_ptr<Object> ConsStream(ObjectVector& list) {
+    AssertLength<SyntaxError>(list, 2);
+    return MakeStreamPair(list[0]->Evaluate(list.GetScope()),
+                          [expr = list[1], scope = list.GetScope()]() {
+                              return expr->Evaluate(scope);
+                          });
+}
+
+std::shared_ptr<Object> CarStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return StreamCar(list[0]->Evaluate(list.GetScope()));
+}
+
+std::shared_ptr<Object> CdrStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return StreamCdr(list[0]->Evaluate(list.GetScope()));
+}
+
+std::shared_ptr<Object> MapStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto func = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    return StreamMap(func, list[1]->Evaluate(list.GetScope()), list.GetScope());
+}
+
+std::shared_ptr<Object> FilterStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto pred = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    return StreamFilter(pred, list[1]->Evaluate(list.GetScope()), list.GetScope());
+}
+
+int EvaluateIndex(const std::shared_ptr<Object>& obj, const std::shared_ptr<Scope>& scope) {
+    int index = As<Number>(obj->Evaluate(scope))->GetValue();
+    if (index < 0) {
+        throw RuntimeError(" ");
+    }
+    return index;
+}
+
+// (stream-take s n): the list of the first n elements of s.
+std::shared_ptr<Object> TakeStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    // The walk must hold the only reference to the head, so the forced part
+    // behind it is freed as it goes.
+    std::shared_ptr<Object> stream = list[0]->Evaluate(list.GetScope());
+    int count = EvaluateIndex(list[1], list.GetScope());
+    return StreamTake(std::move(stream), count);
+}
+
+std::shared_ptr<Object> RefStream(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    std::shared_ptr<Object> stream = list[0]->Evaluate(list.GetScope());
+    int index = EvaluateIndex(list[1], list.GetScope());
+    return StreamRef(std::move(stream), index);
+}
+
+std::string EvaluatePath(const std::shared_ptr<Object>& obj, const std::shared_ptr<Scope>& scope) {
+    return As<String>(obj->Evaluate(scope))->GetValue();
+}
+
+std::shared_ptr<InputPort> EvaluateInputPort(const std::shared_ptr<Object>& obj,
+                                             const std::shared_ptr<Scope>& scope) {
+    return As<InputPort>(obj->Evaluate(scope));
+}
+
+std::shared_ptr<Object> OpenInputFile(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return std::make_shared<InputPort>(EvaluatePath(list[0], list.GetScope()));
+}
+
+std::shared_ptr<Object> OpenOutputFile(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return std::make_shared<OutputPort>(EvaluatePath(list[0], list.GetScope()));
+}
+
+std::shared_ptr<Object> CloseInputPort(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    EvaluateInputPort(list[0], list.GetScope())->Close();
+    return nullptr;
+}
+
+std::shared_ptr<Object> CloseOutputPort(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    As<OutputPort>(list[0]->Evaluate(list.GetScope()))->Close();
+    return nullptr;
+}
+
+std::shared_ptr<Object> ReadLine(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    // The line points into the port, which must outlive it.
+    auto port = EvaluateInputPort(list[0], list.GetScope());
+    std::string_view line;
+    if (!port->ReadLine(&line)) {
+        return EofObject::Get();
+    }
+    return std::make_shared<String>(std::string(line));
+}
+
+std::shared_ptr<Object> ReadDatum(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return EvaluateInputPort(list[0], list.GetScope())->ReadDatum();
+}
+
+std::shared_ptr<Object> IsEofObject(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 1);
+    return std::make_shared<Bool>(Is<EofObject>(list[0]->Evaluate(list.GetScope())));
+}
+
+// Writes text to the port in list[1], or to standard output without one.
+std::shared_ptr<Object> WriteToPort(ObjectVector& list, const std::string& text) {
+    if (list.size() == 1) {
+        std::cout << text;
+    } else {
+        As<OutputPort>(list[1]->Evaluate(list.GetScope()))->Write(text);
+    }
+    return nullptr;
+}
+
+// (write obj [port]): obj as the REPL prints it.
+std::shared_ptr<Object> Write(ObjectVector& list) {
+    AssertLengthMoreEq<RuntimeError>(list, 1);
+    AssertLengthLessEq<RuntimeError>(list, 2);
+    std::shared_ptr<Object> value = list[0]->Evaluate(list.GetScope());
+    return WriteToPort(list, value ? value->Serialize() : "()");
+}
+
+// (display obj [port]): like write, but a string is written without quotes.
+std::shared_ptr<Object> Display(ObjectVector& list) {
+    AssertLengthMoreEq<RuntimeError>(list, 1);
+    AssertLengthLessEq<RuntimeError>(list, 2);
+    std::shared_ptr<Object> value = list[0]->Evaluate(list.GetScope());
+    if (Is<String>(value)) {
+        return WriteToPort(list, As<String>(value)->GetValue());
+    }
+    return WriteToPort(list, value ? value->Serialize() : "()");
+}
+
+std::shared_ptr<Object> Newline(ObjectVector& list) {
+    AssertLengthLessEq<RuntimeError>(list, 1);
+    if (list.empty()) {
+        std::cout << '\n';
+        return nullptr;
+    }
+    As<OutputPort>(list[0]->Evaluate(list.GetScope()))->Write("\n");
+    return nullptr;
+}
+
+// (call-with-input-file path f): (f port), closing the port afterwards.
+std::shared_ptr<Object> CallWithInputFile(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto port = std::make_shared<InputPort>(EvaluatePath(list[0], list.GetScope()));
+    auto func = As<FunctionWrapper>(list[1]->Evaluate(list.GetScope()));
+    std::shared_ptr<Object> result = ApplyToValues(func, {port}, list.GetScope());
+    port->Close();
+    return result;
+}
+
+std::shared_ptr<Object> CallWithOutputFile(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto port = std::make_shared<OutputPort>(EvaluatePath(list[0], list.GetScope()));
+    auto func = As<FunctionWrapper>(list[1]->Evaluate(list.GetScope()));
+    std::shared_ptr<Object> result = ApplyToValues(func, {port}, list.GetScope());
+    port->Close();
+    return result;
+}
+
+// (for-each-line f port): (f line) for every line left in port.
+std::shared_ptr<Object> ForEachLine(ObjectVector& list) {
+    AssertLength<RuntimeError>(list, 2);
+    auto func = As<FunctionWrapper>(list[0]->Evaluate(list.GetScope()));
+    auto port = EvaluateInputPort(list[1], list.GetScope());
+    std::string_view line;
+    while (port->ReadLine(&line)) {
+        ApplyToValues(func, {std::make_shared<String>(std::string(line))}, list.GetScope());
+    }
+    return nullptr;
+}
+
 void InsertBooleanFunctions() {
     FunctionsKeeper& instance = FunctionsKeeper::Instance();
     instance.InsertFunction("boolean?", IsBoolean);
@@ -428,6 +1126,9 @@ void InsertListFunctions() {
     instance.InsertFunction("list", ListList);
     instance.InsertFunction("list-ref", ListRefList);
     instance.InsertFunction("list-tail", ListTailList);
+    instance.InsertFunction("length", LengthList);
+    instance.InsertFunction("sort", SortCopyList);
+    instance.InsertFunction("sort!", SortInPlaceList);
 }
 
 void InsertOtherFunctions() {
@@ -439,13 +1140,99 @@ void InsertOtherFunctions() {
     instance.InsertFunction("set-car!", SetCar);
     instance.InsertFunction("set-cdr!", SetCdr);
     instance.InsertFunction("lambda", CreateLambda);
+    instance.InsertFunction("let", Let);
+    instance.InsertFunction("begin", Begin);
+    instance.InsertFunction(kLoopForm, Loop);
+    instance.InsertFunction(kRecurForm, Recur);
+    instance.InsertFunction(kMemvForm, Memv);
     instance.InsertFunction("symbol?", IsSymbol);
+    instance.InsertFunction("save-image", SaveImageFunction);
+    instance.InsertFunction("load", LoadFunction);
+    instance.InsertFunction("define-library", DefineLibraryFunction);
+    instance.InsertFunction("import", ImportFunction);
+    instance.InsertFunction("profile", ProfileFunction);
+    instance.InsertFunction("runtime-stats", RuntimeStatsFunction);
+    instance.InsertFunction("slab-stats", SlabStatsFunction);
+    instance.InsertFunction("max-depth", MaxDepthFunction);
+    instance.InsertFunction("trace-start", StartTrace);
+    instance.InsertFunction("trace-stop", StopTrace);
+    instance.InsertFunction("trace-dump", DumpTrace);
 }
 
-void InitializeFunctionKeeper() {
+void InsertParallelFunctions() {
+    FunctionsKeeper& instance = FunctionsKeeper::Instance();
+    instance.InsertFunction("future", FutureParallel);
+    instance.InsertFunction("touch", TouchParallel);
+    instance.InsertFunction("parallel-map", MapParallel);
+    instance.InsertFunction("parallel-workers", WorkersParallel);
+}
+
+void InsertCoroutineFunctions() {
+    FunctionsKeeper& instance = FunctionsKeeper::Instance();
+    instance.InsertFunction("make-generator", MakeGenerator);
+    instance.InsertFunction("generator-next", NextGenerator);
+    instance.InsertFunction("generator-done?", IsDoneGenerator);
+    instance.InsertFunction("yield", YieldCoroutine);
+    instance.InsertFunction("spawn", SpawnCoroutine);
+    instance.InsertFunction("run-threads", RunThreadsCoroutine);
+    instance.InsertFunction("make-channel", MakeChannel);
+    instance.InsertFunction("channel-send", SendChannel);
+    instance.InsertFunction("channel-receive", ReceiveChannel);
+}
+
+void InsertMemoFunctions() {
+    FunctionsKeeper& instance = FunctionsKeeper::Instance();
+    instance.InsertFunction("define-memoized", DefineMemoized);
+    instance.InsertFunction("memoize", Memoize);
+    instance.InsertFunction("memo-stats", MemoStats);
+    instance.InsertFunction("memo-capacity!", SetMemoCapacity);
+    instance.InsertFunction("memo-clear!", ClearMemo);
+}
+
+void InsertStreamFunctions() {
+    FunctionsKeeper& instance = FunctionsKeeper::Instance();
+    instance.InsertFunction("delay", Delay);
+    instance.InsertFunction("make-promise", MakePromise);
+    instance.InsertFunction("force", Force);
+    instance.InsertFunction("promise?", IsPromise);
+    instance.InsertFunction("cons-stream", ConsStream);
+    instance.InsertFunction("stream-car", CarStream);
+    instance.InsertFunction("stream-cdr", CdrStream);
+    instance.InsertFunction("stream-map", MapStream);
+    instance.InsertFunction("stream-filter", FilterStream);
+    instance.InsertFunction("stream-take", TakeStream);
+    instance.InsertFunction("stream-ref", RefStream);
+}
+
+void InsertPortFunctions() {
     FunctionsKeeper& instance = FunctionsKeeper::Instance();
-    InsertBooleanFunctions();
-    InsertIntegerFunctions();
-    InsertListFunctions();
-    InsertOtherFunctions();
+    instance.InsertFunction("open-input-file", OpenInputFile);
+    instance.InsertFunction("open-output-file", OpenOutputFile);
+    instance.InsertFunction("close-input-port", CloseInputPort);
+    instance.InsertFunction("close-output-port", CloseOutputPort);
+    instance.InsertFunction("read-line", ReadLine);
+    instance.InsertFunction("read", ReadDatum);
+    instance.InsertFunction("eof-object?", IsEofObject);
+    instance.InsertFunction("write", Write);
+    instance.InsertFunction("display", Display);
+    instance.InsertFunction("newline", Newline);
+    instance.InsertFunction("call-with-input-file", CallWithInputFile);
+    instance.InsertFunction("call-with-output-file", CallWithOutputFile);
+    instance.InsertFunction("for-each-line", ForEachLine);
+}
+
+void InitializeFunctionKeeper() {
+    // Workers read the table concurrently, so it is filled exactly once.
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        InsertBooleanFunctions();
+        InsertIntegerFunctions();
+        InsertListFunctions();
+        InsertOtherFunctions();
+        InsertParallelFunctions();
+        InsertCoroutineFunctions();
+        InsertMemoFunctions();
+        InsertStreamFunctions();
+        InsertPortFunctions();
+    });
 }
\ No newline at end of file
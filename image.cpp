@@ -0,0 +1,451 @@
+#include "image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "closure.h"
+#include "library.h"
+#include "mapped_file.h"
+#include "memo.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'C', 'M', 'I', 'M', 'G', '0', '2'};
+
+enum class Tag : uint8_t {
+    NUMBER = 1,
+    BOOL,
+    SYMBOL,
+    STRING,
+    FUNCTION,
+    CELL,
+    LAMBDA,
+    LAMBDA_CREATOR,
+    BOX,
+    MEMOIZED,
+};
+
+void Put32(std::string& out, uint32_t value) {
+    char bytes[4];
+    std::memcpy(bytes, &value, sizeof(value));
+    out.append(bytes, sizeof(bytes));
+}
+
+class ImageWriter {
+public:
+    std::string Write(const std::shared_ptr<Scope>& global_scope) {
+        uint32_t root = ScopeId(global_scope);
+        size_t next_object = 0;
+        size_t next_scope = 0;
+        while (next_object < objects_.size() || next_scope < scopes_.size()) {
+            while (next_object < objects_.size()) {
+                EncodeObject(objects_[next_object++]);
+            }
+            while (next_scope < scopes_.size()) {
+                EncodeScope(scopes_[next_scope++]);
+            }
+        }
+
+        std::string out(kMagic, sizeof(kMagic));
+        Put32(out, strings_.size());
+        Put32(out, scopes_.size());
+        Put32(out, objects_.size());
+        Put32(out, root);
+        for (const auto& s : strings_) {
+            Put32(out, s.size());
+            out += s;
+        }
+        out += scope_records_;
+        out += object_records_;
+        return out;
+    }
+
+private:
+    uint32_t ObjectId(const std::shared_ptr<Object>& obj) {
+        if (!obj) {
+            return 0;
+        }
+        // An imported name is saved as the value it refers to, so saving
+        // loads its library.
+        if (auto imported = std::dynamic_pointer_cast<LibraryExport>(obj)) {
+            return ObjectId(*imported->Resolve());
+        }
+        auto [iter, inserted] = object_ids_.insert({obj.get(), objects_.size() + 1});
+        if (inserted) {
+            objects_.push_back(obj);
+        }
+        return iter->second;
+    }
+
+    uint32_t ScopeId(const std::shared_ptr<Scope>& scope) {
+        if (!scope) {
+            return 0;
+        }
+        auto [iter, inserted] = scope_ids_.insert({scope.get(), scopes_.size() + 1});
+        if (inserted) {
+            scopes_.push_back(scope);
+        }
+        return iter->second;
+    }
+
+    uint32_t StringId(const std::string& s) {
+        auto [iter, inserted] = string_ids_.insert({s, strings_.size()});
+        if (inserted) {
+            strings_.push_back(s);
+        }
+        return iter->second;
+    }
+
+    void PutObjects(const ObjectVectorBase& objects) {
+        Put32(object_records_, objects.size());
+        for (const auto& obj : objects) {
+            Put32(object_records_, ObjectId(obj));
+        }
+    }
+
+    // By value: encoding may add to objects_ and scopes_.
+    void EncodeObject(std::shared_ptr<Object> obj) {
+        std::string& out = object_records_;
+        if (Is<Number>(obj)) {
+            out.push_back(static_cast<char>(Tag::NUMBER));
+            Put32(out, static_cast<uint32_t>(As<Number>(obj)->GetValue()));
+        } else if (Is<Bool>(obj)) {
+            out.push_back(static_cast<char>(Tag::BOOL));
+            out.push_back(obj->operator bool() ? 1 : 0);
+        } else if (Is<Symbol>(obj)) {
+            out.push_back(static_cast<char>(Tag::SYMBOL));
+            Put32(out, StringId(As<Symbol>(obj)->GetName()));
+        } else if (Is<String>(obj)) {
+            out.push_back(static_cast<char>(Tag::STRING));
+            Put32(out, StringId(As<String>(obj)->GetValue()));
+        } else if (Is<Function>(obj)) {
+            out.push_back(static_cast<char>(Tag::FUNCTION));
+            Put32(out, StringId(As<Function>(obj)->GetName()));
+        } else if (Is<Cell>(obj)) {
+            auto cell = As<Cell>(obj);
+            out.push_back(static_cast<char>(Tag::CELL));
+            Put32(out, ObjectId(cell->GetFirst()));
+            Put32(out, ObjectId(cell->GetSecond()));
+        } else if (Is<Lambda>(obj)) {
+            auto lambda = As<Lambda>(obj);
+            out.push_back(static_cast<char>(Tag::LAMBDA));
+            Put32(out, ScopeId(lambda->GetScope()));
+            Put32(out, StringId(lambda->GetName()));
+            PutObjects(lambda->GetOrder());
+            PutObjects(lambda->GetBody());
+        } else if (Is<LambdaCreator>(obj)) {
+            auto creator = As<LambdaCreator>(obj);
+            out.push_back(static_cast<char>(Tag::LAMBDA_CREATOR));
+            Put32(out, ScopeId(creator->GetScope()));
+            Put32(out, StringId(creator->GetName()));
+            PutObjects(creator->GetOrder());
+            PutObjects(creator->GetBody());
+        } else if (Is<Box>(obj)) {
+            auto box = As<Box>(obj);
+            out.push_back(static_cast<char>(Tag::BOX));
+            out.push_back(box->IsBound() ? 1 : 0);
+            Put32(out, ObjectId(box->GetValue()));
+        } else if (Is<MemoizedFunction>(obj)) {
+            // The procedure and the capacity; the cache starts empty again.
+            auto memoized = As<MemoizedFunction>(obj);
+            uint64_t capacity = memoized->GetStats().capacity;
+            out.push_back(static_cast<char>(Tag::MEMOIZED));
+            Put32(out, ObjectId(memoized->GetFunction()));
+            Put32(out, static_cast<uint32_t>(capacity));
+            Put32(out, static_cast<uint32_t>(capacity >> 32));
+        } else {
+            throw RuntimeError(" ");
+        }
+    }
+
+    void EncodeScope(std::shared_ptr<Scope> scope) {
+        std::string& out = scope_records_;
+        Put32(out, ScopeId(scope->GetParentScope()));
+        std::vector<std::pair<uint32_t, uint32_t>> variables;
+        scope->ForEachVariable([&](const std::string& name, const std::shared_ptr<Object>& value) {
+            variables.emplace_back(StringId(name), ObjectId(value));
+        });
+        Put32(out, variables.size());
+        for (const auto& [name, value] : variables) {
+            Put32(out, name);
+            Put32(out, value);
+        }
+    }
+
+    std::unordered_map<const Object*, uint32_t> object_ids_;
+    std::vector<std::shared_ptr<Object>> objects_;
+    std::unordered_map<const Scope*, uint32_t> scope_ids_;
+    std::vector<std::shared_ptr<Scope>> scopes_;
+    std::unordered_map<std::string, uint32_t> string_ids_;
+    std::vector<std::string> strings_;
+    std::string scope_records_;
+    std::string object_records_;
+};
+
+class ImageReader {
+public:
+    ImageReader(const char* data, size_t size) : data_(data), size_(size), pos_(0) {
+    }
+
+    std::shared_ptr<Scope> Read() {
+        if (size_ < sizeof(kMagic) || std::memcmp(data_, kMagic, sizeof(kMagic)) != 0) {
+            throw RuntimeError(" ");
+        }
+        pos_ = sizeof(kMagic);
+        uint32_t string_count = Get32();
+        uint32_t scope_count = Get32();
+        uint32_t object_count = Get32();
+        uint32_t root = Get32();
+
+        strings_.reserve(string_count);
+        for (uint32_t i = 0; i < string_count; ++i) {
+            uint32_t length = Get32();
+            Need(length);
+            strings_.emplace_back(data_ + pos_, length);
+            pos_ += length;
+        }
+
+        scopes_.push_back(nullptr);
+        for (uint32_t i = 0; i < scope_count; ++i) {
+            scopes_.push_back(i + 1 == root ? Scope::MakeGlobal() : MakeSlabShared<Scope>());
+        }
+        scope_offsets_.push_back(0);
+        for (uint32_t i = 0; i < scope_count; ++i) {
+            scope_offsets_.push_back(pos_);
+            scopes_[i + 1]->GetParentScope() = GetScope();
+            uint32_t variables = Get32();
+            Need(static_cast<size_t>(variables) * 8);
+            pos_ += static_cast<size_t>(variables) * 8;
+        }
+
+        // Everything but lambdas is created first, so lambdas can be built from
+        // ready objects; cells and boxes get their fields once every object
+        // exists.
+        objects_.push_back(nullptr);
+        object_offsets_.push_back(0);
+        for (uint32_t i = 0; i < object_count; ++i) {
+            object_offsets_.push_back(pos_);
+            objects_.push_back(CreateShell());
+        }
+        for (uint32_t id = 1; id <= object_count; ++id) {
+            Materialize(id);
+        }
+        for (uint32_t id = 1; id <= object_count; ++id) {
+            if (Is<Cell>(objects_[id])) {
+                pos_ = object_offsets_[id] + 1;
+                auto cell = As<Cell>(objects_[id]);
+                cell->SetFirst(GetObject());
+                cell->SetSecond(GetObject());
+            } else if (Is<Box>(objects_[id])) {
+                pos_ = object_offsets_[id] + 1;
+                bool bound = Get8() != 0;
+                std::shared_ptr<Object> value = GetObject();
+                if (bound) {
+                    As<Box>(objects_[id])->Bind(std::move(value));
+                }
+            }
+        }
+        // Closure analyses aren't saved; with every cell filled in, they are
+        // made again.
+        for (uint32_t id = 1; id <= object_count && IsClosureFlattening(); ++id) {
+            if (Is<Lambda>(objects_[id])) {
+                auto lambda = As<Lambda>(objects_[id]);
+                lambda->SetShape(AnalyzeClosure(lambda->GetOrder(), lambda->GetBody()));
+            } else if (Is<LambdaCreator>(objects_[id])) {
+                auto creator = As<LambdaCreator>(objects_[id]);
+                creator->SetShape(AnalyzeClosure(creator->GetOrder(), creator->GetBody()));
+            }
+        }
+        for (uint32_t id = 1; id <= scope_count; ++id) {
+            pos_ = scope_offsets_[id];
+            Get32();
+            uint32_t variables = Get32();
+            for (uint32_t i = 0; i < variables; ++i) {
+                const std::string& name = GetString();
+                std::shared_ptr<Object> value = GetObject();
+                if (Is<Box>(value)) {
+                    scopes_[id]->AddEntry(name, std::move(value));
+                } else {
+                    scopes_[id]->AddVariable(name, std::move(value));
+                }
+            }
+        }
+        if (root == 0 || root > scope_count) {
+            throw RuntimeError(" ");
+        }
+        return scopes_[root];
+    }
+
+private:
+    void Need(size_t bytes) {
+        if (size_ - pos_ < bytes) {
+            throw RuntimeError(" ");
+        }
+    }
+
+    uint32_t Get32() {
+        Need(4);
+        uint32_t value;
+        std::memcpy(&value, data_ + pos_, sizeof(value));
+        pos_ += sizeof(value);
+        return value;
+    }
+
+    uint8_t Get8() {
+        Need(1);
+        return static_cast<uint8_t>(data_[pos_++]);
+    }
+
+    const std::string& GetString() {
+        uint32_t id = Get32();
+        if (id >= strings_.size()) {
+            throw RuntimeError(" ");
+        }
+        return strings_[id];
+    }
+
+    std::shared_ptr<Scope> GetScope() {
+        uint32_t id = Get32();
+        if (id >= scopes_.size()) {
+            throw RuntimeError(" ");
+        }
+        return scopes_[id];
+    }
+
+    std::shared_ptr<Object> GetObject() {
+        uint32_t id = Get32();
+        if (id >= objects_.size()) {
+            throw RuntimeError(" ");
+        }
+        return objects_[id];
+    }
+
+    // Skips over an id list; lambdas read them again once they are materialized.
+    void SkipObjects() {
+        uint32_t count = Get32();
+        Need(static_cast<size_t>(count) * 4);
+        pos_ += static_cast<size_t>(count) * 4;
+    }
+
+    std::shared_ptr<Object> CreateShell() {
+        auto tag = static_cast<Tag>(Get8());
+        switch (tag) {
+            case Tag::NUMBER:
+                return MakeSlabShared<Number>(static_cast<int>(Get32()));
+            case Tag::BOOL:
+                return std::make_shared<Bool>(Get8() != 0);
+            case Tag::SYMBOL:
+                return std::make_shared<Symbol>(GetString());
+            case Tag::STRING:
+                return std::make_shared<String>(GetString());
+            case Tag::FUNCTION:
+                return Function::CreateFunction(GetString());
+            case Tag::CELL:
+                Need(8);
+                pos_ += 8;
+                return MakeSlabShared<Cell>();
+            case Tag::BOX:
+                Need(5);
+                pos_ += 5;
+                return std::make_shared<Box>();
+            case Tag::MEMOIZED:
+                Need(12);
+                pos_ += 12;
+                return nullptr;
+            case Tag::LAMBDA:
+            case Tag::LAMBDA_CREATOR:
+                Get32();
+                Get32();
+                SkipObjects();
+                SkipObjects();
+                return nullptr;
+            default:
+                throw RuntimeError(" ");
+        }
+    }
+
+    ObjectVectorBase GetObjects() {
+        uint32_t count = Get32();
+        std::vector<uint32_t> ids;
+        for (uint32_t i = 0; i < count; ++i) {
+            ids.push_back(Get32());
+        }
+        ObjectVectorBase objects;
+        size_t saved = pos_;
+        for (uint32_t id : ids) {
+            objects.push_back(Materialize(id));
+        }
+        pos_ = saved;
+        return objects;
+    }
+
+    // Lambdas and memoized procedures hold their parts by value, so those are
+    // built first. They can only reach themselves through a cell or a scope,
+    // which already exist.
+    std::shared_ptr<Object> Materialize(uint32_t id) {
+        if (id >= objects_.size()) {
+            throw RuntimeError(" ");
+        }
+        if (id == 0 || objects_[id]) {
+            return objects_[id];
+        }
+        if (in_progress_.count(id)) {
+            throw RuntimeError(" ");
+        }
+        in_progress_.insert(id);
+        size_t saved = pos_;
+        pos_ = object_offsets_[id];
+        auto tag = static_cast<Tag>(Get8());
+        if (tag == Tag::MEMOIZED) {
+            std::shared_ptr<Object> function = Materialize(Get32());
+            uint64_t capacity = Get32();
+            capacity |= uint64_t{Get32()} << 32;
+            if (!Is<FunctionWrapper>(function)) {
+                throw RuntimeError(" ");
+            }
+            objects_[id] =
+                std::make_shared<MemoizedFunction>(As<FunctionWrapper>(function), capacity);
+            pos_ = saved;
+            return objects_[id];
+        }
+        std::shared_ptr<Scope> scope = GetScope();
+        const std::string& name = GetString();
+        ObjectVector order = GetObjects();
+        ObjectVectorBase body = GetObjects();
+        if (tag == Tag::LAMBDA) {
+            objects_[id] = std::make_shared<Lambda>(scope, order, body, name);
+        } else {
+            objects_[id] = std::make_shared<LambdaCreator>(scope, order, body, name);
+        }
+        pos_ = saved;
+        return objects_[id];
+    }
+
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+    std::vector<std::string> strings_;
+    std::vector<std::shared_ptr<Scope>> scopes_;
+    std::vector<size_t> scope_offsets_;
+    std::vector<std::shared_ptr<Object>> objects_;
+    std::vector<size_t> object_offsets_;
+    std::unordered_set<uint32_t> in_progress_;
+};
+
+}  // namespace
+
+void SaveImage(const std::shared_ptr<Scope>& global_scope, const std::string& path) {
+    std::string image = ImageWriter().Write(global_scope);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.write(image.data(), image.size())) {
+        throw RuntimeError(" ");
+    }
+}
+
+std::shared_ptr<Scope> LoadImage(const std::string& path) {
+    MappedFile file(path);
+    return ImageReader(file.Data(), file.Size()).Read();
+}
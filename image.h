@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "object.h"
+
+// Heap images: the global scope and everything reachable from it, written to a
+// compact binary file and read back without parsing or evaluating anything.
+//
+// The file holds a string table, a scope table and an object table. Objects
+// and scopes refer to each other by index, so sharing and cycles survive.
+// Memoized procedures are saved without their caches. Futures, generators,
+// channels, promises and ports can't be saved.
+
+void SaveImage(const std::shared_ptr<Scope>& global_scope, const std::string& path);
+
+std::shared_ptr<Scope> LoadImage(const std::string& path);
@@ -0,0 +1,311 @@
+#include "library.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+#include "quicken.h"
+#include "source_cache.h"
+
+namespace {
+
+// The elements of a proper list; anything else is a syntax error.
+ObjectVectorBase Elements(const std::shared_ptr<Object>& list) {
+    ObjectVectorBase items;
+    std::shared_ptr<Object> tail = list;
+    while (Is<Cell>(tail)) {
+        auto cell = As<Cell>(tail);
+        items.push_back(cell->GetFirst());
+        tail = cell->GetSecond();
+    }
+    if (tail) {
+        throw SyntaxError(" ");
+    }
+    return items;
+}
+
+const std::string& NameOf(const std::shared_ptr<Object>& obj) {
+    if (!Is<Symbol>(obj)) {
+        throw SyntaxError(" ");
+    }
+    return As<Symbol>(obj)->GetName();
+}
+
+const std::string* HeadName(const ObjectVectorBase& items) {
+    return !items.empty() && Is<Symbol>(items[0]) ? &As<Symbol>(items[0])->GetName() : nullptr;
+}
+
+// (utils math) is "utils/math", which is also where its file is looked for.
+std::string LibraryName(const std::shared_ptr<Object>& name) {
+    ObjectVectorBase parts = Elements(name);
+    if (parts.empty()) {
+        throw SyntaxError(" ");
+    }
+    std::string joined;
+    for (const auto& part : parts) {
+        if (!Is<Symbol>(part) && !Is<Number>(part)) {
+            throw SyntaxError(" ");
+        }
+        if (!joined.empty()) {
+            joined += '/';
+        }
+        joined += part->Serialize();
+    }
+    return joined;
+}
+
+class Registry {
+public:
+    static Registry& Instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    void Declare(std::shared_ptr<Library> library) {
+        std::lock_guard lock(mutex_);
+        libraries_[library->GetName()] = std::move(library);
+    }
+
+    // The lock is held while a file is read, so two threads importing the
+    // same library get the same one.
+    std::shared_ptr<Library> Find(const std::string& name) {
+        std::lock_guard lock(mutex_);
+        if (auto iter = libraries_.find(name); iter != libraries_.end()) {
+            return iter->second;
+        }
+        for (const auto& directory : paths_) {
+            for (const char* extension : {".sld", ".scm"}) {
+                std::string path = directory + "/" + name + extension;
+                if (access(path.c_str(), R_OK) == 0) {
+                    ReadLibraries(path);
+                    if (auto iter = libraries_.find(name); iter != libraries_.end()) {
+                        return iter->second;
+                    }
+                    throw RuntimeError(" ");
+                }
+            }
+        }
+        throw RuntimeError(" ");
+    }
+
+    void AddPath(const std::string& directory) {
+        std::lock_guard lock(mutex_);
+        paths_.push_back(directory);
+    }
+
+private:
+    Registry() {
+        const char* env = std::getenv("SCHEME_LIBRARY_PATH");
+        std::string path = env ? env : ".";
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = std::min(path.find(':', start), path.size());
+            if (end != start) {
+                paths_.push_back(path.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+    }
+
+    void ReadLibraries(const std::string& path) {
+        for (const auto& form : ReadSourceFile(path)) {
+            ObjectVectorBase items = Elements(form);
+            const std::string* head = HeadName(items);
+            if (!head || *head != "define-library") {
+                throw SyntaxError(" ");
+            }
+            auto library = ParseLibrary(ObjectVectorBase(items.begin() + 1, items.end()));
+            // Declared before its file was read: the declaration stands.
+            libraries_.emplace(library->GetName(), std::move(library));
+        }
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Library>> libraries_;
+    std::vector<std::string> paths_;
+};
+
+using Bindings = std::vector<std::pair<std::string, std::shared_ptr<Object>>>;
+
+Bindings::iterator FindBinding(Bindings* bindings, const std::string& name) {
+    for (auto iter = bindings->begin(); iter != bindings->end(); ++iter) {
+        if (iter->first == name) {
+            return iter;
+        }
+    }
+    throw SyntaxError(" ");
+}
+
+// The names import_set binds and what each is bound to.
+Bindings ResolveImportSet(const std::shared_ptr<Object>& import_set) {
+    ObjectVectorBase items = Elements(import_set);
+    const std::string* head = HeadName(items);
+    bool modifier = head && items.size() >= 2 && Is<Cell>(items[1]) &&
+                    (*head == "only" || *head == "except" || *head == "prefix" ||
+                     *head == "rename");
+    if (!modifier) {
+        std::shared_ptr<Library> library = Registry::Instance().Find(LibraryName(import_set));
+        Bindings bindings;
+        for (const auto& [external, internal] : library->GetExports()) {
+            bindings.emplace_back(external, std::make_shared<LibraryExport>(library, internal));
+        }
+        return bindings;
+    }
+    Bindings bindings = ResolveImportSet(items[1]);
+    if (*head == "only") {
+        Bindings kept;
+        for (size_t i = 2; i < items.size(); ++i) {
+            kept.push_back(*FindBinding(&bindings, NameOf(items[i])));
+        }
+        return kept;
+    }
+    if (*head == "except") {
+        for (size_t i = 2; i < items.size(); ++i) {
+            bindings.erase(FindBinding(&bindings, NameOf(items[i])));
+        }
+        return bindings;
+    }
+    if (*head == "prefix") {
+        if (items.size() != 3) {
+            throw SyntaxError(" ");
+        }
+        for (auto& binding : bindings) {
+            binding.first.insert(0, NameOf(items[2]));
+        }
+        return bindings;
+    }
+    for (size_t i = 2; i < items.size(); ++i) {
+        ObjectVectorBase names = Elements(items[i]);
+        if (names.size() != 2) {
+            throw SyntaxError(" ");
+        }
+        FindBinding(&bindings, NameOf(names[0]))->first = NameOf(names[1]);
+    }
+    return bindings;
+}
+
+}  // namespace
+
+Library::Library(std::string name, Exports exports, ObjectVectorBase imports,
+                 ObjectVectorBase body)
+    : name_(std::move(name)),
+      exports_(std::move(exports)),
+      imports_(std::move(imports)),
+      body_(std::move(body)) {
+}
+
+const std::shared_ptr<Scope>& Library::Load() {
+    if (IsLoaded()) {
+        return scope_;
+    }
+    if (loader_.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+        throw RuntimeError(" ");
+    }
+    std::lock_guard lock(mutex_);
+    if (IsLoaded()) {
+        return scope_;
+    }
+    // A scope with no parent: the body sees its own definitions, its imports
+    // and the builtins, and nothing of the importer's.
+    auto scope = MakeSlabShared<Scope>();
+    loader_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    try {
+        for (const auto& import_set : imports_) {
+            ImportLibrary(import_set, scope);
+        }
+        for (const auto& form : body_) {
+            form->Evaluate(scope);
+        }
+        for (const auto& export_names : exports_) {
+            if (!scope->FindLocal(export_names.second)) {
+                throw NameError(" ");
+            }
+        }
+    } catch (...) {
+        loader_.store(std::thread::id(), std::memory_order_relaxed);
+        throw;
+    }
+    loader_.store(std::thread::id(), std::memory_order_relaxed);
+    scope_ = std::move(scope);
+    loaded_.store(true, std::memory_order_release);
+    return scope_;
+}
+
+LibraryExport::LibraryExport(std::shared_ptr<Library> library, std::string name)
+    : library_(std::move(library)), name_(std::move(name)) {
+}
+
+std::shared_ptr<Object>* LibraryExport::Resolve() {
+    std::shared_ptr<Object>* slot = slot_.load(std::memory_order_acquire);
+    if (!slot) {
+        // Load checked the library binds the name; its slot stays put while
+        // the library, which this export keeps, lives.
+        slot = library_->Load()->FindLocal(name_);
+        slot_.store(slot, std::memory_order_release);
+    }
+    return slot;
+}
+
+std::shared_ptr<Object> LibraryExport::Evaluate(std::shared_ptr<Scope>) {
+    std::shared_ptr<Object> value = *Resolve();
+    if (Is<DeferredBinding>(value)) {
+        return value->Evaluate();
+    }
+    return value;
+}
+
+std::shared_ptr<Library> ParseLibrary(const ObjectVectorBase& declaration) {
+    if (declaration.empty()) {
+        throw SyntaxError(" ");
+    }
+    std::string name = LibraryName(declaration[0]);
+    Library::Exports exports;
+    ObjectVectorBase imports;
+    ObjectVectorBase body;
+    for (size_t i = 1; i < declaration.size(); ++i) {
+        ObjectVectorBase items = Elements(declaration[i]);
+        const std::string* head = HeadName(items);
+        if (!head) {
+            throw SyntaxError(" ");
+        }
+        if (*head == "export") {
+            for (size_t j = 1; j < items.size(); ++j) {
+                if (Is<Symbol>(items[j])) {
+                    exports.emplace_back(NameOf(items[j]), NameOf(items[j]));
+                    continue;
+                }
+                ObjectVectorBase rename = Elements(items[j]);
+                if (rename.size() != 3 || NameOf(rename[0]) != "rename") {
+                    throw SyntaxError(" ");
+                }
+                exports.emplace_back(NameOf(rename[2]), NameOf(rename[1]));
+            }
+        } else if (*head == "import") {
+            imports.insert(imports.end(), items.begin() + 1, items.end());
+        } else if (*head == "begin") {
+            // Each form is a top-level form of the library's scope.
+            for (size_t j = 1; j < items.size(); ++j) {
+                body.push_back(Quicken(items[j]));
+            }
+        } else {
+            throw SyntaxError(" ");
+        }
+    }
+    return std::make_shared<Library>(std::move(name), std::move(exports), std::move(imports),
+                                     std::move(body));
+}
+
+void DeclareLibrary(std::shared_ptr<Library> library) {
+    Registry::Instance().Declare(std::move(library));
+}
+
+void ImportLibrary(const std::shared_ptr<Object>& import_set, const std::shared_ptr<Scope>& scope) {
+    // Every library is found before anything is bound, so a failed import binds nothing.
+    for (auto& [name, binding] : ResolveImportSet(import_set)) {
+        scope->AddVariable(name, std::move(binding));
+    }
+}
+
+void AddLibraryPath(const std::string& directory) {
+    Registry::Instance().AddPath(directory);
+}
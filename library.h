@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "object.h"
+
+// Libraries.
+//
+// (define-library (name part ...) declaration ...) declares a library without
+// evaluating any of it. A declaration is (export spec ...), where a spec is a
+// name or (rename internal external), (import set ...) or (begin form ...).
+// (import set ...) binds the exports of each import set in the global scope,
+// or in the library's own scope when it is one of its declarations. A set is a
+// library name, or (only set name ...), (except set name ...),
+// (prefix set prefix) or (rename set (name new-name) ...) of another set.
+//
+// A library that hasn't been declared when it is imported is read from the
+// first directory of the library path holding part/.../last.sld, or .scm; the
+// file may only hold define-library forms. It goes through ReadSourceFile, so
+// its parsed forms are cached like those of any source file.
+//
+// Importing evaluates nothing either: each name is bound to a LibraryExport.
+// The first time one of them is evaluated, the library's imports and body run
+// in a scope of their own, whose bindings the exports then refer to; a body
+// that fails leaves the library to be loaded again by the next reference. A
+// library is loaded once per process, so the interpreters importing it share
+// its definitions, and a name its body set!s changes for all of them.
+
+class Library {
+public:
+    // (external name, internal name) pairs.
+    using Exports = std::vector<std::pair<std::string, std::string>>;
+
+    Library(std::string name, Exports exports, ObjectVectorBase imports, ObjectVectorBase body);
+
+    const std::string& GetName() const {
+        return name_;
+    }
+
+    const Exports& GetExports() const {
+        return exports_;
+    }
+
+    // The scope of the loaded library, loading it first if it isn't.
+    const std::shared_ptr<Scope>& Load();
+
+    bool IsLoaded() const {
+        return loaded_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::string name_;
+    Exports exports_;
+    ObjectVectorBase imports_;
+    ObjectVectorBase body_;
+
+    std::mutex mutex_;
+    std::atomic<bool> loaded_{false};
+    // The thread running the body, so a library that needs itself while it
+    // loads is an error rather than a deadlock.
+    std::atomic<std::thread::id> loader_{};
+    std::shared_ptr<Scope> scope_;
+};
+
+class LibraryExport : public DeferredBinding {
+public:
+    LibraryExport(std::shared_ptr<Library> library, std::string name);
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override;
+
+    // The binding in the library's scope, loading the library first.
+    std::shared_ptr<Object>* Resolve();
+
+private:
+    std::shared_ptr<Library> library_;
+    std::string name_;
+    std::atomic<std::shared_ptr<Object>*> slot_{nullptr};
+};
+
+// A library from the operands of define-library: its name, then declarations.
+std::shared_ptr<Library> ParseLibrary(const ObjectVectorBase& declaration);
+
+// Makes library the one its name imports from now on.
+void DeclareLibrary(std::shared_ptr<Library> library);
+
+// Binds the names import_set makes visible in scope.
+void ImportLibrary(const std::shared_ptr<Object>& import_set, const std::shared_ptr<Scope>& scope);
+
+// Directories searched for undeclared libraries, in order: those of
+// SCHEME_LIBRARY_PATH (separated by colons, "." when it isn't set), then the
+// ones added.
+void AddLibraryPath(const std::string& directory);
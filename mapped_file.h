@@ -0,0 +1,65 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "error.h"
+
+// A whole file mapped read-only into memory.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw RuntimeError(" ");
+        }
+        struct stat info;
+        if (fstat(fd, &info) < 0 || info.st_size == 0) {
+            close(fd);
+            throw RuntimeError(" ");
+        }
+        size_ = info.st_size;
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            throw RuntimeError(" ");
+        }
+        data_ = static_cast<const char*>(data);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        munmap(const_cast<char*>(data_), size_);
+    }
+
+    const char* Data() const {
+        return data_;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Hints that the file will be read front to back.
+    void AdviseSequential() {
+        madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+    }
+
+    // Drops the pages of [begin, end) from memory; reading them again maps
+    // them back from the file. begin must be page aligned, end is rounded down.
+    void Release(size_t begin, size_t end) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        end -= end % page;
+        if (end > begin) {
+            madvise(const_cast<char*>(data_) + begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+};
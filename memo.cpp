@@ -0,0 +1,157 @@
+#include "memo.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+void AppendBytes(std::string* key, const std::string& bytes) {
+    uint32_t length = bytes.size();
+    key->append(reinterpret_cast<const char*>(&length), sizeof(length));
+    key->append(bytes);
+}
+
+// The key of a value that isn't a pair.
+bool AppendAtomKey(const std::shared_ptr<Object>& value, std::string* key) {
+    if (!value) {
+        key->push_back('n');
+    } else if (Is<Number>(value)) {
+        int number = As<Number>(value)->GetValue();
+        key->push_back('i');
+        key->append(reinterpret_cast<const char*>(&number), sizeof(number));
+    } else if (Is<Bool>(value)) {
+        key->push_back(*value ? 't' : 'f');
+    } else if (Is<Symbol>(value)) {
+        key->push_back('s');
+        AppendBytes(key, As<Symbol>(value)->GetName());
+    } else if (Is<String>(value)) {
+        key->push_back('q');
+        AppendBytes(key, As<String>(value)->GetValue());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+// A list is its elements one after another, then the tail of the chain. The
+// lists being encoded go on an explicit stack; a chain that runs into itself,
+// caught by a second pointer following at half speed, and a key past
+// kMaxMemoKeySize (which a list nested in itself reaches) aren't keys.
+bool AppendStructuralKey(const std::shared_ptr<Object>& value, std::string* key) {
+    struct Frame {
+        std::shared_ptr<Object> rest;
+        std::shared_ptr<Object> slow;
+        bool move_slow;
+    };
+    std::vector<Frame> stack;
+    std::shared_ptr<Object> next = value;
+    while (true) {
+        if (Is<Cell>(next)) {
+            key->push_back('(');
+            stack.push_back({next, next, false});
+        } else if (!AppendAtomKey(next, key)) {
+            return false;
+        }
+        if (key->size() > kMaxMemoKeySize) {
+            return false;
+        }
+        while (true) {
+            if (stack.empty()) {
+                return true;
+            }
+            Frame& frame = stack.back();
+            if (!Is<Cell>(frame.rest)) {
+                key->push_back('.');
+                if (!AppendAtomKey(frame.rest, key)) {
+                    return false;
+                }
+                stack.pop_back();
+                continue;
+            }
+            auto cell = As<Cell>(frame.rest);
+            frame.rest = cell->GetSecond();
+            if (frame.move_slow) {
+                frame.slow = As<Cell>(frame.slow)->GetSecond();
+            }
+            frame.move_slow = !frame.move_slow;
+            if (frame.rest == frame.slow && Is<Cell>(frame.rest)) {
+                return false;
+            }
+            next = cell->GetFirst();
+            break;
+        }
+    }
+}
+
+MemoizedFunction::MemoizedFunction(std::shared_ptr<FunctionWrapper> function, size_t capacity)
+    : function_(std::move(function)), capacity_(capacity) {
+}
+
+std::shared_ptr<Object> MemoizedFunction::Apply(ObjectVector& args) const {
+    ObjectVectorBase values;
+    std::string key;
+    bool cacheable = true;
+    for (const auto& arg : args) {
+        if (!arg) {
+            continue;
+        }
+        values.push_back(arg->Evaluate(args.GetScope()));
+        cacheable = cacheable && AppendStructuralKey(values.back(), &key);
+    }
+    if (cacheable) {
+        std::lock_guard lock(mutex_);
+        auto iter = index_.find(key);
+        if (iter != index_.end()) {
+            ++stats_.hits;
+            entries_.splice(entries_.begin(), entries_, iter->second);
+            return iter->second->second;
+        }
+    }
+
+    std::shared_ptr<Object> result = ApplyToValues(function_, values, args.GetScope());
+
+    if (cacheable) {
+        std::lock_guard lock(mutex_);
+        ++stats_.misses;
+        auto iter = index_.find(key);
+        if (iter != index_.end()) {
+            iter->second->second = result;
+            entries_.splice(entries_.begin(), entries_, iter->second);
+        } else {
+            entries_.emplace_front(key, result);
+            index_.emplace(std::move(key), entries_.begin());
+            EvictOverflow();
+        }
+    }
+    return result;
+}
+
+MemoizedFunction::Stats MemoizedFunction::GetStats() const {
+    std::lock_guard lock(mutex_);
+    Stats stats = stats_;
+    stats.size = entries_.size();
+    stats.capacity = capacity_;
+    return stats;
+}
+
+void MemoizedFunction::SetCapacity(size_t capacity) {
+    std::lock_guard lock(mutex_);
+    capacity_ = capacity;
+    EvictOverflow();
+}
+
+void MemoizedFunction::Clear() {
+    std::lock_guard lock(mutex_);
+    entries_.clear();
+    index_.clear();
+}
+
+void MemoizedFunction::EvictOverflow() const {
+    while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+}
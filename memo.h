@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "object.h"
+
+// A function wrapped with a cache of its results, created by `memoize` and
+// `define-memoized`.
+//
+// Calls are keyed by the structure of their evaluated arguments: numbers,
+// booleans, symbols, strings and lists of them compare by value. A call with
+// any other argument (a procedure, say), a circular list, or a key past
+// kMaxMemoKeySize isn't cached. The cache keeps at most
+// `capacity` results and evicts the least recently used one. Results are
+// shared between calls, so mutating a returned list changes the cached one.
+class MemoizedFunction : public FunctionWrapper {
+public:
+    static constexpr size_t kDefaultCapacity = 65536;
+
+    MemoizedFunction(std::shared_ptr<FunctionWrapper> function, size_t capacity);
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Apply(ObjectVector& args) const override;
+
+    const std::string& GetName() const override {
+        return function_->GetName();
+    }
+
+    const std::shared_ptr<FunctionWrapper>& GetFunction() const {
+        return function_;
+    }
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+    };
+
+    Stats GetStats() const;
+    void SetCapacity(size_t capacity);
+    void Clear();
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<Object>>;
+
+    void EvictOverflow() const;
+
+    std::shared_ptr<FunctionWrapper> function_;
+    // Evaluation happens outside the lock, so recursive calls and parallel
+    // workers don't wait on each other; two of them may compute the same
+    // result, and the later one wins.
+    mutable std::mutex mutex_;
+    // Most recently used first.
+    mutable std::list<Entry> entries_;
+    mutable std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t capacity_;
+    mutable Stats stats_;
+};
+
+// Keys longer than this aren't cached.
+inline constexpr size_t kMaxMemoKeySize = 1 << 20;
+
+// Appends a self-delimiting encoding of value to key; false if the value has a
+// part that can't be compared structurally, is circular, or makes the key
+// longer than kMaxMemoKeySize.
+bool AppendStructuralKey(const std::shared_ptr<Object>& value, std::string* key);
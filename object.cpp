@@ -1,75 +1,323 @@
 #include "object.h"
 
+#include <pthread.h>
+#include <cstdlib>
+#include "closure.h"
+
+namespace {
+
+size_t DefaultMaxDepth() {
+    if (const char* env = std::getenv("SCHEME_MAX_DEPTH")) {
+        long long depth = std::atoll(env);
+        if (depth > 0) {
+            return depth;
+        }
+    }
+    return DepthGuard::kDefaultMaxDepth;
+}
+
+}  // namespace
+
+std::atomic<size_t> DepthGuard::max_depth_{DefaultMaxDepth()};
+
+void DepthGuard::FindStackLimit() {
+    pthread_attr_t attr;
+    void* stack = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &stack, &size);
+        pthread_attr_destroy(&attr);
+    }
+    if (!stack || size <= kStackReserve) {
+        // Unknown: rely on the depth limit alone.
+        stack_limit_ = 1;
+        return;
+    }
+    stack_limit_ = reinterpret_cast<uintptr_t>(stack) + kStackReserve;
+}
+
 void CollectEvaluations(std::shared_ptr<Object> list, ObjectVector& eval) {
-    auto empty = std::make_shared<Cell>();
-    empty->GetFirst() = nullptr;
-    empty->GetSecond() = nullptr;
-    if (Is<Cell>(list)) {
-        auto cell_list = As<Cell>(list);
-        if (cell_list->GetFirst() != nullptr) {
-            eval.push_back(cell_list->GetFirst());
-        } else {
-            eval.push_back(nullptr);
+    // Iterative, and reads each pair once: cdr of a packed pair makes a view.
+    while (auto cell_list = std::dynamic_pointer_cast<Cell>(list)) {
+        eval.push_back(cell_list->GetFirst());
+        list = cell_list->GetSecond();
+        if (list == nullptr) {
+            return;
         }
-        if (cell_list->GetSecond() != nullptr) {
-            CollectEvaluations(cell_list->GetSecond(), eval);
+    }
+    eval.push_back(list);
+}
+
+namespace {
+
+bool IsUniqueCell(const std::shared_ptr<Object>& obj) {
+    return obj && obj.use_count() == 1 && dynamic_cast<Cell*>(obj.get());
+}
+
+}  // namespace
+
+Cell::~Cell() {
+    // Cars that are lists themselves wait here; it only allocates for them.
+    std::vector<std::shared_ptr<Object>> nested;
+    if (IsUniqueCell(cell_.first)) {
+        nested.push_back(std::move(cell_.first));
+    }
+    std::shared_ptr<Object> next = std::move(cell_.second);
+    while (true) {
+        while (IsUniqueCell(next)) {
+            auto* cell = static_cast<Cell*>(next.get());
+            if (IsUniqueCell(cell->cell_.first)) {
+                nested.push_back(std::move(cell->cell_.first));
+            }
+            std::shared_ptr<Object> rest = std::move(cell->cell_.second);
+            next = std::move(rest);
         }
-    } else {
-        eval.push_back(list);
+        if (nested.empty()) {
+            return;
+        }
+        next = std::move(nested.back());
+        nested.pop_back();
     }
 }
 
+// Nested lists go on an explicit stack, so depth costs no native stack.
+std::string Cell::Serialize() {
+    struct Frame {
+        ObjectVectorBase items;
+        bool dotted;
+        size_t next;
+    };
+    std::string ans;
+    std::vector<Frame> stack;
+    auto open = [&](const std::shared_ptr<Object>& list) {
+        Frame frame{{}, false, 0};
+        std::shared_ptr<Object> tail = list;
+        while (auto cell = std::dynamic_pointer_cast<Cell>(tail)) {
+            frame.items.push_back(cell->GetFirst());
+            tail = cell->GetSecond();
+        }
+        if (tail) {
+            frame.items.push_back(std::move(tail));
+            frame.dotted = true;
+        }
+        ans += '(';
+        stack.push_back(std::move(frame));
+    };
+    open(shared_from_this());
+    while (!stack.empty()) {
+        Frame& frame = stack.back();
+        if (frame.next == frame.items.size()) {
+            ans += ')';
+            stack.pop_back();
+            continue;
+        }
+        size_t index = frame.next++;
+        if (index != 0) {
+            ans += frame.dotted && index + 1 == frame.items.size() ? " . " : " ";
+        }
+        std::shared_ptr<Object> item = frame.items[index];
+        if (!item) {
+            ans += "()";
+        } else if (Is<Cell>(item)) {
+            open(item);
+        } else {
+            ans += item->Serialize();
+        }
+    }
+    return ans;
+}
+
 ObjectVector EvaluateList(const std::shared_ptr<Object>& list) {
     ObjectVector res;
     CollectEvaluations(list, res);
     return res;
 }
 
+std::shared_ptr<Object> Quoted(const std::shared_ptr<Object>& value) {
+    auto quote = MakeSlabShared<Cell>();
+    auto argument = MakeSlabShared<Cell>();
+    quote->SetFirst(std::make_shared<Symbol>("quote"));
+    quote->SetSecond(argument);
+    argument->SetFirst(value);
+    return quote;
+}
+
+std::shared_ptr<Object> ApplyToValues(const std::shared_ptr<FunctionWrapper>& func,
+                                      const ObjectVectorBase& values,
+                                      const std::shared_ptr<Scope>& scope) {
+    ObjectVector args;
+    args.reserve(values.size());
+    for (const auto& value : values) {
+        args.push_back(Quoted(value));
+    }
+    args.GetScope() = scope;
+    return func->Apply(args);
+}
+
+std::shared_ptr<Scope> Scope::MakeGlobal() {
+    auto scope = MakeSlabShared<Scope>();
+    scope->environment_ = std::make_shared<Environment>();
+    return scope;
+}
+
 void Scope::AddVariable(const std::string& name, std::shared_ptr<Object> variable) {
+    if (Environment* environment = ActiveEnvironment()) {
+        environment->Define(name, std::move(variable));
+        return;
+    }
     auto iter = variables_.find(name);
     if (iter == variables_.end()) {
         variables_.insert({name, std::move(variable)});
+        stamp_.store(0, std::memory_order_relaxed);
+    } else if (Box* box = AsBox(iter->second)) {
+        box->Bind(std::move(variable));
     } else {
-        variables_[name] = variable;
+        iter->second = std::move(variable);
     }
 }
 
 void Scope::SetVariable(const std::string& name, std::shared_ptr<Object> variable) {
-    auto iter = variables_.find(name);
-    if (iter == variables_.end()) {
-        if (parent_scope_) {
-            return parent_scope_->SetVariable(name, variable);
+    if (Environment* environment = ActiveEnvironment()) {
+        if (!environment->Assign(name, std::move(variable))) {
+            throw NameError(" ");
         }
-        throw NameError(" ");
+        return;
+    }
+    if (std::shared_ptr<Object>* slot = FindSlot(name)) {
+        *slot = std::move(variable);
+    } else if (parent_scope_) {
+        CountRuntime(RuntimeCounter::SCOPE_HOPS);
+        parent_scope_->SetVariable(name, std::move(variable));
     } else {
-        variables_[name] = variable;
+        throw NameError(" ");
     }
 }
 
 std::shared_ptr<Object> Scope::GetVariable(const std::string& name) {
-    auto iter = variables_.find(name);
-    if (iter == variables_.end()) {
-        if (parent_scope_) {
-            return parent_scope_->GetVariable(name);
-        }
-        return Function::CreateFunction(name);
-    } else {
-        return iter->second;
+    if (Environment* environment = ActiveEnvironment()) {
+        std::shared_ptr<Object>* slot = environment->Find(name);
+        return slot ? *slot : Function::CreateFunction(name);
     }
+    if (std::shared_ptr<Object>* slot = FindSlot(name)) {
+        return *slot;
+    }
+    if (parent_scope_) {
+        CountRuntime(RuntimeCounter::SCOPE_HOPS);
+        return parent_scope_->GetVariable(name);
+    }
+    return Function::CreateFunction(name);
 }
 
 std::shared_ptr<Scope>& Scope::GetParentScope() {
     return parent_scope_;
 }
 
-bool Scope::HasVariable(const std::string& name) {
+std::shared_ptr<Object>* Scope::FindLocal(const std::string& name) {
+    if (Environment* environment = ActiveEnvironment()) {
+        return environment->Find(name);
+    }
+    return FindSlot(name);
+}
+
+std::shared_ptr<Object>* Scope::FindSlot(const std::string& name) {
     auto iter = variables_.find(name);
     if (iter == variables_.end()) {
-        if (parent_scope_) {
-            return parent_scope_->HasVariable(name);
+        return nullptr;
+    }
+    if (Box* box = AsBox(iter->second)) {
+        return box->IsBound() ? &box->GetValue() : nullptr;
+    }
+    return &iter->second;
+}
+
+Box* Scope::AsBox(const std::shared_ptr<Object>& entry) const {
+    return has_boxes_ ? dynamic_cast<Box*>(entry.get()) : nullptr;
+}
+
+void Scope::EnterCall(std::shared_ptr<const ClosureShape> shape) {
+    kind_ = Kind::CALL;
+    if (shape) {
+        for (const auto& name : shape->boxed) {
+            BoxVariable(name);
         }
-        return Function::HasFunction(name);
-    } else {
+    }
+    shape_ = std::move(shape);
+}
+
+const std::shared_ptr<Object>* Scope::FindEntry(const std::string& name) const {
+    auto iter = variables_.find(name);
+    return iter == variables_.end() ? nullptr : &iter->second;
+}
+
+void Scope::AddEntry(const std::string& name, std::shared_ptr<Object> entry) {
+    if (Is<Box>(entry)) {
+        has_boxes_ = true;
+    } else if (ActiveEnvironment()) {
+        AddVariable(name, std::move(entry));
+        return;
+    }
+    auto [iter, inserted] = variables_.insert_or_assign(name, std::move(entry));
+    if (inserted) {
+        stamp_.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::shared_ptr<Box> Scope::BoxVariable(const std::string& name) {
+    has_boxes_ = true;
+    auto iter = variables_.find(name);
+    if (iter == variables_.end()) {
+        auto box = std::make_shared<Box>();
+        variables_.insert({name, box});
+        stamp_.store(0, std::memory_order_relaxed);
+        return box;
+    }
+    if (Is<Box>(iter->second)) {
+        return As<Box>(iter->second);
+    }
+    auto box = std::make_shared<Box>(std::move(iter->second));
+    iter->second = box;
+    return box;
+}
+
+uint64_t Scope::GetStamp() {
+    if (Environment* environment = ActiveEnvironment()) {
+        return environment->GetStamp();
+    }
+    uint64_t stamp = stamp_.load(std::memory_order_relaxed);
+    if (stamp == 0) {
+        uint64_t fresh = NewStamp();
+        stamp = stamp_.compare_exchange_strong(stamp, fresh, std::memory_order_relaxed) ? fresh
+                                                                                           : stamp;
+    }
+    return stamp;
+}
+
+uint64_t Scope::NewStamp() {
+    static std::atomic<uint64_t> next_stamp{0};
+    return next_stamp.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void Scope::ForEachVariable(
+    FunctionRef<void(const std::string&, const std::shared_ptr<Object>&)> visit) {
+    if (Environment* environment = ActiveEnvironment()) {
+        environment->ForEach(visit);
+        return;
+    }
+    for (const auto& [name, value] : variables_) {
+        visit(name, value);
+    }
+}
+
+bool Scope::HasVariable(const std::string& name) {
+    if (Environment* environment = ActiveEnvironment()) {
+        return environment->Find(name) || Function::HasFunction(name);
+    }
+    if (FindSlot(name)) {
         return true;
     }
+    if (parent_scope_) {
+        CountRuntime(RuntimeCounter::SCOPE_HOPS);
+        return parent_scope_->HasVariable(name);
+    }
+    return Function::HasFunction(name);
 }
@@ -1,18 +1,31 @@
 #pragma once
 
 #include "error.h"
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <variant>
 #include <vector>
 #include <unordered_map>
+#include "environment.h"
 #include "function_ref.h"
+#include "profiler.h"
+#include "runtime_stats.h"
+#include "slab_allocator.h"
+#include "tracer.h"
 #include <iostream>
 
+class Box;
 class Scope;
+struct ClosureShape;
 
 class Object : public std::enable_shared_from_this<Object> {
 public:
+    Object() {
+        ++object_allocations;
+    }
+
     virtual std::string Serialize() = 0;
     virtual std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) = 0;
     virtual ~Object() = default;
@@ -21,21 +34,114 @@ public:
     }
 };
 
+// Scopes, numbers and cells are allocated with MakeSlabShared.
 class Scope {
 
 public:
+    static constexpr const char* kSlabName = "scope";
+
     Scope() : variables_(), parent_scope_() {
     }
 
+    // A scope whose bindings live in an Environment, so the interpreter that
+    // owns it can be forked.
+    static std::shared_ptr<Scope> MakeGlobal();
+
     void AddVariable(const std::string& name, std::shared_ptr<Object> variable);
     void SetVariable(const std::string& name, std::shared_ptr<Object> variable);
     bool HasVariable(const std::string& name);
     std::shared_ptr<Object> GetVariable(const std::string& name);
     std::shared_ptr<Scope>& GetParentScope();
 
+    // The binding of name in this scope itself, or nullptr. It stays put for as
+    // long as the scope lives.
+    std::shared_ptr<Object>* FindLocal(const std::string& name);
+
+    // What a scope is for, which decides what the closures made below it copy
+    // (see closure.h): a let, loop or other block, the call of a procedure, the
+    // variables a closure keeps, or the body of a future, which runs on another
+    // thread than the scopes above it.
+    enum class Kind : uint8_t { BLOCK, CALL, CLOSURE, FUTURE };
+
+    Kind GetKind() const {
+        return kind_;
+    }
+
+    void SetKind(Kind kind) {
+        kind_ = kind;
+    }
+
+    // For a CALL scope, the analysis of the procedure called; may be nullptr.
+    const std::shared_ptr<const ClosureShape>& GetShape() const {
+        return shape_;
+    }
+
+    // Makes this the scope of a call to a procedure of shape, boxing the
+    // variables the closures made during the call are to share.
+    void EnterCall(std::shared_ptr<const ClosureShape> shape);
+
+    // The binding of name in this scope itself as it is stored: a Box if the
+    // variable is shared with closures. nullptr if the scope doesn't bind it.
+    const std::shared_ptr<Object>* FindEntry(const std::string& name) const;
+
+    // Binds name to entry as FindEntry returns it.
+    void AddEntry(const std::string& name, std::shared_ptr<Object> entry);
+
+    // Makes room for count bindings.
+    void Reserve(size_t count) {
+        variables_.reserve(count);
+    }
+
+    // Puts the binding of name in a Box, an unbound one if the scope doesn't
+    // bind name yet, and returns the box.
+    std::shared_ptr<Box> BoxVariable(const std::string& name);
+
+    bool HasBoxes() const {
+        return has_boxes_;
+    }
+
+    // Changes whenever a name is added to this scope, and is never the same for
+    // two scopes, so (scope, stamp) pins down which names a scope binds.
+    uint64_t GetStamp();
+
+    // A stamp no scope or environment has had yet.
+    static uint64_t NewStamp();
+
+    // The environment a global scope was made with; nullptr for other scopes.
+    const std::shared_ptr<Environment>& GetEnvironment() const {
+        return environment_;
+    }
+
+    void ForEachVariable(
+        FunctionRef<void(const std::string&, const std::shared_ptr<Object>&)> visit);
+
 private:
+    // The value of name in this scope itself, looking through its box; nullptr
+    // if the scope doesn't bind it or the box is unbound.
+    std::shared_ptr<Object>* FindSlot(const std::string& name);
+    Box* AsBox(const std::shared_ptr<Object>& entry) const;
+
+    // The environment of a global scope as the calling thread sees it, or
+    // nullptr for any other scope.
+    Environment* ActiveEnvironment() {
+        if (!environment_) {
+            return nullptr;
+        }
+        const environment_detail::Active& active = environment_detail::active;
+        return active.scope == this ? active.environment : environment_.get();
+    }
+
     std::unordered_map<std::string, std::shared_ptr<Object>> variables_;
+    // Set for global scopes only, which keep their bindings there instead.
+    std::shared_ptr<Environment> environment_;
     std::shared_ptr<Scope> parent_scope_;
+    std::shared_ptr<const ClosureShape> shape_;
+    // 0 until someone asks for it, and again after a name is added.
+    std::atomic<uint64_t> stamp_{0};
+    Kind kind_ = Kind::BLOCK;
+    // Whether any binding is a Box, so scopes without one never check.
+    bool has_boxes_ = false;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::SCOPES_CREATED> counter_;
 };
 
 using ObjectVectorBase = std::vector<std::shared_ptr<Object>>;
@@ -60,6 +166,62 @@ using FunctionSignature = std::shared_ptr<Object> (*)(ObjectVector&);
 
 ObjectVector EvaluateList(const std::shared_ptr<Object>& list);
 
+// Wraps an already evaluated value into (quote value), so it survives being
+// passed through FunctionWrapper::Apply, which evaluates its arguments.
+std::shared_ptr<Object> Quoted(const std::shared_ptr<Object>& value);
+
+// Counts the evaluations (and expansions of nested forms) in progress on this
+// thread. Past the depth limit, or when less than kStackReserve bytes of
+// native stack are left, it throws a RuntimeError instead of letting the
+// recursion crash the process. The same limit bounds the nesting of lists the
+// reader accepts. SCHEME_MAX_DEPTH sets it at startup, (max-depth n) later.
+class DepthGuard {
+public:
+    static constexpr size_t kDefaultMaxDepth = 100000;
+    static constexpr size_t kStackReserve = 256 * 1024;
+
+    DepthGuard() {
+        if (!stack_limit_) {
+            FindStackLimit();
+        }
+        char marker;
+        if (++depth_ > max_depth_.load(std::memory_order_relaxed) ||
+            reinterpret_cast<uintptr_t>(&marker) < stack_limit_) {
+            --depth_;
+            throw RuntimeError(" ");
+        }
+    }
+
+    ~DepthGuard() {
+        --depth_;
+    }
+
+    DepthGuard(const DepthGuard&) = delete;
+    DepthGuard& operator=(const DepthGuard&) = delete;
+
+    static size_t GetMaxDepth() {
+        return max_depth_.load(std::memory_order_relaxed);
+    }
+
+    static void SetMaxDepth(size_t depth) {
+        max_depth_.store(depth, std::memory_order_relaxed);
+    }
+
+private:
+    static void FindStackLimit();
+
+    static std::atomic<size_t> max_depth_;
+    static inline thread_local size_t depth_ = 0;
+    // The lowest address evaluation may use; 0 until looked up.
+    static inline thread_local uintptr_t stack_limit_ = 0;
+};
+
+class FunctionWrapper;
+
+std::shared_ptr<Object> ApplyToValues(const std::shared_ptr<FunctionWrapper>& func,
+                                      const ObjectVectorBase& values,
+                                      const std::shared_ptr<Scope>& scope);
+
 class FunctionsKeeper {
 public:
     void InsertFunction(const std::string& s, FunctionSignature sign) {
@@ -67,6 +229,7 @@ public:
     }
 
     FunctionSignature GetFunction(const std::string& s) {
+        CountRuntime(RuntimeCounter::FUNCTION_LOOKUPS);
         auto iter = functions_.find(s);
         if (iter == functions_.end()) {
             throw NameError(" ");
@@ -75,6 +238,7 @@ public:
     }
 
     static bool HasFunction(const std::string& s) {
+        CountRuntime(RuntimeCounter::FUNCTION_LOOKUPS);
         return (Instance().functions_.find(s) != Instance().functions_.end());
     }
 
@@ -93,16 +257,25 @@ private:
 class FunctionWrapper : public Object {
 public:
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
         return shared_from_this();
     }
 
     virtual std::shared_ptr<Object> Apply(ObjectVector& args) const = 0;
+
+    // The name calls are attributed to in profiles; empty for anonymous lambdas.
+    virtual const std::string& GetName() const = 0;
 };
 
+
 class Function : public FunctionWrapper {
 
 public:
-    Function(FunctionSignature f) : func_(f) {
+    Function(FunctionSignature f, const std::string& name = "") : func_(f), name_(name) {
+    }
+
+    const std::string& GetName() const override {
+        return name_;
     }
 
     std::string Serialize() override {
@@ -115,7 +288,7 @@ public:
 
     static std::shared_ptr<Function> CreateFunction(const std::string& str) {
         FunctionsKeeper& keeper = FunctionsKeeper::Instance();
-        return std::shared_ptr<Function>(new Function(keeper.GetFunction(str)));
+        return std::shared_ptr<Function>(new Function(keeper.GetFunction(str), str));
     }
 
     static bool HasFunction(const std::string& str) {
@@ -124,6 +297,8 @@ public:
 
 private:
     FunctionRef<std::shared_ptr<Object>(ObjectVector&)> func_;
+    std::string name_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::FUNCTIONS_CREATED> counter_;
 };
 
 template <class T>
@@ -131,7 +306,45 @@ std::shared_ptr<T> As(const std::shared_ptr<Object>& obj);
 template <class T>
 bool Is(const std::shared_ptr<Object>& obj);
 
-class LambdaCreator;
+// A binding that evaluating its name turns into the value: a LambdaCreator
+// makes a Lambda, an imported name (see library.h) loads its library.
+class DeferredBinding : public Object {};
+
+// A variable a scope shares with the closures that use it (see closure.h). An
+// unbound one stands for a name the scope is yet to define; until it does,
+// lookups go on to the parent scope.
+class Box : public Object {
+public:
+    Box() = default;
+
+    explicit Box(std::shared_ptr<Object> value) : value_(std::move(value)), bound_(true) {
+    }
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        throw RuntimeError(" ");
+    }
+
+    bool IsBound() const {
+        return bound_;
+    }
+
+    void Bind(std::shared_ptr<Object> value) {
+        value_ = std::move(value);
+        bound_ = true;
+    }
+
+    std::shared_ptr<Object>& GetValue() {
+        return value_;
+    }
+
+private:
+    std::shared_ptr<Object> value_;
+    bool bound_ = false;
+};
 
 class Symbol : public Object {
 public:
@@ -144,12 +357,10 @@ public:
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
         if (scope) {
             std::shared_ptr<Object> obj = scope->GetVariable(symbol_);
-            while (Is<Symbol>(obj)) {
-                obj = scope->GetVariable(As<Symbol>(obj)->GetName());
-            }
-            if (Is<LambdaCreator>(obj)) {
+            if (Is<DeferredBinding>(obj)) {
                 return obj->Evaluate();
             }
             return obj;
@@ -162,14 +373,17 @@ public:
 
 private:
     std::string symbol_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::SYMBOLS_CREATED> counter_;
 };
 
 class Lambda : public FunctionWrapper {
 
 public:
-    Lambda(std::shared_ptr<Scope> scope, const ObjectVector& vars, ObjectVectorBase& body)
-        : order_(), scope_(std::make_shared<Scope>()), body_(body) {
-        scope_->GetParentScope() = scope;
+    // scope is what the closure keeps of where it was made (see closure.h);
+    // shape the analysis of its body, if there is one.
+    Lambda(std::shared_ptr<Scope> scope, const ObjectVector& vars, ObjectVectorBase& body,
+           const std::string& name = "", std::shared_ptr<const ClosureShape> shape = nullptr)
+        : order_(), scope_(std::move(scope)), body_(body), name_(name), shape_(std::move(shape)) {
         std::copy_if(vars.begin(), vars.end(), std::back_inserter(order_),
                      [](std::shared_ptr<Object> ptr) { return ptr != nullptr; });
     }
@@ -179,40 +393,91 @@ public:
     }
 
     std::shared_ptr<Object> Apply(ObjectVector& args) const override {
-        std::shared_ptr<Scope> cur_scope = scope_;
+        std::shared_ptr<Scope> cur_scope = BindArguments(args);
+        std::shared_ptr<Object> res;
+        for (auto& i : body_) {
+            res = i->Evaluate(cur_scope);
+        }
+        return res;
+    }
+
+    // Every call gets a fresh scope, so one Lambda may be applied recursively
+    // or from several workers at once.
+    std::shared_ptr<Scope> BindArguments(ObjectVector& args) const {
+        std::shared_ptr<Scope> cur_scope = MakeSlabShared<Scope>();
+        cur_scope->GetParentScope() = scope_;
+        cur_scope->EnterCall(shape_);
         ObjectVector args_redefined;
         std::copy_if(args.begin(), args.end(), std::back_inserter(args_redefined),
                      [](std::shared_ptr<Object> ptr) { return ptr != nullptr; });
         if (args_redefined.size() != order_.size()) {
             throw RuntimeError(" ");
         }
-        ObjectVector vars;
         for (size_t i = 0; i < args_redefined.size(); ++i) {
             cur_scope->AddVariable(As<Symbol>(order_[i])->GetName(),
                                    args_redefined[i]->Evaluate(args.GetScope()));
         }
-        std::shared_ptr<Object> res;
-        for (auto& i : body_) {
-            res = i->Evaluate(cur_scope);
-        }
-        return res;
+        return cur_scope;
+    }
+
+    const ObjectVectorBase& GetOrder() const {
+        return order_;
+    }
+
+    const std::shared_ptr<Scope>& GetScope() const {
+        return scope_;
     }
 
-    static std::shared_ptr<Lambda> CreateLambda(ObjectVector& vars, ObjectVectorBase& body) {
-        return std::make_shared<Lambda>(vars.GetScope(), vars, body);
+    const ObjectVectorBase& GetBody() const {
+        return body_;
+    }
+
+    const std::string& GetName() const override {
+        return name_;
+    }
+
+    void SetName(const std::string& name) {
+        name_ = name;
+    }
+
+    const std::shared_ptr<const ClosureShape>& GetShape() const {
+        return shape_;
+    }
+
+    void SetShape(std::shared_ptr<const ClosureShape> shape) {
+        shape_ = std::move(shape);
     }
 
 private:
     ObjectVectorBase order_;
     std::shared_ptr<Scope> scope_;
     std::vector<std::shared_ptr<Object>> body_;
+    std::string name_;
+    std::shared_ptr<const ClosureShape> shape_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::LAMBDAS_CREATED> counter_;
 };
 
-class LambdaCreator : public Object {
+// Applies a function, recording the call in the active profile and trace.
+inline std::shared_ptr<Object> ApplyFunction(const FunctionWrapper& func, ObjectVector& args) {
+    if (Profiler* profiler = Profiler::Active()) {
+        Profiler::Call call(profiler, func.GetName());
+        return func.Apply(args);
+    }
+    if (Tracer::Enabled()) {
+        Tracer::Span span(func.GetName(), dynamic_cast<const Lambda*>(&func)
+                                              ? TraceCategory::LAMBDA
+                                              : TraceCategory::BUILTIN);
+        return func.Apply(args);
+    }
+    return func.Apply(args);
+}
+
+class LambdaCreator : public DeferredBinding {
 public:
-    LambdaCreator(std::shared_ptr<Scope> scope, const ObjectVector& vars, ObjectVectorBase& body)
-        : order_(), scope_(std::make_shared<Scope>()), body_(body) {
-        scope_->GetParentScope() = scope;
+    LambdaCreator(std::shared_ptr<Scope> scope, const ObjectVector& vars, ObjectVectorBase& body,
+                  const std::string& name = "",
+                  std::shared_ptr<const ClosureShape> shape = nullptr)
+        : order_(), scope_(std::move(scope)), body_(body), name_(name), shape_(std::move(shape)) {
         std::copy_if(vars.begin(), vars.end(), std::back_inserter(order_),
                      [](std::shared_ptr<Object> ptr) { return ptr != nullptr; });
     }
@@ -222,19 +487,42 @@ public:
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
         ObjectVector obj = order_;
         obj.GetScope() = scope_;
-        return CreateLambda(obj, body_);
+        return std::make_shared<Lambda>(scope_, obj, body_, name_, shape_);
+    }
+
+    const ObjectVectorBase& GetOrder() const {
+        return order_;
+    }
+
+    const std::shared_ptr<Scope>& GetScope() const {
+        return scope_;
+    }
+
+    const ObjectVectorBase& GetBody() const {
+        return body_;
+    }
+
+    const std::string& GetName() const {
+        return name_;
+    }
+
+    const std::shared_ptr<const ClosureShape>& GetShape() const {
+        return shape_;
     }
 
-    static std::shared_ptr<Lambda> CreateLambda(ObjectVector& vars, ObjectVectorBase& body) {
-        return std::make_shared<Lambda>(vars.GetScope(), vars, body);
+    void SetShape(std::shared_ptr<const ClosureShape> shape) {
+        shape_ = std::move(shape);
     }
 
 private:
     ObjectVectorBase order_;
     std::shared_ptr<Scope> scope_;
     std::vector<std::shared_ptr<Object>> body_;
+    std::string name_;
+    std::shared_ptr<const ClosureShape> shape_;
 };
 
 class Bool : public Object {
@@ -259,6 +547,7 @@ public:
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
         return std::make_shared<Bool>(value_);
     }
 
@@ -268,10 +557,13 @@ public:
 
 private:
     bool value_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::BOOLS_CREATED> counter_;
 };
 
 class Number : public Object {
 public:
+    static constexpr const char* kSlabName = "number";
+
     int GetValue() const {
         return value_;
     };
@@ -281,7 +573,8 @@ public:
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
-        return std::make_shared<Number>(GetValue());
+        CountRuntime(RuntimeCounter::EVALUATIONS);
+        return MakeSlabShared<Number>(GetValue());
     }
 
     Number(int n) : value_(n) {
@@ -289,98 +582,98 @@ public:
 
 private:
     int value_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::NUMBERS_CREATED> counter_;
 };
 
-class Cell : public Object {
+class String : public Object {
 public:
+    const std::string& GetValue() const {
+        return value_;
+    }
+
     std::string Serialize() override {
-        std::string ans = "(";
-        ObjectVector cell;
-        if (shared_from_this()) {
-            cell = EvaluateList(shared_from_this());
-        }
-        ObjectVector me_in_vector = ObjectVectorBase({shared_from_this()});
-        if (cell.empty()) {
-            return "(())";
-        }
-        for (size_t j = 0; j < cell.size() - 1; ++j) {
-            auto i = cell[j];
-            if (j != 0) {
-                ans += ' ';
-            }
-            if (!i) {
-                ans += "()";
-            } else {
-                ans += i->Serialize();
-            }
-        }
-        bool is_wrong = false;
-        std::shared_ptr<Cell> cur = As<Cell>(shared_from_this());
-        while (cur->GetSecond() != nullptr && Is<Cell>(cur->GetSecond())) {
-            cur = As<Cell>(cur->GetSecond());
-        }
-        if (cur->GetSecond() == nullptr) {
-            is_wrong = false;
-        } else {
-            is_wrong = true;
-        }
-        if (is_wrong) {
-            ans += " .";
-        }
-        if (cell.size() > 1) {
-            ans += " ";
-        }
-        if (!cell.empty()) {
-            if (!cell.back()) {
-                ans += "()";
+        std::string ans = "\"";
+        for (char c : value_) {
+            if (c == '"' || c == '\\') {
+                ans += '\\';
+                ans += c;
+            } else if (c == '\n') {
+                ans += "\\n";
             } else {
-                ans += cell.back()->Serialize();
+                ans += c;
             }
         }
-        ans += ")";
+        ans += '"';
         return ans;
     }
 
     std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
-        if (GetSecond() == nullptr && GetFirst() == nullptr) {
-            throw RuntimeError(" ");
-        }
-        if (!GetFirst()) {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
+        return shared_from_this();
+    }
+
+    String(const std::string& s) : value_(s) {
+        ChargeHeap(value_.capacity());
+    }
+
+    ~String() override {
+        CreditHeap(value_.capacity());
+    }
+
+private:
+    std::string value_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::STRINGS_CREATED> counter_;
+};
+
+class Cell : public Object {
+public:
+    static constexpr const char* kSlabName = "cell";
+
+    // Frees the cells only this one holds in a loop, so dropping a long or
+    // deeply nested list takes no native stack per cell.
+    ~Cell() override;
+
+    std::string Serialize() override;
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        CountRuntime(RuntimeCounter::EVALUATIONS);
+        ChargeStep();
+        DepthGuard depth_guard;
+        std::shared_ptr<Object> head = GetFirst();
+        if (!head) {
             throw RuntimeError(" ");
         }
-        std::shared_ptr<Object> first_arg = GetFirst()->Evaluate(scope);
+        std::shared_ptr<Object> rest = GetSecond();
+        std::shared_ptr<Object> first_arg = head->Evaluate(scope);
         std::shared_ptr<FunctionWrapper> func = As<FunctionWrapper>(first_arg);
         ObjectVector objects;
-        if (Is<Symbol>(GetFirst())) {
-            if (As<Symbol>(GetFirst())->GetName() == "quote") {
-                auto second = As<Cell>(GetSecond());
-                objects = ObjectVectorBase({second->GetFirst()});
-            } else {
-                objects = EvaluateList(GetSecond());
-            }
-        } else {
-            objects = EvaluateList(GetSecond());
+        if (Is<Symbol>(head) && As<Symbol>(head)->GetName() == "quote") {
+            objects = ObjectVectorBase({As<Cell>(rest)->GetFirst()});
+        } else if (rest) {
+            objects = EvaluateList(rest);
         }
         objects.GetScope() = scope;
-        std::shared_ptr<Object> res = (func->Apply(objects));
+        std::shared_ptr<Object> res = ApplyFunction(*func, objects);
         return res;
     }
 
-    std::shared_ptr<Object> GetFirst() const {
+    // Virtual for PackedCell, a pair inside a packed list.
+    virtual std::shared_ptr<Object> GetFirst() const {
         return cell_.first;
-    };
-    std::shared_ptr<Object>& GetFirst() {
-        return cell_.first;
-    };
-    std::shared_ptr<Object> GetSecond() const {
-        return cell_.second;
-    };
-    std::shared_ptr<Object>& GetSecond() {
+    }
+    virtual std::shared_ptr<Object> GetSecond() const {
         return cell_.second;
-    };
+    }
+    virtual void SetFirst(std::shared_ptr<Object> value) {
+        cell_.first = std::move(value);
+    }
+    virtual void SetSecond(std::shared_ptr<Object> value) {
+        cell_.second = std::move(value);
+    }
 
 private:
     std::pair<std::shared_ptr<Object>, std::shared_ptr<Object>> cell_;
+    [[no_unique_address]] InstanceCounter<RuntimeCounter::CELLS_CREATED> counter_;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,159 @@
+#include "packed_list.h"
+
+#include <limits>
+#include <vector>
+
+std::shared_ptr<Object> PackedCell::Skip(size_t* count) const {
+    size_t end = list_->RunEnd(index_);
+    if (*count <= end - index_) {
+        size_t index = index_ + *count;
+        *count = 0;
+        return MakeSlabShared<PackedCell>(list_, index);
+    }
+    *count -= end - index_ + 1;
+    return list_->GetRunTail(end);
+}
+
+std::shared_ptr<Object> PackedCell::CopyRun(ObjectVectorBase* items) const {
+    size_t end = list_->RunEnd(index_);
+    for (size_t i = index_; i <= end; ++i) {
+        items->push_back(list_->GetItem(i));
+    }
+    return list_->GetRunTail(end);
+}
+
+std::shared_ptr<Object> PackedCell::StoreRun(ObjectVectorBase::const_iterator* next) const {
+    size_t end = list_->RunEnd(index_);
+    for (size_t i = index_; i <= end; ++i) {
+        list_->SetItem(i, *(*next)++);
+    }
+    return list_->GetRunTail(end);
+}
+
+std::shared_ptr<Object> MakePackedList(ObjectVectorBase items) {
+    if (items.size() >= kMinPackedLength) {
+        return MakeSlabShared<PackedCell>(std::make_shared<PackedList>(std::move(items)), 0);
+    }
+    std::shared_ptr<Object> list;
+    for (auto iter = items.rbegin(); iter != items.rend(); ++iter) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(std::move(*iter));
+        cell->SetSecond(std::move(list));
+        list = std::move(cell);
+    }
+    return list;
+}
+
+std::shared_ptr<Object> ListTail(std::shared_ptr<Object> list, size_t count) {
+    while (count > 0) {
+        if (Is<PackedCell>(list)) {
+            list = As<PackedCell>(list)->Skip(&count);
+        } else {
+            list = As<Cell>(list)->GetSecond();
+            --count;
+        }
+    }
+    return list;
+}
+
+bool ProperListLength(std::shared_ptr<Object> list, size_t* length) {
+    *length = 0;
+    while (list) {
+        if (Is<PackedCell>(list)) {
+            size_t count = std::numeric_limits<size_t>::max();
+            list = As<PackedCell>(list)->Skip(&count);
+            *length += std::numeric_limits<size_t>::max() - count;
+        } else if (Is<Cell>(list)) {
+            list = As<Cell>(list)->GetSecond();
+            ++*length;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+ObjectVectorBase ListElements(std::shared_ptr<Object> list) {
+    size_t length;
+    if (!ProperListLength(list, &length)) {
+        throw RuntimeError(" ");
+    }
+    ObjectVectorBase items;
+    items.reserve(length);
+    while (list) {
+        if (Is<PackedCell>(list)) {
+            list = As<PackedCell>(list)->CopyRun(&items);
+        } else {
+            auto cell = As<Cell>(list);
+            items.push_back(cell->GetFirst());
+            list = cell->GetSecond();
+        }
+    }
+    return items;
+}
+
+void StoreListElements(std::shared_ptr<Object> list, const ObjectVectorBase& values) {
+    auto next = values.begin();
+    while (list) {
+        if (Is<PackedCell>(list)) {
+            list = As<PackedCell>(list)->StoreRun(&next);
+        } else {
+            auto cell = As<Cell>(list);
+            cell->SetFirst(*next++);
+            list = cell->GetSecond();
+        }
+    }
+}
+
+namespace {
+
+// The list of items with tail after them: packed if it is proper.
+std::shared_ptr<Object> MakeLiteralList(ObjectVectorBase items, std::shared_ptr<Object> tail) {
+    if (!tail) {
+        return MakePackedList(std::move(items));
+    }
+    for (auto iter = items.rbegin(); iter != items.rend(); ++iter) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(std::move(*iter));
+        cell->SetSecond(std::move(tail));
+        tail = std::move(cell);
+    }
+    return tail;
+}
+
+}  // namespace
+
+// The lists being packed go on an explicit stack, as in the reader, so a
+// literal may be nested as deeply as the reader allows.
+std::shared_ptr<Object> PackLiteral(const std::shared_ptr<Object>& datum) {
+    if (!Is<Cell>(datum)) {
+        return datum;
+    }
+    struct Frame {
+        // The elements packed so far, and the cells after them.
+        ObjectVectorBase items;
+        std::shared_ptr<Object> rest;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({{}, datum});
+    while (true) {
+        Frame& frame = stack.back();
+        if (Is<Cell>(frame.rest)) {
+            auto cell = As<Cell>(frame.rest);
+            frame.rest = cell->GetSecond();
+            if (Is<Cell>(cell->GetFirst())) {
+                stack.push_back({{}, cell->GetFirst()});
+            } else {
+                frame.items.push_back(cell->GetFirst());
+            }
+            continue;
+        }
+        std::shared_ptr<Object> list =
+            MakeLiteralList(std::move(frame.items), std::move(frame.rest));
+        stack.pop_back();
+        if (stack.empty()) {
+            return list;
+        }
+        stack.back().items.push_back(std::move(list));
+    }
+}
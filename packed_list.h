@@ -0,0 +1,127 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include "object.h"
+
+// Packed lists.
+//
+// A proper list made by `list` or written as a quoted literal keeps its
+// elements in one array instead of a chain of cells, once it has at least
+// kMinPackedLength of them. Its pairs are PackedCells, an index into the array
+// that cdr makes on demand and that is dropped as soon as a walk moves on, so
+// a long list costs a pointer per element and walking it reads one block of
+// memory.
+//
+// set-car! writes into the array. set-cdr! cuts the array after that pair:
+// every walk that reaches the pair continues with the new cdr, and pairs
+// behind the cut still lead to the elements after it, as they would in a
+// chain of cells. length, list-ref and list-tail jump over the array up to
+// the next cut, so they take constant time on a list that was never cut.
+
+class PackedList {
+public:
+    explicit PackedList(ObjectVectorBase items) : items_(std::move(items)) {
+        ChargeHeap(items_.capacity() * sizeof(items_[0]));
+    }
+
+    ~PackedList() {
+        CreditHeap(items_.capacity() * sizeof(items_[0]));
+    }
+
+    size_t Size() const {
+        return items_.size();
+    }
+
+    // The last index reachable from index without passing a cut.
+    size_t RunEnd(size_t index) const {
+        auto cut = cuts_.lower_bound(index);
+        return cut == cuts_.end() ? items_.size() - 1 : cut->first;
+    }
+
+    const std::shared_ptr<Object>& GetItem(size_t index) const {
+        return items_[index];
+    }
+
+    void SetItem(size_t index, std::shared_ptr<Object> value) {
+        items_[index] = std::move(value);
+    }
+
+    // The cdr of the last pair of a run: the cut's value, or () at the end.
+    std::shared_ptr<Object> GetRunTail(size_t end) const {
+        auto cut = cuts_.find(end);
+        return cut == cuts_.end() ? nullptr : cut->second;
+    }
+
+    void Cut(size_t index, std::shared_ptr<Object> value) {
+        cuts_[index] = std::move(value);
+    }
+
+private:
+    ObjectVectorBase items_;
+    std::map<size_t, std::shared_ptr<Object>> cuts_;
+};
+
+class PackedCell : public Cell {
+public:
+    static constexpr const char* kSlabName = "packed-cell";
+
+    PackedCell(std::shared_ptr<PackedList> list, size_t index)
+        : list_(std::move(list)), index_(index) {
+    }
+
+    std::shared_ptr<Object> GetFirst() const override {
+        return list_->GetItem(index_);
+    }
+
+    std::shared_ptr<Object> GetSecond() const override {
+        if (index_ < list_->RunEnd(index_)) {
+            return MakeSlabShared<PackedCell>(list_, index_ + 1);
+        }
+        return list_->GetRunTail(index_);
+    }
+
+    void SetFirst(std::shared_ptr<Object> value) override {
+        list_->SetItem(index_, std::move(value));
+    }
+
+    void SetSecond(std::shared_ptr<Object> value) override {
+        list_->Cut(index_, std::move(value));
+    }
+
+    // Takes up to *count cdrs at once, as far as the next cut, and subtracts
+    // the number taken from *count.
+    std::shared_ptr<Object> Skip(size_t* count) const;
+
+    // Appends the elements as far as the next cut to *items and returns the
+    // cdr of the last pair.
+    std::shared_ptr<Object> CopyRun(ObjectVectorBase* items) const;
+
+    // Overwrites the elements as far as the next cut with those from *next
+    // on, advancing it, and returns the cdr of the last pair.
+    std::shared_ptr<Object> StoreRun(ObjectVectorBase::const_iterator* next) const;
+
+private:
+    std::shared_ptr<PackedList> list_;
+    size_t index_;
+};
+
+constexpr size_t kMinPackedLength = 8;
+
+// The proper list of items; packed when there are at least kMinPackedLength.
+std::shared_ptr<Object> MakePackedList(ObjectVectorBase items);
+
+// The tail of list after count pairs, or a RuntimeError if it's shorter.
+std::shared_ptr<Object> ListTail(std::shared_ptr<Object> list, size_t count);
+
+// The number of pairs in list; false if it doesn't end in ().
+bool ProperListLength(std::shared_ptr<Object> list, size_t* length);
+
+// The elements of a proper list, or a RuntimeError if it isn't one.
+ObjectVectorBase ListElements(std::shared_ptr<Object> list);
+
+// Stores values in the cars of list, which has as many pairs, in order.
+void StoreListElements(std::shared_ptr<Object> list, const ObjectVectorBase& values);
+
+// A copy of a datum with its long proper lists packed, for quoted literals.
+std::shared_ptr<Object> PackLiteral(const std::shared_ptr<Object>& datum);
@@ -0,0 +1,282 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+constexpr size_t kNoWorker = std::numeric_limits<size_t>::max();
+
+thread_local size_t current_worker = kNoWorker;
+
+size_t DefaultWorkerCount() {
+    if (const char* env = std::getenv("SCHEME_WORKERS")) {
+        int count = std::atoi(env);
+        if (count > 0) {
+            return count;
+        }
+    }
+    size_t count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool()
+    : queued_(0), next_queue_(0), stopping_(false), worker_count_(DefaultWorkerCount()) {
+}
+
+ThreadPool& ThreadPool::Instance() {
+    static ThreadPool* pool = new ThreadPool{};
+    return *pool;
+}
+
+size_t ThreadPool::GetWorkerCount() {
+    return worker_count_;
+}
+
+void ThreadPool::SetWorkerCount(size_t count) {
+    if (count == 0) {
+        throw RuntimeError(" ");
+    }
+    if (current_worker != kNoWorker) {
+        // A worker can't join itself.
+        throw RuntimeError(" ");
+    }
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    if (!workers_.empty()) {
+        Stop();
+    }
+    worker_count_ = count;
+}
+
+void ThreadPool::Start(size_t count) {
+    stopping_ = false;
+    for (size_t i = 0; i < count; ++i) {
+        queues_.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        workers_.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+}
+
+// Lets the workers drain every queued task, then joins them.
+void ThreadPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    queues_.clear();
+}
+
+void ThreadPool::Submit(Task task) {
+    // The task charges the budget of the call that made it.
+    if (const std::shared_ptr<Budget>& budget = Budget::Current()) {
+        task = [budget, task = std::move(task)]() {
+            BudgetScope scope(budget);
+            task();
+        };
+    }
+    // And sees the globals of the interpreter that made it.
+    if (auto current = EnvironmentScope::Current(); current.second) {
+        task = [current = std::move(current), task = std::move(task)]() {
+            EnvironmentScope environment_scope(current.first, current.second);
+            task();
+        };
+    }
+    if (current_worker != kNoWorker) {
+        std::lock_guard<std::mutex> lock(queues_[current_worker]->mutex);
+        queues_[current_worker]->tasks.push_back(std::move(task));
+        ++queued_;
+    } else {
+        std::lock_guard<std::mutex> control_lock(control_mutex_);
+        if (workers_.empty()) {
+            Start(worker_count_);
+        }
+        auto& queue = *queues_[next_queue_++ % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        ++queued_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::TakeTask(size_t index, Task& task) {
+    if (index != kNoWorker) {
+        auto& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued_;
+            return true;
+        }
+    }
+    size_t start = index == kNoWorker ? 0 : index + 1;
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        auto& victim = *queues_[(start + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued_;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+    Task task;
+    if (current_worker != kNoWorker) {
+        if (!TakeTask(current_worker, task)) {
+            return false;
+        }
+    } else {
+        std::unique_lock<std::mutex> control_lock(control_mutex_, std::try_to_lock);
+        if (!control_lock.owns_lock() || !TakeTask(kNoWorker, task)) {
+            return false;
+        }
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    struct Join {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        size_t remaining;
+        std::exception_ptr error;
+    };
+    size_t chunks = std::min(count, GetWorkerCount() * 4);
+    size_t chunk_size = (count + chunks - 1) / chunks;
+    chunks = (count + chunk_size - 1) / chunk_size;
+    auto join = std::make_shared<Join>();
+    join->remaining = chunks;
+    for (size_t i = 0; i < chunks; ++i) {
+        size_t begin = i * chunk_size;
+        size_t end = std::min(count, begin + chunk_size);
+        Submit([join, &body, begin, end]() {
+            std::exception_ptr error;
+            try {
+                body(begin, end);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(join->mutex);
+            if (error && !join->error) {
+                join->error = error;
+            }
+            if (--join->remaining == 0) {
+                join->done_cv.notify_all();
+            }
+        });
+    }
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(join->mutex);
+            if (join->remaining == 0) {
+                break;
+            }
+        }
+        if (RunPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(join->mutex);
+        join->done_cv.wait(lock, [&join]() { return join->remaining == 0; });
+    }
+    if (join->error) {
+        std::rethrow_exception(join->error);
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    current_worker = index;
+    while (true) {
+        Task task;
+        if (TakeTask(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        if (stopping_ && queued_ == 0) {
+            break;
+        }
+        wake_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            break;
+        }
+    }
+    current_worker = kNoWorker;
+}
+
+Future::Future(std::shared_ptr<Object> expr, std::shared_ptr<Scope> scope)
+    : expr_(std::move(expr)), scope_(std::move(scope)), done_(false) {
+}
+
+std::shared_ptr<Future> Future::Spawn(std::shared_ptr<Object> expr,
+                                      std::shared_ptr<Scope> scope) {
+    // The future body gets a scope of its own, so its `define`s stay private.
+    auto own_scope = MakeSlabShared<Scope>();
+    own_scope->GetParentScope() = std::move(scope);
+    own_scope->SetKind(Scope::Kind::FUTURE);
+    std::shared_ptr<Future> future(new Future(std::move(expr), std::move(own_scope)));
+    ThreadPool::Instance().Submit([future]() { future->Run(); });
+    return future;
+}
+
+void Future::Run() {
+    std::shared_ptr<Object> value;
+    std::exception_ptr error;
+    try {
+        if (!expr_) {
+            value = nullptr;
+        } else {
+            value = expr_->Evaluate(scope_);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        value_ = std::move(value);
+        error_ = std::move(error);
+        expr_.reset();
+        scope_.reset();
+        done_ = true;
+    }
+    done_cv_.notify_all();
+}
+
+std::shared_ptr<Object> Future::Touch() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (done_) {
+                break;
+            }
+        }
+        if (ThreadPool::Instance().RunPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return done_; });
+    }
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+    return value_;
+}
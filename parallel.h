@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "object.h"
+
+// Work-stealing scheduler behind `future` and `parallel-map`.
+// Every worker owns a deque: it pushes and pops its own tasks at the back,
+// idle workers steal from the front of the others.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    static ThreadPool& Instance();
+
+    size_t GetWorkerCount();
+    void SetWorkerCount(size_t count);
+
+    void Submit(Task task);
+
+    // Runs one queued task on the calling thread. Waiters call it, so a worker
+    // blocked on a future keeps draining the pool instead of deadlocking it.
+    bool RunPendingTask();
+
+    // Splits [0, count) into chunks, runs body(begin, end) for each of them on
+    // the pool and waits for all of them. The first exception is rethrown.
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    ThreadPool();
+    void Start(size_t count);
+    void Stop();
+    void WorkerLoop(size_t index);
+    bool TakeTask(size_t index, Task& task);
+
+    std::mutex control_mutex_;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> next_queue_;
+    bool stopping_;
+    std::atomic<size_t> worker_count_;
+};
+
+class Future : public Object {
+public:
+    static std::shared_ptr<Future> Spawn(std::shared_ptr<Object> expr,
+                                         std::shared_ptr<Scope> scope);
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    std::shared_ptr<Object> Touch();
+
+private:
+    Future(std::shared_ptr<Object> expr, std::shared_ptr<Scope> scope);
+    void Run();
+
+    std::shared_ptr<Object> expr_;
+    std::shared_ptr<Scope> scope_;
+    std::mutex mutex_;
+    std::condition_variable done_cv_;
+    bool done_;
+    std::shared_ptr<Object> value_;
+    std::exception_ptr error_;
+};
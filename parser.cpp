@@ -1,90 +1,133 @@
 #include "parser.h"
 
+#include <optional>
+#include "tracer.h"
+
+namespace {
+
+bool IsBracket(Tokenizer* tokenizer, BracketToken bracket) {
+    Token token = tokenizer->GetToken();
+    return std::holds_alternative<BracketToken>(token) && std::get<BracketToken>(token) == bracket;
+}
+
+}  // namespace
+
 std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
-    if (!tokenizer->IsEnd()) {
-        bool was_quote = false;
-        std::shared_ptr<Object> res;
+    return Reader().Read(tokenizer);
+}
+
+// Open lists and quotes go on an explicit stack, so neither long nor deeply
+// nested input uses native stack.
+std::shared_ptr<Object> Reader::Read(Tokenizer* tokenizer) {
+    std::vector<Frame>& stack = stack_;
+    // Left over from a read that failed.
+    stack.clear();
+    while (true) {
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError(" ");
+        }
         Token next = tokenizer->GetToken();
+        std::shared_ptr<Object> datum;
         if (std::holds_alternative<SymbolToken>(next)) {
-            SymbolToken next_token = std::get<SymbolToken>(next);
-            if (next_token.name == "#f" || next_token.name == "#t") {
-                res = std::make_shared<Bool>(next_token.name);
+            const std::string& name = std::get<SymbolToken>(next).name;
+            if (name == "#f" || name == "#t") {
+                datum = std::make_shared<Bool>(name);
             } else {
-                res = std::make_shared<Symbol>(next_token.name);
+                datum = std::make_shared<Symbol>(name);
             }
+            tokenizer->Next();
+        } else if (std::holds_alternative<StringToken>(next)) {
+            datum = std::make_shared<String>(std::get<StringToken>(next).value);
+            tokenizer->Next();
         } else if (std::holds_alternative<ConstantToken>(next)) {
-            ConstantToken next_token = std::get<ConstantToken>(next);
-            res = std::make_shared<Number>(next_token.value);
-        } else if (std::holds_alternative<BracketToken>(next)) {
-            BracketToken next_token = std::get<BracketToken>(next);
-            if (next_token == BracketToken::OPEN) {
-                tokenizer->Next();
-                res = ReadList(tokenizer);
-            } else {
+            datum = MakeSlabShared<Number>(std::get<ConstantToken>(next).value);
+            tokenizer->Next();
+        } else if (std::holds_alternative<QuoteToken>(next) ||
+                   (std::holds_alternative<BracketToken>(next) &&
+                    std::get<BracketToken>(next) == BracketToken::OPEN)) {
+            if (stack.size() >= DepthGuard::GetMaxDepth()) {
+                throw SyntaxError(" ");
+            }
+            tokenizer->Next();
+            if (std::holds_alternative<QuoteToken>(next)) {
+                stack.push_back({true});
+                continue;
+            }
+            if (tokenizer->IsEnd()) {
                 throw SyntaxError(" ");
             }
-        } else if (std::holds_alternative<QuoteToken>(next)) {
-            std::shared_ptr<Cell> ans_cell = std::make_shared<Cell>();
-            ans_cell->GetFirst() = std::make_shared<Symbol>("quote");
+            if (!IsBracket(tokenizer, BracketToken::CLOSE)) {
+                stack.push_back({});
+                continue;
+            }
+            // ()
             tokenizer->Next();
-            std::shared_ptr<Cell> right_cell = std::make_shared<Cell>();
-            right_cell->GetFirst() = Read(tokenizer);
-            right_cell->GetSecond() = nullptr;
-            ans_cell->GetSecond() = right_cell;
-            res = ans_cell;
-            was_quote = true;
         } else {
             throw SyntaxError(" ");
         }
-        if (!was_quote) {
-            tokenizer->Next();
-        }
-        return res;
-    } else {
-        throw SyntaxError(" ");
-    }
-}
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    bool was_dot = false;
-    if (!tokenizer->IsEnd()) {
-        std::shared_ptr<Cell> cell = std::make_shared<Cell>();
-        if (std::holds_alternative<BracketToken>(tokenizer->GetToken())) {
-            if (std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE) {
-                return nullptr;
+        // Hands the datum to the frames it completes.
+        while (true) {
+            if (stack.empty()) {
+                return datum;
             }
-        }
-        cell->GetFirst() = Read(tokenizer);
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError(" ");
-        }
-        if (std::holds_alternative<DotToken>(tokenizer->GetToken())) {
-            was_dot = true;
-            tokenizer->Next();
-        }
-        if (std::holds_alternative<BracketToken>(tokenizer->GetToken())) {
-            if (std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE && was_dot) {
-                throw SyntaxError(" ");
+            Frame& frame = stack.back();
+            if (frame.is_quote) {
+                auto quote = MakeSlabShared<Cell>();
+                quote->SetFirst(std::make_shared<Symbol>("quote"));
+                auto argument = MakeSlabShared<Cell>();
+                argument->SetFirst(std::move(datum));
+                quote->SetSecond(argument);
+                datum = quote;
+                stack.pop_back();
+                continue;
             }
-        }
-        if (was_dot) {
-            cell->GetSecond() = Read(tokenizer);
-        } else {
-            cell->GetSecond() = ReadList(tokenizer);
-        }
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError(" ");
-        } else {
-            if (std::holds_alternative<BracketToken>(tokenizer->GetToken())) {
-                if (std::get<BracketToken>(tokenizer->GetToken()) != BracketToken::CLOSE) {
+            if (frame.dotted) {
+                frame.last->SetSecond(std::move(datum));
+                if (tokenizer->IsEnd() || !IsBracket(tokenizer, BracketToken::CLOSE)) {
                     throw SyntaxError(" ");
                 }
             } else {
-                throw SyntaxError(" ");
+                auto cell = MakeSlabShared<Cell>();
+                cell->SetFirst(std::move(datum));
+                if (frame.last) {
+                    frame.last->SetSecond(cell);
+                } else {
+                    frame.head = cell;
+                }
+                frame.last = cell;
+                if (tokenizer->IsEnd()) {
+                    throw SyntaxError(" ");
+                }
+                if (std::holds_alternative<DotToken>(tokenizer->GetToken())) {
+                    tokenizer->Next();
+                    if (!tokenizer->IsEnd() && IsBracket(tokenizer, BracketToken::CLOSE)) {
+                        throw SyntaxError(" ");
+                    }
+                    frame.dotted = true;
+                    break;
+                }
+                if (!IsBracket(tokenizer, BracketToken::CLOSE)) {
+                    break;
+                }
             }
+            // The list closes.
+            tokenizer->Next();
+            datum = std::move(frame.head);
+            stack.pop_back();
+        }
+    }
+}
+
+std::vector<std::shared_ptr<Object>> ReadAll(Tokenizer* tokenizer) {
+    std::vector<std::shared_ptr<Object>> forms;
+    Reader reader;
+    while (!tokenizer->IsEnd()) {
+        std::optional<Tracer::Span> span;
+        if (Tracer::Enabled()) {
+            span.emplace("read", TraceCategory::PARSE);
         }
-        return cell;
-    } else {
-        throw SyntaxError(" ");
+        forms.push_back(reader.Read(tokenizer));
     }
-}
\ No newline at end of file
+    return forms;
+}
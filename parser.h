@@ -1,9 +1,32 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "object.h"
 #include "tokenizer.h"
 
+// Reads one datum. Lists may nest up to DepthGuard::GetMaxDepth()
+// deep; deeper input is a SyntaxError.
 std::shared_ptr<Object> Read(Tokenizer* tokenizer);
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer);
+// The same, keeping its stack of open lists from one read to the next, so
+// reading many data allocates only for the data.
+class Reader {
+public:
+    std::shared_ptr<Object> Read(Tokenizer* tokenizer);
+
+private:
+    // A list being read, or a quote waiting for its datum.
+    struct Frame {
+        bool is_quote = false;
+        std::shared_ptr<Cell> head;
+        std::shared_ptr<Cell> last;
+        // After a dot: the next datum is the tail, then the list must close.
+        bool dotted = false;
+    };
+
+    std::vector<Frame> stack_;
+};
+
+// Reads expressions until the input ends.
+std::vector<std::shared_ptr<Object>> ReadAll(Tokenizer* tokenizer);
@@ -0,0 +1,209 @@
+#include "ports.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "packed_list.h"
+#include "parser.h"
+
+std::shared_ptr<Object> EofObject::Get() {
+    static const std::shared_ptr<Object> eof = std::make_shared<EofObject>();
+    return eof;
+}
+
+InputPort::InputPort(const std::string& path)
+    : fd_(-1), data_(nullptr), begin_(0), end_(0), at_end_(false), released_(0), closed_(false) {
+    struct stat info;
+    if (stat(path.c_str(), &info) < 0) {
+        throw RuntimeError(" ");
+    }
+    // Files like those in /proc claim to be empty and are read in blocks.
+    if (S_ISREG(info.st_mode) && info.st_size != 0) {
+        mapped_ = std::make_unique<MappedFile>(path);
+        mapped_->AdviseSequential();
+        data_ = mapped_->Data();
+        end_ = mapped_->Size();
+        at_end_ = true;
+        return;
+    }
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw RuntimeError(" ");
+    }
+}
+
+InputPort::~InputPort() {
+    Close();
+}
+
+void InputPort::Close() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    mapped_.reset();
+    buffer_ = std::string();
+    data_ = nullptr;
+    begin_ = end_ = 0;
+    at_end_ = true;
+    closed_ = true;
+}
+
+void InputPort::AssertOpen() const {
+    if (closed_) {
+        throw RuntimeError(" ");
+    }
+}
+
+bool InputPort::Fill() {
+    if (at_end_) {
+        return false;
+    }
+    buffer_.erase(0, begin_);
+    size_t kept = buffer_.size();
+    buffer_.resize(kept + kBlockSize);
+    size_t filled = kept;
+    while (filled < buffer_.size()) {
+        ssize_t count = read(fd_, buffer_.data() + filled, buffer_.size() - filled);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw RuntimeError(" ");
+        }
+        if (count == 0) {
+            at_end_ = true;
+            break;
+        }
+        filled += count;
+    }
+    buffer_.resize(filled);
+    data_ = buffer_.data();
+    begin_ = 0;
+    end_ = filled;
+    return filled > kept;
+}
+
+void InputPort::Advance(size_t length) {
+    begin_ += length;
+    if (mapped_ && begin_ - released_ >= kReleaseStep) {
+        mapped_->Release(released_, begin_);
+        released_ = begin_ - begin_ % kReleaseStep;
+    }
+}
+
+bool InputPort::ReadLine(std::string_view* line) {
+    AssertOpen();
+    while (true) {
+        const char* start = data_ + begin_;
+        size_t available = end_ - begin_;
+        const char* newline = nullptr;
+        if (available != 0) {
+            newline = static_cast<const char*>(std::memchr(start, '\n', available));
+        }
+        if (newline) {
+            *line = std::string_view(start, newline - start);
+            Advance(newline - start + 1);
+            return true;
+        }
+        if (!Fill() && at_end_) {
+            if (begin_ == end_) {
+                return false;
+            }
+            *line = std::string_view(data_ + begin_, end_ - begin_);
+            Advance(end_ - begin_);
+            return true;
+        }
+    }
+}
+
+std::shared_ptr<Object> InputPort::ReadDatum() {
+    AssertOpen();
+    while (true) {
+        std::string_view text(data_ + begin_, end_ - begin_);
+        try {
+            Tokenizer tokenizer{text};
+            if (tokenizer.IsEnd()) {
+                if (at_end_) {
+                    Advance(text.size());
+                    return EofObject::Get();
+                }
+                Fill();
+                continue;
+            }
+            std::shared_ptr<Object> datum = Read(&tokenizer);
+            // A datum that reaches the end of what is buffered may go on in
+            // the next block.
+            if (tokenizer.GetTokenOffset() == text.size() && !at_end_) {
+                Fill();
+                continue;
+            }
+            Advance(tokenizer.GetTokenOffset());
+            return PackLiteral(datum);
+        } catch (SyntaxError&) {
+            if (at_end_) {
+                throw;
+            }
+            Fill();
+        }
+    }
+}
+
+OutputPort::OutputPort(const std::string& path) {
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw RuntimeError(" ");
+    }
+    buffer_.reserve(kBufferSize);
+}
+
+OutputPort::~OutputPort() {
+    try {
+        Close();
+    } catch (RuntimeError&) {
+        // Nobody is left to report a failed write to.
+    }
+}
+
+void OutputPort::Write(std::string_view text) {
+    if (fd_ < 0) {
+        throw RuntimeError(" ");
+    }
+    buffer_.append(text);
+    if (buffer_.size() >= kBufferSize) {
+        Flush();
+    }
+}
+
+void OutputPort::Flush() {
+    size_t written = 0;
+    while (written < buffer_.size()) {
+        ssize_t count = write(fd_, buffer_.data() + written, buffer_.size() - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            buffer_.clear();
+            throw RuntimeError(" ");
+        }
+        written += count;
+    }
+    buffer_.clear();
+}
+
+void OutputPort::Close() {
+    if (fd_ < 0) {
+        return;
+    }
+    int fd = fd_;
+    try {
+        Flush();
+    } catch (RuntimeError&) {
+        close(fd);
+        fd_ = -1;
+        throw;
+    }
+    close(fd);
+    fd_ = -1;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include "mapped_file.h"
+#include "object.h"
+
+// File ports.
+//
+// An input port maps a regular file into memory and reads lines and data
+// straight out of the mapping; pages it has moved past are dropped, so going
+// through a file of any size takes constant memory. Anything that can't be
+// mapped (a pipe, say) is read in 1 MiB blocks instead. An output port
+// collects writes in a 64 KiB buffer.
+//
+// Ports belong to the thread using them and can't be saved in heap images.
+
+// What read-line and read return at the end of a file.
+class EofObject : public Object {
+public:
+    static std::shared_ptr<Object> Get();
+
+    std::string Serialize() override {
+        return "#<eof>";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+};
+
+class InputPort : public Object {
+public:
+    explicit InputPort(const std::string& path);
+    ~InputPort() override;
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    // The next line without its '\n'; false at the end of the file. The view
+    // is valid until the next read from the port.
+    bool ReadLine(std::string_view* line);
+
+    // The next datum, or EofObject::Get() at the end of the file.
+    std::shared_ptr<Object> ReadDatum();
+
+    void Close();
+
+private:
+    static constexpr size_t kBlockSize = size_t{1} << 20;
+    static constexpr size_t kReleaseStep = size_t{64} << 20;
+
+    void AssertOpen() const;
+    // Reads another block after the unread bytes; false at the end of the file.
+    bool Fill();
+    void Advance(size_t length);
+
+    std::unique_ptr<MappedFile> mapped_;
+    int fd_;
+    std::string buffer_;
+    // The unread bytes are data_[begin_, end_).
+    const char* data_;
+    size_t begin_;
+    size_t end_;
+    bool at_end_;
+    // Mapped bytes before this have been dropped from memory.
+    size_t released_;
+    bool closed_;
+};
+
+class OutputPort : public Object {
+public:
+    explicit OutputPort(const std::string& path);
+    ~OutputPort() override;
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    void Write(std::string_view text);
+    void Flush();
+    void Close();
+
+private:
+    static constexpr size_t kBufferSize = size_t{64} << 10;
+
+    int fd_;
+    std::string buffer_;
+};
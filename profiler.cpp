@@ -0,0 +1,88 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+Profiler::Profiler() : entry_ids_(), entries_(), nodes_(), stack_() {
+    nodes_.push_back(Node{0, 0, {}, 0});
+}
+
+void Profiler::Enter(const std::string& name) {
+    static const std::string kAnonymous = "(anonymous)";
+    const std::string& key = name.empty() ? kAnonymous : name;
+    auto iter = entry_ids_.find(key);
+    if (iter == entry_ids_.end()) {
+        iter = entry_ids_.emplace(key, entries_.size()).first;
+        entries_.push_back(Entry{key});
+    }
+    uint32_t entry = iter->second;
+    uint32_t parent = stack_.empty() ? 0 : stack_.back().node;
+    auto [child, created] = nodes_[parent].children.insert({entry, nodes_.size()});
+    if (created) {
+        nodes_.push_back(Node{entry, parent, {}, 0});
+    }
+    ++entries_[entry].calls;
+    ++entries_[entry].active;
+    stack_.push_back(Frame{child->second, Clock::now(), object_allocations});
+}
+
+void Profiler::Exit() {
+    Frame frame = stack_.back();
+    stack_.pop_back();
+    int64_t elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start).count();
+    uint64_t allocations = object_allocations - frame.allocations_at_start;
+    Node& node = nodes_[frame.node];
+    Entry& entry = entries_[node.entry];
+    node.exclusive_ns += elapsed - frame.children_ns;
+    entry.exclusive_ns += elapsed - frame.children_ns;
+    entry.allocations += allocations - frame.children_allocations;
+    if (--entry.active == 0) {
+        entry.inclusive_ns += elapsed;
+    }
+    if (!stack_.empty()) {
+        stack_.back().children_ns += elapsed;
+        stack_.back().children_allocations += allocations;
+    }
+}
+
+void Profiler::WriteReport(std::ostream& out) const {
+    std::vector<const Entry*> sorted;
+    for (const auto& entry : entries_) {
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b) {
+        return a->exclusive_ns > b->exclusive_ns;
+    });
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-24s %10s %14s %14s %12s\n", "function", "calls",
+                  "inclusive ms", "exclusive ms", "allocations");
+    out << line;
+    for (const Entry* entry : sorted) {
+        std::snprintf(line, sizeof(line), "%-24s %10llu %14.3f %14.3f %12llu\n",
+                      entry->name.c_str(), static_cast<unsigned long long>(entry->calls),
+                      entry->inclusive_ns / 1e6, entry->exclusive_ns / 1e6,
+                      static_cast<unsigned long long>(entry->allocations));
+        out << line;
+    }
+}
+
+void Profiler::WriteCollapsedStacks(std::ostream& out) const {
+    std::vector<const std::string*> path;
+    for (size_t id = 1; id < nodes_.size(); ++id) {
+        if (nodes_[id].exclusive_ns <= 0) {
+            continue;
+        }
+        path.clear();
+        for (uint32_t node = id; node != 0; node = nodes_[node].parent) {
+            path.push_back(&entries_[nodes_[node].entry].name);
+        }
+        for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+            if (iter != path.rbegin()) {
+                out << ';';
+            }
+            out << **iter;
+        }
+        out << ' ' << nodes_[id].exclusive_ns << '\n';
+    }
+}
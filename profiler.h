@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Objects created by the current thread so far; every Object constructor
+// bumps it.
+inline thread_local uint64_t object_allocations = 0;
+
+// Per-function profile of one thread's evaluation: call counts, inclusive and
+// exclusive wall time and the objects allocated, keyed by the name a function
+// was defined under (builtins by their own name, anonymous lambdas as
+// "(anonymous)"). While no profiler is active the only cost is a null check per
+// call.
+class Profiler {
+public:
+    static Profiler* Active() {
+        return active_;
+    }
+
+    // Makes a profiler the active one on this thread for its lifetime.
+    class Activation {
+    public:
+        explicit Activation(Profiler* profiler) : previous_(active_) {
+            active_ = profiler;
+        }
+
+        ~Activation() {
+            active_ = previous_;
+        }
+
+        Activation(const Activation&) = delete;
+        Activation& operator=(const Activation&) = delete;
+
+    private:
+        Profiler* previous_;
+    };
+
+    // Records one call for as long as it lives.
+    class Call {
+    public:
+        Call(Profiler* profiler, const std::string& name) : profiler_(profiler) {
+            profiler_->Enter(name);
+        }
+
+        ~Call() {
+            profiler_->Exit();
+        }
+
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+
+    private:
+        Profiler* profiler_;
+    };
+
+    Profiler();
+
+    // A table sorted by exclusive time.
+    void WriteReport(std::ostream& out) const;
+
+    // One line per call path with its exclusive time in nanoseconds, the
+    // input format of flamegraph.pl and speedscope.
+    void WriteCollapsedStacks(std::ostream& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string name;
+        uint64_t calls = 0;
+        int64_t inclusive_ns = 0;
+        int64_t exclusive_ns = 0;
+        uint64_t allocations = 0;
+        // Frames of this function on the stack; recursive calls add their time
+        // to the inclusive total only once.
+        uint32_t active = 0;
+    };
+
+    struct Node {
+        uint32_t entry;
+        uint32_t parent;
+        std::unordered_map<uint32_t, uint32_t> children;
+        int64_t exclusive_ns = 0;
+    };
+
+    struct Frame {
+        uint32_t node;
+        Clock::time_point start;
+        uint64_t allocations_at_start;
+        int64_t children_ns = 0;
+        uint64_t children_allocations = 0;
+    };
+
+    void Enter(const std::string& name);
+    void Exit();
+
+    static inline thread_local Profiler* active_ = nullptr;
+
+    std::unordered_map<std::string, uint32_t> entry_ids_;
+    std::vector<Entry> entries_;
+    // The call tree; node 0 is the root.
+    std::vector<Node> nodes_;
+    std::vector<Frame> stack_;
+};
@@ -0,0 +1,422 @@
+#include "quicken.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+#include "expander.h"
+#include "library.h"
+
+namespace {
+
+bool DefaultQuickening() {
+    const char* env = std::getenv("SCHEME_QUICKEN");
+    return !env || std::strcmp(env, "0") != 0;
+}
+
+std::atomic<bool> quickening{DefaultQuickening()};
+
+using NameSet = std::unordered_set<std::string>;
+
+const std::string* HeadName(const std::shared_ptr<Object>& form) {
+    if (!Is<Cell>(form)) {
+        return nullptr;
+    }
+    std::shared_ptr<Object> head = As<Cell>(form)->GetFirst();
+    return Is<Symbol>(head) ? &As<Symbol>(head)->GetName() : nullptr;
+}
+
+bool IsBinder(const std::string& name) {
+    return name == "lambda" || name == "define" || name == "define-memoized";
+}
+
+bool IsLet(const std::string& name) {
+    return name == "let" || name == kLoopForm;
+}
+
+// Forms whose operands are data: a library quickens its body itself, as
+// top-level forms of its own scope.
+bool IsData(const std::string& name) {
+    return name == "quote" || name == "define-library" || name == "import";
+}
+
+// The elements of a list, with a dotted tail as the last one.
+ObjectVectorBase Elements(const std::shared_ptr<Object>& list) {
+    ObjectVectorBase items;
+    std::shared_ptr<Object> tail = list;
+    while (Is<Cell>(tail)) {
+        auto cell = As<Cell>(tail);
+        items.push_back(cell->GetFirst());
+        tail = cell->GetSecond();
+    }
+    if (tail) {
+        items.push_back(tail);
+    }
+    return items;
+}
+
+void AddSymbols(const std::shared_ptr<Object>& obj, NameSet* names) {
+    if (Is<Symbol>(obj)) {
+        names->insert(As<Symbol>(obj)->GetName());
+    }
+    for (const auto& item : Is<Cell>(obj) ? Elements(obj) : ObjectVectorBase{}) {
+        AddSymbols(item, names);
+    }
+}
+
+// Every name a binding form of form binds in a scope below the global one.
+// At the top level (outside any lambda, let or future) a define binds a
+// global, which call sites check for themselves.
+void CollectLocalNames(const std::shared_ptr<Object>& form, bool top_level, NameSet* names) {
+    if (!Is<Cell>(form)) {
+        return;
+    }
+    DepthGuard depth_guard;
+    ObjectVectorBase items = Elements(form);
+    const std::string* head = HeadName(form);
+    size_t body = 0;
+    bool body_top_level = top_level;
+    if (head && IsData(*head)) {
+        return;
+    } else if (head && IsBinder(*head) && items.size() >= 2) {
+        if (Is<Cell>(items[1])) {
+            // (define (name var ...) body ...) and (lambda (var ...) body ...).
+            ObjectVectorBase signature = Elements(items[1]);
+            for (size_t i = 0; i < signature.size(); ++i) {
+                if (i != 0 || !top_level || *head == "lambda") {
+                    AddSymbols(signature[i], names);
+                }
+            }
+            body_top_level = false;
+        } else if (*head == "lambda") {
+            AddSymbols(items[1], names);
+            body_top_level = false;
+        } else if (!top_level) {
+            AddSymbols(items[1], names);
+        }
+        body = 2;
+    } else if (head && IsLet(*head) && items.size() >= 2) {
+        for (const auto& binding : Is<Cell>(items[1]) ? Elements(items[1]) : ObjectVectorBase{}) {
+            ObjectVectorBase parts = Is<Cell>(binding) ? Elements(binding) : ObjectVectorBase{};
+            if (!parts.empty()) {
+                AddSymbols(parts[0], names);
+            }
+            for (size_t i = 1; i < parts.size(); ++i) {
+                CollectLocalNames(parts[i], top_level, names);
+            }
+        }
+        body = 2;
+        body_top_level = false;
+    } else if (head && *head == "future") {
+        // A future runs in a scope of its own.
+        body_top_level = false;
+    }
+    for (size_t i = body; i < items.size(); ++i) {
+        CollectLocalNames(items[i], i == 0 ? top_level : body_top_level, names);
+    }
+}
+
+// Whether nothing in form can run twice: without a lambda, a procedure
+// definition or a loop, every call in it runs at most once, and specializing
+// it would cost more than it saves.
+bool RunsOnce(const std::shared_ptr<Object>& form) {
+    if (!Is<Cell>(form)) {
+        return true;
+    }
+    DepthGuard depth_guard;
+    ObjectVectorBase items = Elements(form);
+    const std::string* head = HeadName(form);
+    if (head && IsData(*head)) {
+        return true;
+    }
+    if (head && (*head == "lambda" || *head == "define-memoized" || *head == kLoopForm ||
+                 (*head == "define" && items.size() >= 2 && Is<Cell>(items[1])))) {
+        return false;
+    }
+    for (const auto& item : items) {
+        if (!RunsOnce(item)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<Object> MakeList(const ObjectVectorBase& items, std::shared_ptr<Object> tail) {
+    std::shared_ptr<Object> list = std::move(tail);
+    for (auto iter = items.rbegin(); iter != items.rend(); ++iter) {
+        auto cell = MakeSlabShared<Cell>();
+        cell->SetFirst(*iter);
+        cell->SetSecond(std::move(list));
+        list = std::move(cell);
+    }
+    return list;
+}
+
+std::shared_ptr<Object> QuickenForm(const std::shared_ptr<Object>& form, const NameSet& locals) {
+    if (!Is<Cell>(form)) {
+        return form;
+    }
+    DepthGuard depth_guard;
+    const std::string* head = HeadName(form);
+    if (head && IsData(*head)) {
+        return form;
+    }
+    ObjectVectorBase items;
+    std::shared_ptr<Object> tail = form;
+    while (Is<Cell>(tail)) {
+        auto cell = As<Cell>(tail);
+        items.push_back(cell->GetFirst());
+        tail = cell->GetSecond();
+    }
+    // Parameter lists and binding lists are data to their forms; only the
+    // expressions in them are quickened.
+    size_t first = head ? 1 : 0;
+    if (head && IsBinder(*head) && items.size() >= 2) {
+        first = 2;
+    } else if (head && IsLet(*head) && items.size() >= 2) {
+        ObjectVectorBase bindings;
+        std::shared_ptr<Object> rest = items[1];
+        while (Is<Cell>(rest)) {
+            auto cell = As<Cell>(rest);
+            std::shared_ptr<Object> binding = cell->GetFirst();
+            if (Is<Cell>(binding)) {
+                auto parts = As<Cell>(binding);
+                ObjectVectorBase inits;
+                std::shared_ptr<Object> init = parts->GetSecond();
+                while (Is<Cell>(init)) {
+                    inits.push_back(QuickenForm(As<Cell>(init)->GetFirst(), locals));
+                    init = As<Cell>(init)->GetSecond();
+                }
+                binding = MakeList({parts->GetFirst()}, MakeList(inits, init));
+            }
+            bindings.push_back(binding);
+            rest = cell->GetSecond();
+        }
+        items[1] = MakeList(bindings, rest);
+        first = 2;
+    }
+    for (size_t i = first; i < items.size(); ++i) {
+        items[i] = QuickenForm(items[i], locals);
+    }
+    if (!head) {
+        return MakeList(items, tail);
+    }
+    ObjectVectorBase operands(items.begin() + 1, items.end());
+    return std::make_shared<CallSite>(items[0], MakeList(operands, tail), locals.count(*head));
+}
+
+Scope* FindRoot(Scope* scope) {
+    while (Scope* parent = scope->GetParentScope().get()) {
+        scope = parent;
+    }
+    return scope;
+}
+
+}  // namespace
+
+bool IsQuickening() {
+    return quickening.load(std::memory_order_relaxed);
+}
+
+void SetQuickening(bool enabled) {
+    quickening.store(enabled, std::memory_order_relaxed);
+}
+
+std::shared_ptr<Object> Quicken(const std::shared_ptr<Object>& form) {
+    if (!IsQuickening() || RunsOnce(form)) {
+        return form;
+    }
+    NameSet locals;
+    CollectLocalNames(form, true, &locals);
+    return QuickenForm(form, locals);
+}
+
+CallSite::CallSite(std::shared_ptr<Object> head, std::shared_ptr<Object> rest, bool shadowed)
+    : name_(As<Symbol>(head)->GetName()), spec_(nullptr) {
+    SetFirst(std::move(head));
+    SetSecond(std::move(rest));
+    if (GetSecond()) {
+        operands_ = EvaluateList(GetSecond());
+    }
+    if (shadowed) {
+        specs_.push_back(std::make_unique<Specialization>());
+        spec_.store(specs_.back().get(), std::memory_order_release);
+    }
+}
+
+bool CallSite::Holds(const Specialization& spec, Scope* root) const {
+    if (spec.root != root || spec.stamp != root->GetStamp()) {
+        return false;
+    }
+    return (!spec.slot || spec.slot->get() == spec.binding.get()) &&
+           (!spec.target || spec.target->get() == spec.target_binding.get());
+}
+
+const CallSite::Specialization* CallSite::Specialize(Scope* root) {
+    std::lock_guard lock(mutex_);
+    const Specialization* current = spec_.load(std::memory_order_acquire);
+    if (current && (current->kind == Kind::GENERIC || Holds(*current, root))) {
+        return current;
+    }
+    // Forks of one interpreter share their global scope, each with a stamp
+    // of its own, and take turns at the site.
+    for (const auto& spec : specs_) {
+        if (spec->kind != Kind::GENERIC && Holds(*spec, root)) {
+            spec_.store(spec.get(), std::memory_order_release);
+            return spec.get();
+        }
+    }
+    auto spec = std::make_unique<Specialization>();
+    if (specs_.size() < kMaxSpecializations) {
+        // The stamp is read first: a name added while this resolves changes
+        // it, and the next call resolves again.
+        spec->root = root;
+        spec->stamp = root->GetStamp();
+        if (std::shared_ptr<Object>* slot = root->FindLocal(name_)) {
+            std::shared_ptr<Object> binding = *slot;
+            std::shared_ptr<Object> callee = binding;
+            // An imported name is called through the library's own binding.
+            std::shared_ptr<Object>* target = nullptr;
+            while (auto imported = std::dynamic_pointer_cast<LibraryExport>(callee)) {
+                target = imported->Resolve();
+                callee = *target;
+            }
+            std::shared_ptr<Object> target_binding = callee;
+            if (Is<LambdaCreator>(callee)) {
+                callee = callee->Evaluate();
+            }
+            if (Is<FunctionWrapper>(callee)) {
+                spec->kind = Kind::GLOBAL;
+                spec->slot = slot;
+                spec->binding = std::move(binding);
+                spec->target = target;
+                spec->target_binding = target ? std::move(target_binding) : nullptr;
+                spec->callee = As<FunctionWrapper>(callee);
+            }
+        } else if (Function::HasFunction(name_)) {
+            spec->kind = Kind::BUILTIN;
+            spec->callee = Function::CreateFunction(name_);
+            spec->op = FindInlineOp();
+        }
+    }
+    if (spec->kind == Kind::GENERIC) {
+        spec->root = nullptr;
+    }
+    specs_.push_back(std::move(spec));
+    spec_.store(specs_.back().get(), std::memory_order_release);
+    return specs_.back().get();
+}
+
+CallSite::InlineOp CallSite::FindInlineOp() const {
+    for (const auto& operand : operands_) {
+        if (!operand) {
+            return InlineOp::NONE;
+        }
+    }
+    // A dotted tail is left to the builtin to reject.
+    std::shared_ptr<Object> rest = GetSecond();
+    while (Is<Cell>(rest)) {
+        rest = As<Cell>(rest)->GetSecond();
+    }
+    if (rest) {
+        return InlineOp::NONE;
+    }
+    if (operands_.size() == 1) {
+        if (name_ == "car") {
+            return InlineOp::CAR;
+        } else if (name_ == "cdr") {
+            return InlineOp::CDR;
+        } else if (name_ == "null?") {
+            return InlineOp::IS_NULL;
+        }
+    } else if (operands_.size() == 2) {
+        static const std::pair<const char*, InlineOp> kBinary[] = {
+            {"+", InlineOp::ADD},       {"-", InlineOp::SUBTRACT},
+            {"*", InlineOp::MULTIPLY},  {"=", InlineOp::EQUAL},
+            {"<", InlineOp::LESS},      {">", InlineOp::GREATER},
+            {"<=", InlineOp::LESS_EQUAL}, {">=", InlineOp::GREATER_EQUAL}};
+        for (const auto& [name, op] : kBinary) {
+            if (name_ == name) {
+                return op;
+            }
+        }
+    }
+    return InlineOp::NONE;
+}
+
+std::shared_ptr<Object> CallSite::Evaluate(std::shared_ptr<Scope> scope) {
+    const Specialization* spec = spec_.load(std::memory_order_acquire);
+    if (!scope || (spec && spec->kind == Kind::GENERIC)) {
+        return Cell::Evaluate(std::move(scope));
+    }
+    Scope* root = FindRoot(scope.get());
+    if (!spec || !Holds(*spec, root)) {
+        spec = Specialize(root);
+        if (spec->kind == Kind::GENERIC) {
+            return Cell::Evaluate(std::move(scope));
+        }
+    }
+    CountRuntime(RuntimeCounter::EVALUATIONS);
+    ChargeStep();
+    DepthGuard depth_guard;
+    // Inline ops bypass ApplyFunction, so profiles and traces take the call.
+    if (spec->op != InlineOp::NONE && !Profiler::Active() && !Tracer::Enabled()) {
+        return EvaluateInline(spec->op, scope);
+    }
+    ObjectVector objects(operands_);
+    objects.GetScope() = scope;
+    return ApplyFunction(*spec->callee, objects);
+}
+
+// The same results and errors as the builtins: an operand of the wrong type is
+// a RuntimeError as soon as it is evaluated.
+std::shared_ptr<Object> CallSite::EvaluateInline(InlineOp op,
+                                                 const std::shared_ptr<Scope>& scope) {
+    std::shared_ptr<Object> lhs = operands_[0]->Evaluate(scope);
+    if (op == InlineOp::CAR || op == InlineOp::CDR || op == InlineOp::IS_NULL) {
+        auto* cell = dynamic_cast<Cell*>(lhs.get());
+        if (op == InlineOp::IS_NULL) {
+            return std::make_shared<Bool>(!cell ||
+                                          (cell->GetFirst() == nullptr && !cell->GetSecond()));
+        }
+        if (!cell) {
+            throw RuntimeError(" ");
+        }
+        if (op == InlineOp::CDR) {
+            return cell->GetSecond();
+        }
+        std::shared_ptr<Object> first = cell->GetFirst();
+        if (!first) {
+            throw RuntimeError(" ");
+        }
+        return first;
+    }
+    auto* left = dynamic_cast<Number*>(lhs.get());
+    if (!left) {
+        throw RuntimeError(" ");
+    }
+    std::shared_ptr<Object> rhs = operands_[1]->Evaluate(scope);
+    auto* right = dynamic_cast<Number*>(rhs.get());
+    if (!right) {
+        throw RuntimeError(" ");
+    }
+    int a = left->GetValue();
+    int b = right->GetValue();
+    switch (op) {
+        case InlineOp::ADD:
+            return MakeSlabShared<Number>(a + b);
+        case InlineOp::SUBTRACT:
+            return MakeSlabShared<Number>(a - b);
+        case InlineOp::MULTIPLY:
+            return MakeSlabShared<Number>(a * b);
+        case InlineOp::EQUAL:
+            return std::make_shared<Bool>(a == b);
+        case InlineOp::LESS:
+            return std::make_shared<Bool>(a < b);
+        case InlineOp::GREATER:
+            return std::make_shared<Bool>(a > b);
+        case InlineOp::LESS_EQUAL:
+            return std::make_shared<Bool>(a <= b);
+        default:
+            return std::make_shared<Bool>(a >= b);
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "object.h"
+
+// Self-specializing call sites.
+//
+// Quicken turns every application in an expanded expression whose head is a
+// symbol into a CallSite. The first time a call site runs, it resolves its
+// head and rewrites itself into the specialized node for what it found:
+//   a builtin           is called directly, without looking the name up and
+//                       making a Function for it each time;
+//   +, -, *, =, <, >, <=, >= with two operands, and car, cdr, null? with one,
+//                       run inline on the values of their operands;
+//   a global procedure  is called through the Lambda made for it once, rather
+//                       than one made on every call; an imported one loads
+//                       its library then.
+// A name some lambda, let or inner define of the expression binds is left to
+// the generic evaluator, so every other head can only mean a global binding or
+// a builtin. A call site keeps the global scope and its stamp, and for a global
+// procedure the binding it found, and the library's binding of an imported
+// one; once any of them changes (a new global name is defined, or the procedure
+// is redefined with set! or define) the site resolves its head again, going
+// back to an earlier resolution if that one holds again. A site that has
+// resolved kMaxSpecializations times stays generic. `import` and
+// `define-library` forms are left alone; a library quickens its own body.
+//
+// SCHEME_QUICKEN=0 turns quickening off; SetQuickening does it at run time,
+// for code read after the call.
+
+inline constexpr size_t kMaxSpecializations = 8;
+
+bool IsQuickening();
+void SetQuickening(bool enabled);
+
+// A copy of an expanded expression with its applications made CallSites; the
+// expression itself if quickening is off or no call in it can run twice (it
+// has no lambda, procedure definition or loop).
+std::shared_ptr<Object> Quicken(const std::shared_ptr<Object>& form);
+
+class CallSite : public Cell {
+public:
+    // shadowed: some binding form of the expression binds the name of head.
+    CallSite(std::shared_ptr<Object> head, std::shared_ptr<Object> rest, bool shadowed);
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override;
+
+private:
+    enum class Kind { GENERIC, BUILTIN, GLOBAL };
+    enum class InlineOp { NONE, ADD, SUBTRACT, MULTIPLY, EQUAL, LESS, GREATER, LESS_EQUAL,
+                          GREATER_EQUAL, CAR, CDR, IS_NULL };
+
+    struct Specialization {
+        Kind kind = Kind::GENERIC;
+        InlineOp op = InlineOp::NONE;
+        // Compared, never dereferenced: a scope freed since can't come back
+        // with the same stamp.
+        const Scope* root = nullptr;
+        uint64_t stamp = 0;
+        // GLOBAL: the slot of the global binding and what it held; for an
+        // imported name also the slot of the binding in its library.
+        std::shared_ptr<Object>* slot = nullptr;
+        std::shared_ptr<Object> binding;
+        std::shared_ptr<Object>* target = nullptr;
+        std::shared_ptr<Object> target_binding;
+        std::shared_ptr<FunctionWrapper> callee;
+    };
+
+    bool Holds(const Specialization& spec, Scope* root) const;
+    const Specialization* Specialize(Scope* root);
+    InlineOp FindInlineOp() const;
+    std::shared_ptr<Object> EvaluateInline(InlineOp op, const std::shared_ptr<Scope>& scope);
+
+    std::string name_;
+    // The operands as Cell::Evaluate hands them to the function.
+    ObjectVectorBase operands_;
+    std::atomic<const Specialization*> spec_;
+    // Every specialization made, since another thread may still be using an
+    // older one.
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Specialization>> specs_;
+};
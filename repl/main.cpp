@@ -1,8 +1,63 @@
+#include <fstream>
 #include <iostream>
+#include <csignal>
+#include <optional>
+#include "../library.h"
 #include "../scheme.h"
+#include "../signals.h"
 
-int main() {
+int main(int argc, char** argv) {
     Interpreter interpreter;
+    Profiler profiler;
+    std::optional<Profiler::Activation> profiling;
+    std::string profile_path;
+    std::string stats_path;
+    std::string trace_path;
+    EvaluationLimits limits;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--image" && i + 1 < argc) {
+            try {
+                interpreter.LoadImage(argv[++i]);
+            } catch (std::exception&) {
+                std::cerr << "Can't load the image " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profiling.emplace(&profiler);
+            profile_path = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i];
+            DumpRuntimeStatsOnSignal(SIGUSR1, stats_path);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+            Tracer::Start();
+            HandleSignalInThread(SIGUSR2, [trace_path]() { Tracer::WriteChromeTrace(trace_path); });
+        } else if (arg == "--max-steps" && i + 1 < argc) {
+            limits.max_steps = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--max-heap-bytes" && i + 1 < argc) {
+            limits.max_heap_bytes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--timeout-ms" && i + 1 < argc) {
+            limits.timeout = std::chrono::milliseconds(std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--library-path" && i + 1 < argc) {
+            AddLibraryPath(argv[++i]);
+        } else if (arg == "--load" && i + 1 < argc) {
+            try {
+                interpreter.LoadFile(argv[++i]);
+            } catch (std::exception&) {
+                std::cerr << "Can't load " << argv[i] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: scheme_interpreter [--image FILE] [--profile FILE]"
+                         " [--stats FILE]"
+                         " [--trace FILE] [--library-path DIR]... [--load FILE]..."
+                         " [--max-steps N] [--max-heap-bytes N] [--timeout-ms N]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    interpreter.SetLimits(limits);
     std::cout << "(pseudo)Scheme Language interpreter by @pepilica, 2022" << std::endl;
     std::cout << "Type \"exit\" to exit" << std::endl;
     std::string cur_string;
@@ -25,11 +80,27 @@ int main() {
         } catch (RuntimeError&) {
             std::cerr << "Runtime error occurred!" << std::endl;
             std::cerr.flush();
+        } catch (LimitError&) {
+            std::cerr << "Limit exceeded!" << std::endl;
+            std::cerr.flush();
         } catch (...) {
             std::cerr << "Some internal error occurred! Exiting..." << std::endl;
             std::cerr.flush();
             throw;
         }
     }
+    if (profiling) {
+        profiling.reset();
+        profiler.WriteReport(std::cerr);
+        std::ofstream out(profile_path);
+        profiler.WriteCollapsedStacks(out);
+    }
+    if (!stats_path.empty()) {
+        WriteRuntimeStats(stats_path);
+    }
+    if (!trace_path.empty()) {
+        Tracer::Stop();
+        Tracer::WriteChromeTrace(trace_path);
+    }
     return 0;
 }
@@ -0,0 +1,151 @@
+#include "runtime_stats.h"
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "signals.h"
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<runtime_stats_detail::ThreadBlock*> blocks;
+};
+
+// Leaked, like the blocks, so threads exiting after main can still count.
+Registry& GetRegistry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+struct ObjectKind {
+    const char* name;
+    RuntimeCounter created;
+    RuntimeCounter destroyed;
+};
+
+constexpr ObjectKind kKinds[] = {
+    {"cell", RuntimeCounter::CELLS_CREATED, RuntimeCounter::CELLS_DESTROYED},
+    {"number", RuntimeCounter::NUMBERS_CREATED, RuntimeCounter::NUMBERS_DESTROYED},
+    {"bool", RuntimeCounter::BOOLS_CREATED, RuntimeCounter::BOOLS_DESTROYED},
+    {"symbol", RuntimeCounter::SYMBOLS_CREATED, RuntimeCounter::SYMBOLS_DESTROYED},
+    {"string", RuntimeCounter::STRINGS_CREATED, RuntimeCounter::STRINGS_DESTROYED},
+    {"lambda", RuntimeCounter::LAMBDAS_CREATED, RuntimeCounter::LAMBDAS_DESTROYED},
+    {"function", RuntimeCounter::FUNCTIONS_CREATED, RuntimeCounter::FUNCTIONS_DESTROYED},
+    {"scope", RuntimeCounter::SCOPES_CREATED, RuntimeCounter::SCOPES_DESTROYED},
+};
+
+struct Total {
+    const char* name;
+    const char* help;
+    RuntimeCounter counter;
+};
+
+constexpr Total kTotals[] = {
+    {"evaluations", "Evaluate calls.", RuntimeCounter::EVALUATIONS},
+    {"scope_hops", "Parent scopes visited by variable lookups.", RuntimeCounter::SCOPE_HOPS},
+    {"function_lookups", "Builtin lookups by name.", RuntimeCounter::FUNCTION_LOOKUPS},
+    {"tokenizer_bytes", "Bytes handed to the tokenizer.", RuntimeCounter::TOKENIZER_BYTES},
+    {"tokens", "Tokens read.", RuntimeCounter::TOKENS},
+};
+
+// Destructions are counted on whichever thread drops the last reference, so
+// the live count is only exact in the sum.
+uint64_t Live(const RuntimeCounters& counters, const ObjectKind& kind) {
+    uint64_t created = counters[kind.created];
+    uint64_t destroyed = counters[kind.destroyed];
+    return created > destroyed ? created - destroyed : 0;
+}
+
+}  // namespace
+
+runtime_stats_detail::ThreadBlock* runtime_stats_detail::RegisterThread() {
+    auto* block = new ThreadBlock();
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    registry.blocks.push_back(block);
+    return block;
+}
+
+RuntimeCounters CollectRuntimeCounters() {
+    RuntimeCounters counters;
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    for (const auto* block : registry.blocks) {
+        for (size_t i = 0; i < kRuntimeCounterCount; ++i) {
+            counters.values[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    return counters;
+}
+
+std::vector<std::pair<std::string, uint64_t>> RuntimeStatsEntries(
+    const RuntimeCounters& counters) {
+    std::vector<std::pair<std::string, uint64_t>> entries;
+    for (const auto& kind : kKinds) {
+        entries.emplace_back(std::string(kind.name) + "s-created", counters[kind.created]);
+        entries.emplace_back(std::string(kind.name) + "s-live", Live(counters, kind));
+    }
+    for (const auto& total : kTotals) {
+        std::string name = total.name;
+        for (char& c : name) {
+            if (c == '_') {
+                c = '-';
+            }
+        }
+        entries.emplace_back(name, counters[total.counter]);
+    }
+    return entries;
+}
+
+std::string RuntimeStatsToPrometheus(const RuntimeCounters& counters) {
+    std::ostringstream out;
+    out << "# HELP scheme_objects_created_total Objects created, by type.\n"
+        << "# TYPE scheme_objects_created_total counter\n";
+    for (const auto& kind : kKinds) {
+        out << "scheme_objects_created_total{type=\"" << kind.name << "\"} "
+            << counters[kind.created] << "\n";
+    }
+    out << "# HELP scheme_objects_live Objects alive, by type.\n"
+        << "# TYPE scheme_objects_live gauge\n";
+    for (const auto& kind : kKinds) {
+        out << "scheme_objects_live{type=\"" << kind.name << "\"} " << Live(counters, kind)
+            << "\n";
+    }
+    for (const auto& total : kTotals) {
+        out << "# HELP scheme_" << total.name << "_total " << total.help << "\n"
+            << "# TYPE scheme_" << total.name << "_total counter\n"
+            << "scheme_" << total.name << "_total " << counters[total.counter] << "\n";
+    }
+    return out.str();
+}
+
+std::string RuntimeStatsToJson(const RuntimeCounters& counters) {
+    std::ostringstream out;
+    out << "{\n  \"objects\": {";
+    bool first = true;
+    for (const auto& kind : kKinds) {
+        out << (first ? "\n" : ",\n") << "    \"" << kind.name
+            << "\": {\"created\": " << counters[kind.created]
+            << ", \"live\": " << Live(counters, kind) << "}";
+        first = false;
+    }
+    out << "\n  }";
+    for (const auto& total : kTotals) {
+        out << ",\n  \"" << total.name << "\": " << counters[total.counter];
+    }
+    out << "\n}\n";
+    return out.str();
+}
+
+void WriteRuntimeStats(const std::string& path) {
+    RuntimeCounters counters = CollectRuntimeCounters();
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    std::ofstream out(path, std::ios::trunc);
+    out << (json ? RuntimeStatsToJson(counters) : RuntimeStatsToPrometheus(counters));
+}
+
+void DumpRuntimeStatsOnSignal(int signal, const std::string& path) {
+    HandleSignalInThread(signal, [path]() { WriteRuntimeStats(path); });
+}
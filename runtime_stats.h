@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Process-wide runtime counters: objects and scopes created and destroyed by
+// type, evaluations, scope-chain hops, builtin lookups and tokenizer input.
+//
+// Every thread counts into its own block with relaxed stores, so a counter
+// costs about as much as an increment; reading sums the blocks. Blocks outlive
+// their threads, so objects destroyed during thread exit are still counted. An
+// interpreter runs on one thread, so in the server the counts of a worker are
+// those of its interpreter.
+
+// Every *_CREATED is directly followed by its *_DESTROYED.
+enum class RuntimeCounter : size_t {
+    CELLS_CREATED,
+    CELLS_DESTROYED,
+    NUMBERS_CREATED,
+    NUMBERS_DESTROYED,
+    BOOLS_CREATED,
+    BOOLS_DESTROYED,
+    SYMBOLS_CREATED,
+    SYMBOLS_DESTROYED,
+    STRINGS_CREATED,
+    STRINGS_DESTROYED,
+    LAMBDAS_CREATED,
+    LAMBDAS_DESTROYED,
+    FUNCTIONS_CREATED,
+    FUNCTIONS_DESTROYED,
+    SCOPES_CREATED,
+    SCOPES_DESTROYED,
+    EVALUATIONS,
+    SCOPE_HOPS,
+    FUNCTION_LOOKUPS,
+    TOKENIZER_BYTES,
+    TOKENS,
+    COUNT,
+};
+
+constexpr size_t kRuntimeCounterCount = static_cast<size_t>(RuntimeCounter::COUNT);
+
+struct RuntimeCounters {
+    uint64_t values[kRuntimeCounterCount] = {};
+
+    uint64_t operator[](RuntimeCounter counter) const {
+        return values[static_cast<size_t>(counter)];
+    }
+};
+
+namespace runtime_stats_detail {
+
+struct ThreadBlock {
+    std::atomic<uint64_t> values[kRuntimeCounterCount] = {};
+};
+
+ThreadBlock* RegisterThread();
+
+inline thread_local ThreadBlock* thread_block = nullptr;
+
+}  // namespace runtime_stats_detail
+
+inline void CountRuntime(RuntimeCounter counter, uint64_t amount = 1) {
+    using namespace runtime_stats_detail;
+    ThreadBlock* block = thread_block;
+    if (!block) {
+        block = thread_block = RegisterThread();
+    }
+    auto& value = block->values[static_cast<size_t>(counter)];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Counts the creation and destruction of the object that holds it; declare it
+// [[no_unique_address]] so it takes no space. The destruction counter is the
+// one after `created`.
+template <RuntimeCounter created>
+struct InstanceCounter {
+    static constexpr RuntimeCounter kDestroyed =
+        static_cast<RuntimeCounter>(static_cast<size_t>(created) + 1);
+
+    InstanceCounter() {
+        CountRuntime(created);
+    }
+
+    InstanceCounter(const InstanceCounter&) : InstanceCounter() {
+    }
+
+    InstanceCounter& operator=(const InstanceCounter&) {
+        return *this;
+    }
+
+    ~InstanceCounter() {
+        CountRuntime(kDestroyed);
+    }
+};
+
+RuntimeCounters CollectRuntimeCounters();
+
+// Flat (name, value) pairs in Scheme naming: "cells-created", "cells-live",
+// ..., "evaluations", "scope-hops" and so on.
+std::vector<std::pair<std::string, uint64_t>> RuntimeStatsEntries(const RuntimeCounters& counters);
+
+std::string RuntimeStatsToPrometheus(const RuntimeCounters& counters);
+std::string RuntimeStatsToJson(const RuntimeCounters& counters);
+
+// Writes the current counters to path, as JSON if it ends in ".json" and in
+// the Prometheus text format otherwise.
+void WriteRuntimeStats(const std::string& path);
+
+// Writes the counters to path whenever the process gets signal; see
+// HandleSignalInThread.
+void DumpRuntimeStatsOnSignal(int signal, const std::string& path);
@@ -1,60 +1,203 @@
 #include "scheme.h"
 
+#include "expander.h"
+#include "image.h"
+#include "quicken.h"
+#include "source_cache.h"
+
+namespace {
+
+void AppendResult(const std::shared_ptr<Object>& result, std::string* output) {
+    if (!result) {
+        *output += "()";
+    } else {
+        *output += result->Serialize();
+    }
+}
+
+void StartBudget(const EvaluationLimits& limits, std::optional<BudgetScope>* budget) {
+    if (limits.IsSet()) {
+        budget->emplace(std::make_shared<Budget>(limits));
+    }
+}
+
+}  // namespace
+
 std::string Interpreter::Run(const std::string& stream) {
 
     InitializeFunctionKeeper();
 
-    std::stringstream ss{stream};
-    Tokenizer tokenizer{&ss};
+    std::optional<BudgetScope> budget;
+    StartBudget(limits_, &budget);
+    std::optional<EnvironmentScope> environment;
+    EnterGlobalScope(&environment);
+
+    tokenizer_.Reset(stream);
+
+    std::optional<Tracer::Span> span;
+    if (Tracer::Enabled()) {
+        span.emplace("read", TraceCategory::PARSE);
+    }
+    auto input_ast = Quicken(Expand(reader_.Read(&tokenizer_)));
+    span.reset();
+
+    while (!tokenizer_.IsEnd()) {
+        reader_.Read(&tokenizer_);
+    }
 
     std::string output_string;
+    AppendResult(EvaluateTopLevel(input_ast), &output_string);
+    return output_string;
+}
+
+std::string Interpreter::Eval(std::string_view source) {
+    std::string output;
+    Eval(source, &output);
+    return output;
+}
+
+void Interpreter::Eval(std::string_view source, std::string* output) {
+    InitializeFunctionKeeper();
+
+    std::optional<BudgetScope> budget;
+    StartBudget(limits_, &budget);
+    std::optional<EnvironmentScope> environment;
+    EnterGlobalScope(&environment);
+
+    // What an earlier call that failed left behind goes now.
+    forms_.clear();
+    tokenizer_.Reset(source);
+    {
+        std::optional<Tracer::Span> span;
+        if (Tracer::Enabled()) {
+            span.emplace("read", TraceCategory::PARSE);
+        }
+        while (!tokenizer_.IsEnd()) {
+            forms_.push_back(Quicken(Expand(reader_.Read(&tokenizer_))));
+        }
+    }
+    if (forms_.empty()) {
+        throw RuntimeError(" ");
+    }
+
+    std::shared_ptr<Object> result;
+    for (const auto& form : forms_) {
+        result = EvaluateTopLevel(form);
+    }
+    forms_.clear();
+    AppendResult(result, output);
+}
 
-    auto input_ast = Read(&tokenizer);
+std::vector<EvalResult> Interpreter::RunBatch(std::span<const std::string_view> items) {
+    std::vector<EvalResult> results;
+    RunBatch(items, &results);
+    return results;
+}
+
+void Interpreter::RunBatch(std::span<const std::string_view> items,
+                           std::vector<EvalResult>* results) {
+    results->resize(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        EvalResult& result = (*results)[i];
+        result.output.clear();
+        result.status = TryEval(items[i], &result.output);
+    }
+}
 
-    while (!tokenizer.IsEnd()) {
-        Read(&tokenizer);
+EvalStatus Interpreter::TryEval(std::string_view source, std::string* output) {
+    size_t size = output->size();
+    EvalStatus status = EvalStatus::OK;
+    try {
+        Eval(source, output);
+        return status;
+    } catch (LimitError&) {
+        status = EvalStatus::LIMIT_EXCEEDED;
+    } catch (SyntaxError&) {
+        status = EvalStatus::SYNTAX_ERROR;
+    } catch (NameError&) {
+        status = EvalStatus::NAME_ERROR;
+    } catch (RuntimeError&) {
+        status = EvalStatus::RUNTIME_ERROR;
+    } catch (...) {
+        status = EvalStatus::INTERNAL_ERROR;
     }
+    output->resize(size);
+    return status;
+}
 
+// A list at the top level is applied here rather than evaluated as a cell, with
+// a quoted datum its own single argument.
+std::shared_ptr<Object> Interpreter::EvaluateTopLevel(const std::shared_ptr<Object>& input_ast) {
     if (!input_ast) {
         throw RuntimeError(" ");
     }
 
-    if (!global_scope_) {
-        global_scope_ = std::make_shared<Scope>();
-    }
-
-    if (Is<Cell>(input_ast)) {
-        std::shared_ptr<Cell> cell_ast = As<Cell>(input_ast);
-        std::shared_ptr<Object> first_arg = cell_ast->GetFirst();
-        ObjectVector args;
-        if (Is<Symbol>(first_arg)) {
-            if (As<Symbol>(first_arg)->GetName() == "quote") {
-                if (Is<Cell>(cell_ast->GetSecond())) {
-                    args = ObjectVectorBase({As<Cell>(cell_ast->GetSecond())->GetFirst()});
-                } else if (cell_ast->GetSecond()) {
-                    args = ObjectVectorBase({cell_ast->GetSecond()});
-                }
+    if (!Is<Cell>(input_ast)) {
+        return input_ast->Evaluate(global_scope_);
+    }
+    std::shared_ptr<Cell> cell_ast = As<Cell>(input_ast);
+    std::shared_ptr<Object> first_arg = cell_ast->GetFirst();
+    ObjectVector args;
+    if (Is<Symbol>(first_arg)) {
+        if (As<Symbol>(first_arg)->GetName() == "quote") {
+            if (Is<Cell>(cell_ast->GetSecond())) {
+                args = ObjectVectorBase({As<Cell>(cell_ast->GetSecond())->GetFirst()});
             } else if (cell_ast->GetSecond()) {
-                args = EvaluateList(cell_ast->GetSecond());
+                args = ObjectVectorBase({cell_ast->GetSecond()});
             }
-        } else {
+        } else if (cell_ast->GetSecond()) {
             args = EvaluateList(cell_ast->GetSecond());
         }
-        args.GetScope() = std::shared_ptr<Scope>(new Scope());
-        args.GetScope() = global_scope_;
-        if (first_arg == nullptr) {
-            throw RuntimeError(" ");
-        }
-        std::shared_ptr<Object> evaluated_first_arg = first_arg->Evaluate(global_scope_);
-        auto function = As<FunctionWrapper>(evaluated_first_arg);
-        auto output = function->Apply(args);
-        if (!output) {
-            output_string += "()";
-        } else {
-            output_string += output->Serialize();
-        }
     } else {
-        output_string += input_ast->Evaluate(global_scope_)->Serialize();
+        args = EvaluateList(cell_ast->GetSecond());
+    }
+    args.GetScope() = global_scope_;
+    if (first_arg == nullptr) {
+        throw RuntimeError(" ");
+    }
+    std::shared_ptr<Object> evaluated_first_arg = first_arg->Evaluate(global_scope_);
+    auto function = As<FunctionWrapper>(evaluated_first_arg);
+    return ApplyFunction(*function, args);
+}
+
+void Interpreter::SetLimits(const EvaluationLimits& limits) {
+    limits_ = limits;
+}
+
+void Interpreter::LoadImage(const std::string& path) {
+    InitializeFunctionKeeper();
+    global_scope_ = ::LoadImage(path);
+    environment_ = nullptr;
+}
+
+void Interpreter::LoadFile(const std::string& path) {
+    InitializeFunctionKeeper();
+    std::optional<EnvironmentScope> environment;
+    EnterGlobalScope(&environment);
+    for (const auto& form : ReadSourceFile(path)) {
+        form->Evaluate(global_scope_);
+    }
+}
+
+std::unique_ptr<Interpreter> Interpreter::Fork() {
+    if (!global_scope_) {
+        global_scope_ = Scope::MakeGlobal();
+    }
+    if (!environment_) {
+        environment_ = global_scope_->GetEnvironment();
+    }
+    auto fork = std::make_unique<Interpreter>();
+    fork->global_scope_ = global_scope_;
+    fork->environment_ = environment_->Fork();
+    fork->limits_ = limits_;
+    return fork;
+}
+
+void Interpreter::EnterGlobalScope(std::optional<EnvironmentScope>* environment) {
+    if (!global_scope_) {
+        global_scope_ = Scope::MakeGlobal();
+    }
+    if (environment_) {
+        environment->emplace(global_scope_.get(), environment_);
     }
-    return output_string;
 }
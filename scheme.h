@@ -1,16 +1,91 @@
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <vector>
 #include "tokenizer.h"
 #include "parser.h"
 #include "error.h"
 #include "functions.h"
+#include "eval_limits.h"
+
+enum class EvalStatus {
+    OK,
+    SYNTAX_ERROR,
+    NAME_ERROR,
+    RUNTIME_ERROR,
+    LIMIT_EXCEEDED,
+    INTERNAL_ERROR,
+};
+
+struct EvalResult {
+    EvalStatus status = EvalStatus::OK;
+    // What the item evaluated to; empty after an error.
+    std::string output;
+};
 
 class Interpreter {
 public:
+    // Evaluates the first expression of stream; the rest only has to read.
+    // Throws a LimitError if the limits set are exceeded.
     std::string Run(const std::string& stream);
 
+    // Evaluates every expression of source in order and returns what the last
+    // one evaluated to. Nothing is evaluated unless all of source reads. Throws
+    // like Run.
+    std::string Eval(std::string_view source);
+
+    // The same, appending the result to *output, so a caller can keep one
+    // buffer for many calls.
+    void Eval(std::string_view source, std::string* output);
+
+    // Eval that returns how it ended instead of throwing; after an error
+    // *output is as it was.
+    EvalStatus TryEval(std::string_view source, std::string* output);
+
+    // Evaluates each item as Eval does, each with the full limits; an error
+    // ends only its own item. results[i] is for items[i].
+    std::vector<EvalResult> RunBatch(std::span<const std::string_view> items);
+
+    // The same into *results, reusing the strings already there.
+    void RunBatch(std::span<const std::string_view> items, std::vector<EvalResult>* results);
+
+    // Limits every later Run and Eval call and batch item, each to the full
+    // amounts.
+    void SetLimits(const EvaluationLimits& limits);
+
+    // Replaces the global scope with the one saved by (save-image "file").
+    void LoadImage(const std::string& path);
+
+    // Evaluates every expression of a source file in the global scope.
+    void LoadFile(const std::string& path);
+
+    // An interpreter that starts with the global bindings and limits of this
+    // one and from then on is independent of it: what either defines or
+    // set!s the other doesn't see. The two share the data the bindings hold
+    // rather than copying it, so this takes constant time however many there
+    // are. Must not be called while this interpreter evaluates; the two may
+    // then run on different threads.
+    std::unique_ptr<Interpreter> Fork();
+
 private:
+    std::shared_ptr<Object> EvaluateTopLevel(const std::shared_ptr<Object>& form);
+
+    // Makes the global scope if there is none yet and has this thread see the
+    // environment of this interpreter through it.
+    void EnterGlobalScope(std::optional<EnvironmentScope>* environment);
+
     std::shared_ptr<Scope> global_scope_;
+    // Set in forks and in the interpreters they were forked from; otherwise
+    // the global scope's own environment is this interpreter's.
+    std::shared_ptr<Environment> environment_;
+    EvaluationLimits limits_;
+    // Kept from one call to the next, so reading allocates only for the forms.
+    Tokenizer tokenizer_{std::string_view()};
+    Reader reader_;
+    std::vector<std::shared_ptr<Object>> forms_;
 };
@@ -0,0 +1,67 @@
+#include "scheme_capi.h"
+
+#include <new>
+#include <string>
+#include <string_view>
+#include "scheme.h"
+
+struct scheme_interpreter {
+    Interpreter interpreter;
+    // The last result, which *output points into.
+    std::string output;
+};
+
+namespace {
+
+scheme_status StatusOf(EvalStatus status) {
+    switch (status) {
+        case EvalStatus::OK:
+            return SCHEME_OK;
+        case EvalStatus::SYNTAX_ERROR:
+            return SCHEME_SYNTAX_ERROR;
+        case EvalStatus::NAME_ERROR:
+            return SCHEME_NAME_ERROR;
+        case EvalStatus::RUNTIME_ERROR:
+            return SCHEME_RUNTIME_ERROR;
+        case EvalStatus::LIMIT_EXCEEDED:
+            return SCHEME_LIMIT_EXCEEDED;
+        case EvalStatus::INTERNAL_ERROR:
+            break;
+    }
+    return SCHEME_INTERNAL_ERROR;
+}
+
+}  // namespace
+
+extern "C" {
+
+scheme_interpreter* scheme_new(void) {
+    return new (std::nothrow) scheme_interpreter();
+}
+
+scheme_status scheme_eval(scheme_interpreter* interpreter, const char* source, size_t length,
+                          const char** output, size_t* output_length) {
+    interpreter->output.clear();
+    EvalStatus status =
+        interpreter->interpreter.TryEval(std::string_view(source, length), &interpreter->output);
+    *output = interpreter->output.c_str();
+    if (output_length) {
+        *output_length = interpreter->output.size();
+    }
+    return StatusOf(status);
+}
+
+void scheme_set_limits(scheme_interpreter* interpreter, uint64_t max_steps,
+                       uint64_t max_heap_bytes, uint64_t timeout_ms) {
+    EvaluationLimits limits;
+    limits.max_steps = max_steps;
+    limits.max_heap_bytes = max_heap_bytes;
+    limits.timeout = std::chrono::milliseconds(timeout_ms);
+    interpreter->interpreter.SetLimits(limits);
+}
+
+void scheme_free(scheme_interpreter* interpreter) {
+    delete interpreter;
+}
+
+}  // extern "C"
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The interpreter behind a C ABI, for runtimes that can't call C++; libscheme
+// exports it. An interpreter may be used by one thread at a time, and no C++
+// exception leaves these functions.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct scheme_interpreter scheme_interpreter;
+
+typedef enum {
+    SCHEME_OK = 0,
+    SCHEME_SYNTAX_ERROR = 1,
+    SCHEME_NAME_ERROR = 2,
+    SCHEME_RUNTIME_ERROR = 3,
+    SCHEME_LIMIT_EXCEEDED = 4,
+    SCHEME_INTERNAL_ERROR = 5,
+} scheme_status;
+
+// An interpreter with an empty global scope, or NULL if it can't be made.
+scheme_interpreter* scheme_new(void);
+
+// Evaluates the length bytes at source as Interpreter::Eval does. *output is
+// set to the result, NUL-terminated, with its length in *output_length unless
+// that is NULL; it is empty after an error, and stays valid until the next
+// call with the same interpreter.
+scheme_status scheme_eval(scheme_interpreter* interpreter, const char* source, size_t length,
+                          const char** output, size_t* output_length);
+
+// Limits every later scheme_eval; 0 leaves a limit off.
+void scheme_set_limits(scheme_interpreter* interpreter, uint64_t max_steps,
+                       uint64_t max_heap_bytes, uint64_t timeout_ms);
+
+void scheme_free(scheme_interpreter* interpreter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,395 @@
+#include "eval_server.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "../scheme.h"
+
+namespace {
+
+constexpr uint64_t kListenId = 0;
+constexpr uint64_t kWakeId = 1;
+constexpr uint64_t kFirstConnectionId = 2;
+constexpr size_t kReadChunk = 64 * 1024;
+
+void ThrowErrno(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+}  // namespace
+
+EvalServer::EvalServer(ServerOptions options)
+    : options_(std::move(options)),
+      prelude_(),
+      listen_fd_(-1),
+      epoll_fd_(-1),
+      wake_fd_(-1),
+      stopping_(false),
+      stop_requested_(false),
+      next_connection_id_(kFirstConnectionId) {
+    if (!options_.prelude_path.empty()) {
+        std::ifstream prelude(options_.prelude_path);
+        if (!prelude) {
+            throw std::runtime_error("can't open prelude " + options_.prelude_path);
+        }
+        std::string line;
+        while (std::getline(prelude, line)) {
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                prelude_.push_back(line);
+            }
+        }
+    }
+    Listen();
+    for (size_t i = 0; i < options_.interpreters; ++i) {
+        workers_.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+EvalServer::~EvalServer() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        stopping_ = true;
+    }
+    jobs_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    for (auto& [id, connection] : connections_) {
+        close(connection.fd);
+    }
+    close(wake_fd_);
+    close(epoll_fd_);
+    close(listen_fd_);
+    unlink(options_.socket_path.c_str());
+}
+
+void EvalServer::Listen() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options_.socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path is too long");
+    }
+    std::strcpy(address.sun_path, options_.socket_path.c_str());
+    unlink(options_.socket_path.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        ThrowErrno("socket");
+    }
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        ThrowErrno("bind");
+    }
+    if (listen(listen_fd_, SOMAXCONN) < 0) {
+        ThrowErrno("listen");
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        ThrowErrno("epoll");
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = kListenId;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+    event.data.u64 = kWakeId;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+void EvalServer::WorkerLoop() {
+    Interpreter interpreter;
+    for (const auto& line : prelude_) {
+        try {
+            interpreter.Run(line);
+        } catch (std::exception& error) {
+            std::cerr << "prelude line failed: " << line << std::endl;
+        }
+    }
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex_);
+            jobs_cv_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        Done done{job.connection_id, job.sequence, ResponseStatus::OK, ""};
+        if (Clock::now() >= job.deadline) {
+            // It has already been answered with a timeout while it waited.
+            continue;
+        }
+        EvaluationLimits limits;
+        limits.max_steps = options_.max_steps;
+        limits.max_heap_bytes = options_.max_heap_bytes;
+        limits.timeout = job.deadline - Clock::now();
+        interpreter.SetLimits(limits);
+        try {
+            done.body = interpreter.Run(job.expression);
+        } catch (LimitError&) {
+            done.status = ResponseStatus::LIMIT_EXCEEDED;
+        } catch (SyntaxError&) {
+            done.status = ResponseStatus::SYNTAX_ERROR;
+        } catch (NameError&) {
+            done.status = ResponseStatus::NAME_ERROR;
+        } catch (RuntimeError&) {
+            done.status = ResponseStatus::RUNTIME_ERROR;
+        } catch (...) {
+            done.status = ResponseStatus::INTERNAL_ERROR;
+        }
+        {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            done_.push_back(std::move(done));
+        }
+        uint64_t one = 1;
+        [[maybe_unused]] auto written = write(wake_fd_, &one, sizeof(one));
+    }
+}
+
+void EvalServer::Stop() {
+    stop_requested_ = true;
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wake_fd_, &one, sizeof(one));
+}
+
+LatencyStats& EvalServer::GetLatency() {
+    return latency_;
+}
+
+void EvalServer::Serve() {
+    std::vector<epoll_event> events(128);
+    while (!stop_requested_) {
+        int count = epoll_wait(epoll_fd_, events.data(), events.size(), NextTimeoutMs());
+        if (count < 0 && errno != EINTR) {
+            ThrowErrno("epoll_wait");
+        }
+        for (int i = 0; i < count; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == kListenId) {
+                Accept();
+            } else if (id == kWakeId) {
+                uint64_t value;
+                [[maybe_unused]] auto got = read(wake_fd_, &value, sizeof(value));
+                CollectDone();
+            } else {
+                auto iter = connections_.find(id);
+                if (iter == connections_.end()) {
+                    continue;
+                }
+                if ((events[i].events & EPOLLOUT) && !WriteTo(id, iter->second)) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    ReadFrom(id, iter->second);
+                }
+            }
+        }
+        ExpireDeadlines();
+    }
+}
+
+void EvalServer::Accept() {
+    while (true) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        uint64_t id = next_connection_id_++;
+        Connection& connection = connections_[id];
+        connection.fd = fd;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void EvalServer::ReadFrom(uint64_t id, Connection& connection) {
+    char buffer[kReadChunk];
+    while (true) {
+        ssize_t got = read(connection.fd, buffer, sizeof(buffer));
+        if (got > 0) {
+            connection.input.append(buffer, got);
+            continue;
+        }
+        if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+            connection.closing = true;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+    size_t offset = 0;
+    while (connection.input.size() - offset >= kHeaderSize) {
+        uint32_t length = ReadFrameLength(connection.input.data() + offset);
+        if (length > options_.max_request_size) {
+            Close(id);
+            return;
+        }
+        if (connection.input.size() - offset - kHeaderSize < length) {
+            break;
+        }
+        connection.requests.push_back(connection.input.substr(offset + kHeaderSize, length));
+        offset += kHeaderSize + length;
+    }
+    connection.input.erase(0, offset);
+    if (!connection.in_flight && !Dispatch(id, connection)) {
+        return;
+    }
+    if (connection.closing) {
+        UpdateEvents(id, connection);
+    }
+}
+
+bool EvalServer::Dispatch(uint64_t id, Connection& connection) {
+    if (connection.requests.empty()) {
+        if (connection.closing && connection.output_offset == connection.output.size()) {
+            Close(id);
+            return false;
+        }
+        return true;
+    }
+    connection.in_flight = true;
+    connection.started = Clock::now();
+    connection.deadline = connection.started + options_.timeout;
+    ++connection.sequence;
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        jobs_.push_back(Job{id, connection.sequence, std::move(connection.requests.front()),
+                            connection.deadline});
+    }
+    connection.requests.pop_front();
+    jobs_cv_.notify_one();
+    return true;
+}
+
+void EvalServer::Respond(uint64_t id, Connection& connection, ResponseStatus status,
+                         const std::string& body) {
+    auto elapsed = Clock::now() - connection.started;
+    latency_.Add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    connection.in_flight = false;
+    AppendFrame(connection.output, status, body);
+    if (WriteTo(id, connection)) {
+        Dispatch(id, connection);
+    }
+}
+
+bool EvalServer::WriteTo(uint64_t id, Connection& connection) {
+    while (connection.output_offset < connection.output.size()) {
+        ssize_t sent = send(connection.fd, connection.output.data() + connection.output_offset,
+                            connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                Close(id);
+                return false;
+            }
+            break;
+        }
+        connection.output_offset += sent;
+    }
+    if (connection.output_offset == connection.output.size()) {
+        connection.output.clear();
+        connection.output_offset = 0;
+        if (connection.closing && !connection.in_flight && connection.requests.empty()) {
+            Close(id);
+            return false;
+        }
+    }
+    UpdateEvents(id, connection);
+    return true;
+}
+
+void EvalServer::UpdateEvents(uint64_t id, Connection& connection) {
+    if (connection.closing && connection.output.empty()) {
+        // Hang-ups are reported even with no events asked for; stop watching the
+        // socket until there is something to write.
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+        return;
+    }
+    epoll_event event{};
+    event.events = connection.closing ? 0 : EPOLLIN;
+    if (!connection.output.empty()) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event) < 0 && errno == ENOENT) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event);
+    }
+}
+
+void EvalServer::CollectDone() {
+    std::vector<Done> done;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        done.swap(done_);
+    }
+    for (auto& result : done) {
+        auto iter = connections_.find(result.connection_id);
+        if (iter == connections_.end()) {
+            continue;
+        }
+        Connection& connection = iter->second;
+        if (!connection.in_flight || connection.sequence != result.sequence) {
+            continue;
+        }
+        Respond(result.connection_id, connection, result.status, result.body);
+    }
+}
+
+void EvalServer::ExpireDeadlines() {
+    auto now = Clock::now();
+    std::vector<uint64_t> expired;
+    for (auto& [id, connection] : connections_) {
+        if (connection.in_flight && connection.deadline <= now) {
+            expired.push_back(id);
+        }
+    }
+    for (uint64_t id : expired) {
+        auto iter = connections_.find(id);
+        if (iter != connections_.end()) {
+            Respond(id, iter->second, ResponseStatus::TIMEOUT, "");
+        }
+    }
+}
+
+int EvalServer::NextTimeoutMs() {
+    auto now = Clock::now();
+    bool any = false;
+    Clock::time_point nearest;
+    for (auto& [id, connection] : connections_) {
+        if (connection.in_flight && (!any || connection.deadline < nearest)) {
+            nearest = connection.deadline;
+            any = true;
+        }
+    }
+    if (!any) {
+        return -1;
+    }
+    if (nearest <= now) {
+        return 0;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nearest - now);
+    return wait.count() + 1;
+}
+
+void EvalServer::Close(uint64_t id) {
+    auto iter = connections_.find(id);
+    if (iter == connections_.end()) {
+        return;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, iter->second.fd, nullptr);
+    close(iter->second.fd);
+    connections_.erase(iter);
+}
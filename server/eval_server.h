@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "latency.h"
+#include "protocol.h"
+
+struct ServerOptions {
+    std::string socket_path;
+    size_t interpreters = 4;
+    std::chrono::milliseconds timeout{1000};
+    // Evaluated line by line in every interpreter before the server starts.
+    std::string prelude_path;
+    size_t max_request_size = 1 << 20;
+    // Per request; 0 is no limit. A request is also stopped at its timeout.
+    uint64_t max_steps = 0;
+    uint64_t max_heap_bytes = 0;
+};
+
+// Serves length-prefixed eval requests on a Unix domain socket. One epoll loop
+// does all socket I/O; a pool of threads, each with its own warm Interpreter,
+// evaluates the requests. A connection has at most one request in flight, so
+// its responses come back in order.
+class EvalServer {
+public:
+    explicit EvalServer(ServerOptions options);
+    ~EvalServer();
+
+    // Runs the event loop until Stop() is called.
+    void Serve();
+
+    // Safe to call from a signal handler.
+    void Stop();
+
+    LatencyStats& GetLatency();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        uint64_t connection_id;
+        uint64_t sequence;
+        std::string expression;
+        Clock::time_point deadline;
+    };
+
+    struct Done {
+        uint64_t connection_id;
+        uint64_t sequence;
+        ResponseStatus status;
+        std::string body;
+    };
+
+    struct Connection {
+        int fd;
+        std::string input;
+        std::string output;
+        size_t output_offset = 0;
+        std::deque<std::string> requests;
+        bool in_flight = false;
+        // Tells the result of the request in flight from a late one of a request
+        // that has already timed out.
+        uint64_t sequence = 0;
+        Clock::time_point started;
+        Clock::time_point deadline;
+        bool closing = false;
+    };
+
+    void Listen();
+    void WorkerLoop();
+    void Accept();
+    void ReadFrom(uint64_t id, Connection& connection);
+    // WriteTo and Dispatch may close the connection; they return false if
+    // they did, and connection must not be used after that.
+    bool WriteTo(uint64_t id, Connection& connection);
+    bool Dispatch(uint64_t id, Connection& connection);
+    void Respond(uint64_t id, Connection& connection, ResponseStatus status,
+                 const std::string& body);
+    void CollectDone();
+    void ExpireDeadlines();
+    int NextTimeoutMs();
+    void Close(uint64_t id);
+    void UpdateEvents(uint64_t id, Connection& connection);
+
+    ServerOptions options_;
+    std::vector<std::string> prelude_;
+    int listen_fd_;
+    int epoll_fd_;
+    int wake_fd_;
+
+    std::mutex jobs_mutex_;
+    std::condition_variable jobs_cv_;
+    std::deque<Job> jobs_;
+    bool stopping_;
+    std::atomic<bool> stop_requested_;
+
+    std::mutex done_mutex_;
+    std::vector<Done> done_;
+
+    std::vector<std::thread> workers_;
+    std::unordered_map<uint64_t, Connection> connections_;
+    uint64_t next_connection_id_;
+    LatencyStats latency_;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Request latencies in microseconds; percentiles are computed on demand.
+class LatencyStats {
+public:
+    void Add(uint64_t micros) {
+        samples_.push_back(micros);
+    }
+
+    size_t Count() const {
+        return samples_.size();
+    }
+
+    uint64_t Percentile(double fraction) {
+        if (samples_.empty()) {
+            return 0;
+        }
+        size_t index = static_cast<size_t>(fraction * (samples_.size() - 1));
+        std::nth_element(samples_.begin(), samples_.begin() + index, samples_.end());
+        return samples_[index];
+    }
+
+    void Merge(const LatencyStats& other) {
+        samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+    }
+
+    void Report(std::ostream& out) {
+        out << "requests: " << Count() << "  p50: " << Percentile(0.5)
+            << " us  p99: " << Percentile(0.99) << " us  max: " << Percentile(1.0) << " us"
+            << std::endl;
+    }
+
+private:
+    std::vector<uint64_t> samples_;
+};
@@ -0,0 +1,137 @@
+// Drives scheme_server over its socket and reports client-side latency.
+// Usage: scheme_loadgen --socket PATH [--connections N] [--requests N] [--expr EXPR]
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "latency.h"
+#include "protocol.h"
+
+namespace {
+
+struct Client {
+    LatencyStats latency;
+    size_t failures = 0;
+};
+
+bool WriteAll(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t sent = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        offset += sent;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, char* buffer, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t got = read(fd, buffer + offset, size - offset);
+        if (got <= 0) {
+            return false;
+        }
+        offset += got;
+    }
+    return true;
+}
+
+int Connect(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void RunClient(const std::string& path, const std::string& expr, size_t requests,
+               Client& client) {
+    int fd = Connect(path);
+    if (fd < 0) {
+        client.failures = requests;
+        return;
+    }
+    std::string frame;
+    AppendFrame(frame, expr);
+    std::string body;
+    for (size_t i = 0; i < requests; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        char header[kHeaderSize];
+        if (!WriteAll(fd, frame) || !ReadAll(fd, header, kHeaderSize)) {
+            client.failures += requests - i;
+            break;
+        }
+        body.resize(ReadFrameLength(header));
+        if (!ReadAll(fd, body.data(), body.size())) {
+            client.failures += requests - i;
+            break;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        client.latency.Add(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        if (body.empty() || body[0] != static_cast<char>(ResponseStatus::OK)) {
+            ++client.failures;
+        }
+    }
+    close(fd);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string path;
+    size_t connections = 8;
+    size_t requests = 10000;
+    std::string expr = "(+ 1 2)";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--socket") {
+            path = argv[i + 1];
+        } else if (arg == "--connections") {
+            connections = std::max(1, std::atoi(argv[i + 1]));
+        } else if (arg == "--requests") {
+            requests = std::atoi(argv[i + 1]);
+        } else if (arg == "--expr") {
+            expr = argv[i + 1];
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: scheme_loadgen --socket PATH [--connections N] [--requests N]"
+                     " [--expr EXPR]"
+                  << std::endl;
+        return 1;
+    }
+    std::vector<Client> clients(connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < connections; ++i) {
+        size_t share = requests / connections + (i < requests % connections ? 1 : 0);
+        threads.emplace_back(RunClient, path, expr, share, std::ref(clients[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    LatencyStats total;
+    size_t failures = 0;
+    for (auto& client : clients) {
+        total.Merge(client.latency);
+        failures += client.failures;
+    }
+    std::cout << "throughput: " << total.Count() / elapsed.count() << " req/s  failures: "
+              << failures << std::endl;
+    total.Report(std::cout);
+    return failures == 0 ? 0 : 2;
+}
@@ -0,0 +1,97 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "../library.h"
+#include "../runtime_stats.h"
+#include "../signals.h"
+#include "../tracer.h"
+#include "eval_server.h"
+
+namespace {
+
+EvalServer* running_server = nullptr;
+
+void HandleSignal(int) {
+    if (running_server) {
+        running_server->Stop();
+    }
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: scheme_server --socket PATH [--interpreters N] [--timeout-ms N]"
+                 " [--max-steps N] [--max-heap-bytes N]"
+                 " [--library-path DIR]... [--prelude FILE] [--stats FILE] [--trace FILE]"
+              << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    std::string stats_path;
+    std::string trace_path;
+    options.interpreters = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--socket") {
+            options.socket_path = value;
+        } else if (arg == "--interpreters") {
+            options.interpreters = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--timeout-ms") {
+            options.timeout = std::chrono::milliseconds(std::atoi(value.c_str()));
+        } else if (arg == "--max-steps") {
+            options.max_steps = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--max-heap-bytes") {
+            options.max_heap_bytes = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--library-path") {
+            AddLibraryPath(value);
+        } else if (arg == "--prelude") {
+            options.prelude_path = value;
+        } else if (arg == "--stats") {
+            stats_path = value;
+        } else if (arg == "--trace") {
+            trace_path = value;
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (options.socket_path.empty()) {
+        PrintUsage();
+        return 1;
+    }
+    if (!stats_path.empty()) {
+        DumpRuntimeStatsOnSignal(SIGUSR1, stats_path);
+    }
+    if (!trace_path.empty()) {
+        Tracer::Start();
+        HandleSignalInThread(SIGUSR2, [trace_path]() { Tracer::WriteChromeTrace(trace_path); });
+    }
+    try {
+        EvalServer server(options);
+        running_server = &server;
+        std::signal(SIGINT, HandleSignal);
+        std::signal(SIGTERM, HandleSignal);
+        std::cerr << "Serving on " << options.socket_path << " with " << options.interpreters
+                  << " interpreters" << std::endl;
+        server.Serve();
+        running_server = nullptr;
+        server.GetLatency().Report(std::cerr);
+        if (!stats_path.empty()) {
+            WriteRuntimeStats(stats_path);
+        }
+        if (!trace_path.empty()) {
+            Tracer::WriteChromeTrace(trace_path);
+        }
+    } catch (std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
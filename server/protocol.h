@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Every message is a 4-byte big-endian length followed by that many bytes.
+// A request carries one expression; a response starts with a status byte
+// followed by the serialized result or nothing.
+enum class ResponseStatus : char {
+    OK = 'O',
+    SYNTAX_ERROR = 'S',
+    NAME_ERROR = 'N',
+    RUNTIME_ERROR = 'R',
+    TIMEOUT = 'T',
+    LIMIT_EXCEEDED = 'L',
+    INTERNAL_ERROR = 'E',
+};
+
+constexpr size_t kHeaderSize = 4;
+
+inline void AppendFrame(std::string& out, ResponseStatus status, const std::string& body) {
+    uint32_t length = body.size() + 1;
+    out.push_back(static_cast<char>(length >> 24));
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+    out.push_back(static_cast<char>(status));
+    out += body;
+}
+
+inline void AppendFrame(std::string& out, const std::string& body) {
+    uint32_t length = body.size();
+    out.push_back(static_cast<char>(length >> 24));
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+    out += body;
+}
+
+inline uint32_t ReadFrameLength(const char* header) {
+    auto byte = [header](int i) { return static_cast<uint32_t>(static_cast<uint8_t>(header[i])); };
+    return (byte(0) << 24) | (byte(1) << 16) | (byte(2) << 8) | byte(3);
+}
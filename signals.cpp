@@ -0,0 +1,20 @@
+#include "signals.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <thread>
+
+void HandleSignalInThread(int signal, std::function<void()> handler) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, signal);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    std::thread([set, handler = std::move(handler)]() {
+        while (true) {
+            int received;
+            if (sigwait(&set, &received) == 0) {
+                handler();
+            }
+        }
+    }).detach();
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <functional>
+
+// Runs handler on a dedicated thread every time the process gets signal, so
+// the handler may lock and allocate. The signal is blocked in the calling
+// thread and the threads it starts afterwards; call this before starting any.
+void HandleSignalInThread(int signal, std::function<void()> handler);
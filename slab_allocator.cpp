@@ -0,0 +1,216 @@
+#include "slab_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+struct PoolRegistry {
+    std::mutex mutex;
+    std::vector<SlabPool*> pools;
+};
+
+PoolRegistry& GetPoolRegistry() {
+    static PoolRegistry* registry = new PoolRegistry();
+    return *registry;
+}
+
+}  // namespace
+
+// Hands the caches of a thread back to their pools when it exits. Frees that
+// come later, from the destructors of other thread_locals, go to the pools
+// directly.
+struct SlabThreadExit {
+    bool armed = false;
+
+    ~SlabThreadExit() {
+        SlabPool::ReleaseThread();
+    }
+};
+
+static thread_local SlabThreadExit slab_thread_exit;
+
+SlabPool::SlabPool(const char* name, size_t slot_size)
+    : name_(name),
+      slot_size_(std::max(slot_size, sizeof(FreeSlot))),
+      slots_per_chunk_(kChunkSize / slot_size_),
+      max_cached_(4 * slots_per_chunk_) {
+    PoolRegistry& registry = GetPoolRegistry();
+    std::lock_guard lock(registry.mutex);
+    if (registry.pools.size() == kMaxPools) {
+        std::abort();
+    }
+    id_ = registry.pools.size();
+    registry.pools.push_back(this);
+}
+
+void* SlabPool::AllocateSlow() {
+    ThreadCache* cache = thread_caches_[id_];
+    if (!cache && !thread_exited_) {
+        cache = AttachCache();
+    }
+    if (!cache) {
+        std::lock_guard lock(mutex_);
+        if (!depot_) {
+            char* chunk = NewChunk();
+            for (size_t i = 0; i < slots_per_chunk_; ++i) {
+                auto* slot = reinterpret_cast<FreeSlot*>(chunk + i * slot_size_);
+                slot->next = depot_;
+                depot_ = slot;
+            }
+            depot_count_ += slots_per_chunk_;
+        }
+        FreeSlot* slot = depot_;
+        depot_ = slot->next;
+        --depot_count_;
+        ++orphan_allocations_;
+        return slot;
+    }
+    Refill(cache);
+    return Allocate();
+}
+
+void SlabPool::DeallocateSlow(void* ptr) {
+    ThreadCache* cache = thread_caches_[id_];
+    if (!cache && !thread_exited_) {
+        AttachCache();
+        Deallocate(ptr);
+        return;
+    }
+    auto* slot = static_cast<FreeSlot*>(ptr);
+    std::lock_guard lock(mutex_);
+    if (cache) {
+        // Keep the most recently freed half, which is likelier to be in cache.
+        size_t keep = cache->free_count / 2;
+        FreeSlot* last = cache->free_list;
+        for (size_t i = 1; i < keep; ++i) {
+            last = last->next;
+        }
+        FreeSlot* rest = last->next;
+        last->next = nullptr;
+        FreeSlot* tail = rest;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        tail->next = depot_;
+        depot_ = rest;
+        depot_count_ += cache->free_count - keep;
+        cache->free_count = keep;
+
+        slot->next = cache->free_list;
+        cache->free_list = slot;
+        ++cache->free_count;
+        Count(cache->frees);
+    } else {
+        slot->next = depot_;
+        depot_ = slot;
+        ++depot_count_;
+        ++orphan_frees_;
+    }
+}
+
+SlabPool::ThreadCache* SlabPool::AttachCache() {
+    slab_thread_exit.armed = true;
+    std::lock_guard lock(mutex_);
+    ThreadCache* cache;
+    if (!idle_caches_.empty()) {
+        cache = idle_caches_.back();
+        idle_caches_.pop_back();
+    } else {
+        cache = new ThreadCache();
+        caches_.push_back(cache);
+    }
+    thread_caches_[id_] = cache;
+    return cache;
+}
+
+// Takes up to a chunk's worth of slots from the depot, or a new chunk to carve.
+void SlabPool::Refill(ThreadCache* cache) {
+    std::lock_guard lock(mutex_);
+    if (!depot_) {
+        cache->bump = NewChunk();
+        cache->bump_end = cache->bump + slots_per_chunk_ * slot_size_;
+        return;
+    }
+    size_t taken = 0;
+    FreeSlot* last = depot_;
+    while (++taken < slots_per_chunk_ && last->next) {
+        last = last->next;
+    }
+    cache->free_list = depot_;
+    depot_ = last->next;
+    last->next = nullptr;
+    cache->free_count = taken;
+    depot_count_ -= taken;
+}
+
+void SlabPool::Release(ThreadCache* cache) {
+    std::lock_guard lock(mutex_);
+    for (char* slot = cache->bump; slot != cache->bump_end; slot += slot_size_) {
+        auto* free_slot = reinterpret_cast<FreeSlot*>(slot);
+        free_slot->next = depot_;
+        depot_ = free_slot;
+        ++depot_count_;
+    }
+    cache->bump = cache->bump_end = nullptr;
+    while (cache->free_list) {
+        FreeSlot* slot = cache->free_list;
+        cache->free_list = slot->next;
+        slot->next = depot_;
+        depot_ = slot;
+        ++depot_count_;
+    }
+    cache->free_count = 0;
+    idle_caches_.push_back(cache);
+}
+
+char* SlabPool::NewChunk() {
+    ++chunks_;
+    return static_cast<char*>(::operator new(kChunkSize, std::align_val_t{kChunkSize}));
+}
+
+void SlabPool::ReleaseThread() {
+    thread_exited_ = true;
+    PoolRegistry& registry = GetPoolRegistry();
+    std::lock_guard lock(registry.mutex);
+    for (size_t id = 0; id < registry.pools.size(); ++id) {
+        if (thread_caches_[id]) {
+            registry.pools[id]->Release(thread_caches_[id]);
+            thread_caches_[id] = nullptr;
+        }
+    }
+}
+
+SlabStats SlabPool::GetStats() const {
+    SlabStats stats;
+    stats.name = name_;
+    stats.slot_size = slot_size_;
+    std::lock_guard lock(mutex_);
+    stats.chunks = chunks_;
+    stats.capacity = chunks_ * slots_per_chunk_;
+    uint64_t allocations = orphan_allocations_;
+    uint64_t frees = orphan_frees_;
+    for (const auto* cache : caches_) {
+        allocations += cache->allocations.load(std::memory_order_relaxed);
+        frees += cache->frees.load(std::memory_order_relaxed);
+    }
+    // Frees on one thread may be read before the allocations they pair with
+    // on another.
+    stats.in_use = allocations > frees ? allocations - frees : 0;
+    return stats;
+}
+
+std::vector<SlabStats> CollectSlabStats() {
+    PoolRegistry& registry = GetPoolRegistry();
+    std::vector<SlabPool*> pools;
+    {
+        std::lock_guard lock(registry.mutex);
+        pools = registry.pools;
+    }
+    std::vector<SlabStats> stats;
+    for (const auto* pool : pools) {
+        stats.push_back(pool->GetStats());
+    }
+    return stats;
+}
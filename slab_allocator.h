@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "eval_limits.h"
+
+// Slab pools for the small objects the evaluator makes by the million: cells,
+// numbers and scopes.
+//
+// A pool hands out slots of one size carved from page-sized chunks. Every
+// thread keeps its own free list per pool, so allocating and freeing take no
+// lock and a handful of instructions. Fresh slots are carved in address order,
+// so a list built in one go lies in consecutive memory. A slot freed on another
+// thread joins that thread's list; a thread holding too many free slots hands
+// half of them back to the pool, and an exiting thread hands back all of them.
+// Chunks are never returned to the system.
+//
+// Under AddressSanitizer the pools pass every request to operator new, so
+// use-after-free is still caught.
+
+#ifdef __SANITIZE_ADDRESS__
+inline constexpr bool kSlabBypass = true;
+#else
+inline constexpr bool kSlabBypass = false;
+#endif
+
+struct SlabStats {
+    std::string name;
+    size_t slot_size = 0;
+    uint64_t chunks = 0;
+    // Slots in all chunks, and those of them holding an object.
+    uint64_t capacity = 0;
+    uint64_t in_use = 0;
+};
+
+class SlabPool {
+public:
+    static constexpr size_t kChunkSize = 4096;
+    static constexpr size_t kMaxPools = 8;
+
+    SlabPool(const char* name, size_t slot_size);
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    void* Allocate() {
+        ThreadCache* cache = thread_caches_[id_];
+        if (cache) {
+            if (cache->free_list) {
+                FreeSlot* slot = cache->free_list;
+                cache->free_list = slot->next;
+                --cache->free_count;
+                Count(cache->allocations);
+                return slot;
+            }
+            if (cache->bump != cache->bump_end) {
+                void* slot = cache->bump;
+                cache->bump += slot_size_;
+                Count(cache->allocations);
+                return slot;
+            }
+        }
+        return AllocateSlow();
+    }
+
+    void Deallocate(void* ptr) {
+        ThreadCache* cache = thread_caches_[id_];
+        if (cache && cache->free_count < max_cached_) {
+            auto* slot = static_cast<FreeSlot*>(ptr);
+            slot->next = cache->free_list;
+            cache->free_list = slot;
+            ++cache->free_count;
+            Count(cache->frees);
+            return;
+        }
+        DeallocateSlow(ptr);
+    }
+
+    SlabStats GetStats() const;
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    // Owned by one thread at a time; the counters are only read elsewhere.
+    struct ThreadCache {
+        FreeSlot* free_list = nullptr;
+        size_t free_count = 0;
+        char* bump = nullptr;
+        char* bump_end = nullptr;
+        std::atomic<uint64_t> allocations = 0;
+        std::atomic<uint64_t> frees = 0;
+    };
+
+    friend struct SlabThreadExit;
+
+    static void Count(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void* AllocateSlow();
+    void DeallocateSlow(void* ptr);
+    ThreadCache* AttachCache();
+    void Refill(ThreadCache* cache);
+    void Release(ThreadCache* cache);
+    char* NewChunk();
+    static void ReleaseThread();
+
+    size_t id_;
+    std::string name_;
+    size_t slot_size_;
+    size_t slots_per_chunk_;
+    size_t max_cached_;
+
+    mutable std::mutex mutex_;
+    // Slots handed back by threads, shared by all of them.
+    FreeSlot* depot_ = nullptr;
+    size_t depot_count_ = 0;
+    uint64_t chunks_ = 0;
+    // Allocations and frees of threads that already released their caches.
+    uint64_t orphan_allocations_ = 0;
+    uint64_t orphan_frees_ = 0;
+    std::vector<ThreadCache*> caches_;
+    std::vector<ThreadCache*> idle_caches_;
+
+    static inline thread_local ThreadCache* thread_caches_[kMaxPools] = {};
+    static inline thread_local bool thread_exited_ = false;
+};
+
+std::vector<SlabStats> CollectSlabStats();
+
+// An allocator for std::allocate_shared that takes single objects from the
+// slab pool of Tag, which names it with `static constexpr const char*
+// kSlabName`. Rebinding keeps the tag, so the control block and the object
+// share one slot.
+template <class T, class Tag = T>
+class SlabAllocator {
+public:
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = SlabAllocator<U, Tag>;
+    };
+
+    SlabAllocator() = default;
+
+    template <class U>
+    SlabAllocator(const SlabAllocator<U, Tag>&) {
+    }
+
+    T* allocate(size_t n) {
+        ChargeHeap(n * sizeof(T));
+        if (kSlabBypass || n != 1) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(Pool().Allocate());
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        CreditHeap(n * sizeof(T));
+        if (kSlabBypass || n != 1) {
+            ::operator delete(ptr);
+            return;
+        }
+        Pool().Deallocate(ptr);
+    }
+
+    bool operator==(const SlabAllocator&) const {
+        return true;
+    }
+
+private:
+    static_assert(alignof(T) <= alignof(std::max_align_t));
+
+    // Leaked, so objects freed during static destruction still find it.
+    static SlabPool& Pool() {
+        static SlabPool* pool = new SlabPool(Tag::kSlabName, sizeof(T));
+        return *pool;
+    }
+};
+
+// std::make_shared for a type that has a slab pool.
+template <class T, class... Args>
+std::shared_ptr<T> MakeSlabShared(Args&&... args) {
+    return std::allocate_shared<T>(SlabAllocator<T>(), std::forward<Args>(args)...);
+}
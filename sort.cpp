@@ -0,0 +1,189 @@
+#include "sort.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "packed_list.h"
+#include "parallel.h"
+
+namespace {
+
+// Runs body(begin, end) over [0, count), on the pool when parallel.
+void ForRange(size_t count, bool parallel, const std::function<void(size_t, size_t)>& body) {
+    if (parallel && count > 1) {
+        ThreadPool::Instance().ParallelFor(count, body);
+    } else {
+        body(0, count);
+    }
+}
+
+// A guarded insertion sort: less? may be inconsistent, so nothing relies on
+// it to stop a scan before the start of the run.
+template <class T, class Less>
+void InsertionSort(T* first, T* last, const Less& less) {
+    for (T* i = first + 1; i < last; ++i) {
+        T value = *i;
+        T* j = i;
+        while (j > first && less(value, *(j - 1))) {
+            *j = *(j - 1);
+            --j;
+        }
+        *j = value;
+    }
+}
+
+// Stable: on a tie the element of the left run goes first.
+template <class T, class Less>
+void Merge(const T* first, const T* middle, const T* last, T* out, const Less& less) {
+    const T* left = first;
+    const T* right = middle;
+    while (left < middle && right < last) {
+        *out++ = less(*right, *left) ? *right++ : *left++;
+    }
+    out = std::copy(left, middle, out);
+    std::copy(right, last, out);
+}
+
+// Sorts each run of *items with sort_run, then merges runs pairwise until one
+// is left.
+template <class T, class Less, class SortRun>
+void MergeSort(std::vector<T>* items, size_t run, bool parallel, const Less& less,
+               const SortRun& sort_run) {
+    size_t size = items->size();
+    T* data = items->data();
+    ForRange((size + run - 1) / run, parallel, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sort_run(data + i * run, data + std::min(size, (i + 1) * run));
+        }
+    });
+    if (run >= size) {
+        return;
+    }
+    std::vector<T> buffer(size);
+    T* from = data;
+    T* to = buffer.data();
+    for (size_t width = run; width < size; width *= 2) {
+        ForRange((size + 2 * width - 1) / (2 * width), parallel, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                size_t first = i * 2 * width;
+                size_t middle = std::min(size, first + width);
+                size_t last = std::min(size, first + 2 * width);
+                Merge(from + first, from + middle, from + last, to + first, less);
+            }
+        });
+        std::swap(from, to);
+    }
+    if (from != data) {
+        items->swap(buffer);
+    }
+}
+
+// Sorts keys by their high 32 bits, a byte at a time from the lowest; each
+// pass is stable, so keys with the same high half keep their order. A byte
+// that is the same in every key is skipped.
+void RadixSort(uint64_t* first, uint64_t* last) {
+    size_t size = last - first;
+    if (size < 256) {
+        std::sort(first, last);
+        return;
+    }
+    std::vector<uint64_t> buffer(size);
+    uint64_t* from = first;
+    uint64_t* to = buffer.data();
+    for (int shift = 32; shift < 64; shift += 8) {
+        size_t counts[256] = {};
+        for (size_t i = 0; i < size; ++i) {
+            ++counts[(from[i] >> shift) & 0xff];
+        }
+        if (counts[(from[0] >> shift) & 0xff] == size) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            offset += std::exchange(count, offset);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            to[counts[(from[i] >> shift) & 0xff]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+    if (from != first) {
+        std::copy(from, from + size, first);
+    }
+}
+
+// The order of the numbers of items under the builtin < or >, found by sorting
+// keys of value and position; false if an item isn't a number.
+bool SortNumbers(const ObjectVectorBase& items, bool descending, bool parallel,
+                 std::vector<uint64_t>* keys) {
+    if (items.size() > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    keys->reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto number = dynamic_cast<const Number*>(items[i].get());
+        if (!number) {
+            return false;
+        }
+        // Biased, so unsigned order is numeric order; the position in the low
+        // half makes equal values keep theirs.
+        uint32_t value = static_cast<uint32_t>(number->GetValue()) ^ 0x80000000u;
+        if (descending) {
+            value = ~value;
+        }
+        keys->push_back(uint64_t{value} << 32 | i);
+    }
+    MergeSort(keys, parallel ? kParallelSortLength / 2 : keys->size(), parallel,
+              std::less<uint64_t>(), RadixSort);
+    return true;
+}
+
+}  // namespace
+
+std::shared_ptr<Object> SortList(const std::shared_ptr<Object>& list,
+                                 const std::shared_ptr<FunctionWrapper>& less,
+                                 const std::shared_ptr<Scope>& scope, bool in_place) {
+    ObjectVectorBase items = ListElements(list);
+    if (items.empty()) {
+        return list;
+    }
+    bool parallel =
+        items.size() >= kParallelSortLength && ThreadPool::Instance().GetWorkerCount() > 1;
+    ObjectVectorBase sorted;
+    sorted.reserve(items.size());
+
+    auto builtin = std::dynamic_pointer_cast<Function>(less);
+    std::vector<uint64_t> keys;
+    if (builtin && (builtin->GetName() == "<" || builtin->GetName() == ">") &&
+        SortNumbers(items, builtin->GetName() == ">", parallel, &keys)) {
+        // Moved rather than copied: the items are this call's own, and a copy
+        // would touch the count of every element in sorted order.
+        for (uint64_t key : keys) {
+            sorted.push_back(std::move(items[static_cast<uint32_t>(key)]));
+        }
+    } else {
+        std::vector<size_t> order(items.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        auto before = [&](size_t lhs, size_t rhs) {
+            std::shared_ptr<Object> result = ApplyToValues(less, {items[lhs], items[rhs]}, scope);
+            return !result || *result;
+        };
+        // less? may be any procedure, with state of its own, so it is only
+        // called on this thread.
+        MergeSort(&order, kSortRunLength, false, before,
+                  [&before](size_t* first, size_t* last) { InsertionSort(first, last, before); });
+        for (size_t index : order) {
+            sorted.push_back(std::move(items[index]));
+        }
+    }
+
+    if (!in_place) {
+        return MakePackedList(std::move(sorted));
+    }
+    StoreListElements(list, sorted);
+    return list;
+}
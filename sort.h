@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include "object.h"
+
+// Sorting.
+//
+// (sort list less?) returns a new list of the elements of list in the order
+// less? puts them; (sort! list less?) stores them in that order in the pairs
+// of list itself and returns it. Both are stable. The elements are copied
+// into one array and merge sorted there: runs of kSortRunLength elements are
+// insertion sorted, then merged pairwise into a second array and back, each
+// pass reading both arrays from front to back. less? is only ever called on
+// the calling thread.
+//
+// When less? is the builtin < or > and every element is a number, the
+// elements are not compared through less?: each becomes a 64-bit key of its
+// value and position, and the keys are radix sorted as plain integers. From
+// kParallelSortLength keys on, when the pool has more than one worker, the
+// runs and the merges of each pass are spread over it.
+
+inline constexpr size_t kSortRunLength = 16;
+inline constexpr size_t kParallelSortLength = 1 << 15;
+
+std::shared_ptr<Object> SortList(const std::shared_ptr<Object>& list,
+                                 const std::shared_ptr<FunctionWrapper>& less,
+                                 const std::shared_ptr<Scope>& scope, bool in_place);
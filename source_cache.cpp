@@ -0,0 +1,432 @@
+#include "source_cache.h"
+
+#include <unistd.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include "expander.h"
+#include "mapped_file.h"
+#include "packed_list.h"
+#include "parallel.h"
+#include "parser.h"
+#include "quicken.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'C', 'M', 'S', 'R', 'C', '0', '3'};
+
+enum class Tag : uint8_t {
+    NIL = 1,
+    NUMBER,
+    TRUE,
+    FALSE,
+    SYMBOL,
+    STRING,
+    // Followed by a count n: pops the tail and the n elements before it and
+    // pushes the list of them.
+    LIST,
+    // Followed by a count n: pops n elements and pushes a packed proper list
+    // of them.
+    PACKED,
+};
+
+template <class T>
+void Put(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+class FormsWriter {
+public:
+    std::string Write(const std::vector<std::shared_ptr<Object>>& forms, uint64_t hash) {
+        // Each entry is either an object to encode or, with a non-zero length,
+        // the LIST or PACKED record that closes a list.
+        struct Entry {
+            std::shared_ptr<Object> obj;
+            uint32_t length = 0;
+            Tag closing = Tag::LIST;
+        };
+        std::vector<Entry> stack;
+        for (auto iter = forms.rbegin(); iter != forms.rend(); ++iter) {
+            stack.push_back({*iter});
+        }
+        ObjectVectorBase elements;
+        while (!stack.empty()) {
+            Entry entry = std::move(stack.back());
+            stack.pop_back();
+            if (entry.length != 0) {
+                records_.push_back(static_cast<char>(entry.closing));
+                Put<uint32_t>(records_, entry.length);
+                continue;
+            }
+            Object* obj = entry.obj.get();
+            if (!obj) {
+                records_.push_back(static_cast<char>(Tag::NIL));
+            } else if (Is<Cell>(entry.obj)) {
+                // Packed cdrs are made on demand, so the walk holds them.
+                elements.clear();
+                std::shared_ptr<Object> tail = entry.obj;
+                while (Is<Cell>(tail)) {
+                    auto cell = As<Cell>(tail);
+                    elements.push_back(cell->GetFirst());
+                    tail = cell->GetSecond();
+                }
+                auto length = static_cast<uint32_t>(elements.size());
+                if (Is<PackedCell>(entry.obj) && !tail) {
+                    stack.push_back({nullptr, length, Tag::PACKED});
+                } else {
+                    stack.push_back({nullptr, length, Tag::LIST});
+                    stack.push_back({tail});
+                }
+                for (auto iter = elements.rbegin(); iter != elements.rend(); ++iter) {
+                    stack.push_back({*iter});
+                }
+            } else if (auto number = dynamic_cast<Number*>(obj)) {
+                records_.push_back(static_cast<char>(Tag::NUMBER));
+                Put<int32_t>(records_, number->GetValue());
+            } else if (dynamic_cast<Bool*>(obj)) {
+                records_.push_back(static_cast<char>(*obj ? Tag::TRUE : Tag::FALSE));
+            } else if (auto symbol = dynamic_cast<Symbol*>(obj)) {
+                records_.push_back(static_cast<char>(Tag::SYMBOL));
+                Put<uint32_t>(records_, StringId(symbol->GetName()));
+            } else if (auto string = dynamic_cast<String*>(obj)) {
+                records_.push_back(static_cast<char>(Tag::STRING));
+                Put<uint32_t>(records_, StringId(string->GetValue()));
+            } else {
+                throw RuntimeError(" ");
+            }
+        }
+
+        std::string out(kMagic, sizeof(kMagic));
+        Put<uint64_t>(out, hash);
+        Put<uint32_t>(out, strings_.size());
+        for (const auto& s : strings_) {
+            Put<uint32_t>(out, s.size());
+            out += s;
+        }
+        Put<uint32_t>(out, forms.size());
+        out += records_;
+        return out;
+    }
+
+private:
+    uint32_t StringId(const std::string& s) {
+        auto [iter, inserted] = string_ids_.insert({s, strings_.size()});
+        if (inserted) {
+            strings_.push_back(s);
+        }
+        return iter->second;
+    }
+
+    std::unordered_map<std::string, uint32_t> string_ids_;
+    std::vector<std::string> strings_;
+    std::string records_;
+};
+
+class FormsReader {
+public:
+    FormsReader(const char* data, size_t size) : data_(data), size_(size), pos_(0) {
+    }
+
+    std::vector<std::shared_ptr<Object>> Read(uint64_t hash) {
+        Need(sizeof(kMagic));
+        if (std::memcmp(data_, kMagic, sizeof(kMagic)) != 0) {
+            throw RuntimeError(" ");
+        }
+        pos_ = sizeof(kMagic);
+        if (Get<uint64_t>() != hash) {
+            throw RuntimeError(" ");
+        }
+        uint32_t string_count = Get<uint32_t>();
+        std::vector<std::string> strings;
+        strings.reserve(string_count);
+        for (uint32_t i = 0; i < string_count; ++i) {
+            uint32_t length = Get<uint32_t>();
+            Need(length);
+            strings.emplace_back(data_ + pos_, length);
+            pos_ += length;
+        }
+        uint32_t form_count = Get<uint32_t>();
+
+        std::vector<std::shared_ptr<Object>> stack;
+        while (pos_ < size_) {
+            auto tag = static_cast<Tag>(data_[pos_++]);
+            switch (tag) {
+                case Tag::NIL:
+                    stack.push_back(nullptr);
+                    break;
+                case Tag::NUMBER:
+                    stack.push_back(MakeSlabShared<Number>(Get<int32_t>()));
+                    break;
+                case Tag::TRUE:
+                case Tag::FALSE:
+                    stack.push_back(std::make_shared<Bool>(tag == Tag::TRUE));
+                    break;
+                case Tag::SYMBOL:
+                case Tag::STRING: {
+                    uint32_t id = Get<uint32_t>();
+                    if (id >= strings.size()) {
+                        throw RuntimeError(" ");
+                    }
+                    if (tag == Tag::SYMBOL) {
+                        stack.push_back(std::make_shared<Symbol>(strings[id]));
+                    } else {
+                        stack.push_back(std::make_shared<String>(strings[id]));
+                    }
+                    break;
+                }
+                case Tag::LIST: {
+                    uint32_t length = Get<uint32_t>();
+                    if (stack.size() <= length) {
+                        throw RuntimeError(" ");
+                    }
+                    std::shared_ptr<Object> list = std::move(stack.back());
+                    stack.pop_back();
+                    for (uint32_t i = 0; i < length; ++i) {
+                        auto cell = MakeSlabShared<Cell>();
+                        cell->SetFirst(std::move(stack.back()));
+                        cell->SetSecond(std::move(list));
+                        stack.pop_back();
+                        list = std::move(cell);
+                    }
+                    stack.push_back(std::move(list));
+                    break;
+                }
+                case Tag::PACKED: {
+                    uint32_t length = Get<uint32_t>();
+                    if (stack.size() < length) {
+                        throw RuntimeError(" ");
+                    }
+                    ObjectVectorBase items(std::make_move_iterator(stack.end() - length),
+                                           std::make_move_iterator(stack.end()));
+                    stack.resize(stack.size() - length);
+                    stack.push_back(MakePackedList(std::move(items)));
+                    break;
+                }
+                default:
+                    throw RuntimeError(" ");
+            }
+        }
+        if (stack.size() != form_count) {
+            throw RuntimeError(" ");
+        }
+        return stack;
+    }
+
+private:
+    void Need(size_t bytes) {
+        if (size_ - pos_ < bytes) {
+            throw RuntimeError(" ");
+        }
+    }
+
+    template <class T>
+    T Get() {
+        Need(sizeof(T));
+        T value;
+        std::memcpy(&value, data_ + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+};
+
+std::string CacheDirectory() {
+    if (const char* dir = std::getenv("SCHEME_CACHE_DIR")) {
+        return dir;
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/scheme";
+    }
+    return "";
+}
+
+std::string CachePath(const std::string& directory, uint64_t hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.scmc", static_cast<unsigned long long>(hash));
+    return directory + "/" + name;
+}
+
+// Written under a temporary name and renamed, so concurrent readers never see
+// half a file.
+void StoreCache(const std::string& directory, const std::string& path,
+                const std::string& encoded) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out.write(encoded.data(), encoded.size())) {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+    }
+}
+
+std::vector<std::shared_ptr<Object>> ParseRange(std::string_view text) {
+    Tokenizer tokenizer{text};
+    std::vector<std::shared_ptr<Object>> forms = ReadAll(&tokenizer);
+    for (auto& form : forms) {
+        form = Expand(form);
+    }
+    return forms;
+}
+
+}  // namespace
+
+std::vector<std::pair<size_t, size_t>> SplitTopLevelForms(std::string_view source) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t depth = 0;
+    size_t start = 0;
+    bool in_form = false;
+    // A quote at the top level belongs to the datum after it.
+    bool quoted = false;
+    auto close_form = [&](size_t end) {
+        if (in_form && depth == 0 && !quoted) {
+            ranges.emplace_back(start, end);
+            in_form = false;
+        }
+    };
+    for (size_t i = 0; i < source.size(); ++i) {
+        char c = source[i];
+        if (c == ';') {
+            close_form(i);
+            while (i < source.size() && source[i] != '\n') {
+                ++i;
+            }
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            close_form(i);
+            continue;
+        }
+        if (!in_form) {
+            in_form = true;
+            start = i;
+        }
+        if (c == '\'') {
+            quoted = depth == 0 ? true : quoted;
+            continue;
+        }
+        if (depth == 0) {
+            quoted = false;
+        }
+        if (c == '"') {
+            for (++i; i < source.size() && source[i] != '"'; ++i) {
+                if (source[i] == '\\') {
+                    ++i;
+                }
+            }
+            if (i >= source.size()) {
+                return {};
+            }
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            if (depth == 0) {
+                return {};
+            }
+            if (--depth == 0) {
+                close_form(i + 1);
+            }
+        }
+    }
+    if (depth != 0 || quoted) {
+        return {};
+    }
+    close_form(source.size());
+    return ranges;
+}
+
+std::vector<std::shared_ptr<Object>> ParseSource(std::string_view source) {
+    ThreadPool& pool = ThreadPool::Instance();
+    std::vector<std::pair<size_t, size_t>> ranges;
+    if (source.size() >= kParallelParseBytes && pool.GetWorkerCount() > 1) {
+        ranges = SplitTopLevelForms(source);
+    }
+    if (ranges.size() < 2) {
+        // Small, or malformed: the sequential reader reports the error.
+        return ParseRange(source);
+    }
+    // Every chunk of consecutive forms is read by one tokenizer; its forms are
+    // kept under the index of its first range.
+    std::vector<std::vector<std::shared_ptr<Object>>> pieces(ranges.size());
+    pool.ParallelFor(ranges.size(), [&](size_t begin, size_t end) {
+        size_t from = ranges[begin].first;
+        pieces[begin] = ParseRange(source.substr(from, ranges[end - 1].second - from));
+    });
+    std::vector<std::shared_ptr<Object>> forms;
+    for (auto& piece : pieces) {
+        for (auto& form : piece) {
+            forms.push_back(std::move(form));
+        }
+    }
+    return forms;
+}
+
+uint64_t HashSource(const std::string& source) {
+    // 64-bit FNV-1a.
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : source) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string EncodeForms(const std::vector<std::shared_ptr<Object>>& forms, uint64_t hash) {
+    return FormsWriter().Write(forms, hash);
+}
+
+std::vector<std::shared_ptr<Object>> DecodeForms(const char* data, size_t size, uint64_t hash) {
+    return FormsReader(data, size).Read(hash);
+}
+
+namespace {
+
+std::vector<std::shared_ptr<Object>> QuickenAll(std::vector<std::shared_ptr<Object>> forms) {
+    for (auto& form : forms) {
+        form = Quicken(form);
+    }
+    return forms;
+}
+
+}  // namespace
+
+// The cache keeps the expanded forms; call sites are made after decoding.
+std::vector<std::shared_ptr<Object>> ReadSourceFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw RuntimeError(" ");
+    }
+    std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t hash = HashSource(source);
+
+    std::string directory = CacheDirectory();
+    std::string cache_path = directory.empty() ? "" : CachePath(directory, hash);
+    if (!cache_path.empty() && access(cache_path.c_str(), R_OK) == 0) {
+        try {
+            MappedFile cache(cache_path);
+            return QuickenAll(DecodeForms(cache.Data(), cache.Size(), hash));
+        } catch (RuntimeError&) {
+            // A damaged or foreign cache file: parse again and replace it.
+        }
+    }
+
+    std::vector<std::shared_ptr<Object>> forms = ParseSource(source);
+    if (!cache_path.empty()) {
+        StoreCache(directory, cache_path, EncodeForms(forms, hash));
+    }
+    return QuickenAll(std::move(forms));
+}
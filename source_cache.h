@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "object.h"
+
+// Pre-parsed source files.
+//
+// ReadSourceFile returns the expressions of a file, with derived forms already
+// expanded. The first read parses and expands the text and stores the resulting
+// trees in a cache file named after a hash of the contents; any later read of
+// the same contents decodes that file instead of running the tokenizer, the
+// parser and the expander. The cache lives in $SCHEME_CACHE_DIR,
+// or in ~/.cache/scheme when that isn't set; an empty SCHEME_CACHE_DIR turns it
+// off. A cache that can't be read or written is ignored.
+
+std::vector<std::shared_ptr<Object>> ReadSourceFile(const std::string& path);
+
+// Reads and expands every form of source. A source of at least
+// kParallelParseBytes is first split into its top-level forms, which are then
+// tokenized and parsed on the thread pool; the forms come back in source order.
+std::vector<std::shared_ptr<Object>> ParseSource(std::string_view source);
+
+inline constexpr size_t kParallelParseBytes = 64 * 1024;
+
+// The byte ranges of the top-level forms of source, found by tracking bracket
+// depth and skipping strings and comments without tokenizing. Empty if the
+// brackets or strings don't balance.
+std::vector<std::pair<size_t, size_t>> SplitTopLevelForms(std::string_view source);
+
+// The encoding itself: the trees in postorder, so decoding is one pass over the
+// bytes with an explicit stack and takes no native stack however long or deep
+// a literal is.
+std::string EncodeForms(const std::vector<std::shared_ptr<Object>>& forms, uint64_t hash);
+
+std::vector<std::shared_ptr<Object>> DecodeForms(const char* data, size_t size, uint64_t hash);
+
+uint64_t HashSource(const std::string& source);
@@ -3,5 +3,10 @@ add_library(scheme_libs
         parser.cpp
         scheme.cpp
         # maybe more .cpp files here
-        functions.cpp object.cpp obj_fwd.h)
+        functions.cpp object.cpp obj_fwd.h
+        parallel.cpp coroutine.cpp image.cpp source_cache.cpp
+        profiler.cpp runtime_stats.cpp signals.cpp tracer.cpp memo.cpp
+        expander.cpp slab_allocator.cpp packed_list.cpp structural_index.cpp
+        stream.cpp ports.cpp quicken.cpp eval_limits.cpp library.cpp
+        environment.cpp sort.cpp closure.cpp)
 
@@ -0,0 +1,118 @@
+#include "stream.h"
+
+#include "packed_list.h"
+
+std::shared_ptr<Promise> Promise::MakeForced(std::shared_ptr<Object> value) {
+    auto promise = std::make_shared<Promise>(nullptr);
+    promise->forced_ = true;
+    promise->value_ = std::move(value);
+    return promise;
+}
+
+// A forced stream is a chain pair -> promise -> pair -> ...; it is unlinked
+// here, so freeing a long one doesn't recurse once per element.
+Promise::~Promise() {
+    std::shared_ptr<Object> next = std::move(value_);
+    while (next && next.use_count() == 1) {
+        auto pair = std::dynamic_pointer_cast<Cell>(next);
+        if (!pair) {
+            break;
+        }
+        auto promise = std::dynamic_pointer_cast<Promise>(pair->GetSecond());
+        // Owned by the pair and by this reference alone.
+        if (!promise || promise.use_count() != 2) {
+            break;
+        }
+        next = std::move(promise->value_);
+    }
+}
+
+std::shared_ptr<Object> Promise::Force() {
+    Producer producer;
+    {
+        std::lock_guard lock(mutex_);
+        if (forced_) {
+            return value_;
+        }
+        producer = producer_;
+    }
+    std::shared_ptr<Object> value = producer();
+    std::lock_guard lock(mutex_);
+    if (!forced_) {
+        forced_ = true;
+        value_ = std::move(value);
+        producer_ = nullptr;
+    }
+    return value_;
+}
+
+std::shared_ptr<Object> ForceValue(const std::shared_ptr<Object>& obj) {
+    if (Is<Promise>(obj)) {
+        return As<Promise>(obj)->Force();
+    }
+    return obj;
+}
+
+std::shared_ptr<Object> MakeStreamPair(std::shared_ptr<Object> first, Promise::Producer rest) {
+    auto pair = MakeSlabShared<Cell>();
+    pair->SetFirst(std::move(first));
+    pair->SetSecond(std::make_shared<Promise>(std::move(rest)));
+    return pair;
+}
+
+std::shared_ptr<Object> StreamCar(const std::shared_ptr<Object>& stream) {
+    return As<Cell>(stream)->GetFirst();
+}
+
+std::shared_ptr<Object> StreamCdr(const std::shared_ptr<Object>& stream) {
+    return As<Promise>(As<Cell>(stream)->GetSecond())->Force();
+}
+
+std::shared_ptr<Object> StreamMap(std::shared_ptr<FunctionWrapper> func,
+                                  std::shared_ptr<Object> stream, std::shared_ptr<Scope> scope) {
+    if (!stream) {
+        return nullptr;
+    }
+    std::shared_ptr<Object> value = ApplyToValues(func, {StreamCar(stream)}, scope);
+    return MakeStreamPair(value, [func, stream, scope]() {
+        return StreamMap(func, StreamCdr(stream), scope);
+    });
+}
+
+std::shared_ptr<Object> StreamFilter(std::shared_ptr<FunctionWrapper> pred,
+                                     std::shared_ptr<Object> stream, std::shared_ptr<Scope> scope) {
+    // Forces up to the next match; the elements skipped are dropped as it goes.
+    while (stream) {
+        std::shared_ptr<Object> value = StreamCar(stream);
+        std::shared_ptr<Object> keep = ApplyToValues(pred, {value}, scope);
+        if (!keep || *keep) {
+            return MakeStreamPair(value, [pred, stream, scope]() {
+                return StreamFilter(pred, StreamCdr(stream), scope);
+            });
+        }
+        stream = StreamCdr(stream);
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object> StreamTake(std::shared_ptr<Object> stream, size_t count) {
+    ObjectVectorBase items;
+    while (stream && items.size() < count) {
+        items.push_back(StreamCar(stream));
+        // The rest is only forced if another element is wanted.
+        if (items.size() < count) {
+            stream = StreamCdr(stream);
+        }
+    }
+    return MakePackedList(std::move(items));
+}
+
+std::shared_ptr<Object> StreamRef(std::shared_ptr<Object> stream, size_t index) {
+    for (; index > 0; --index) {
+        stream = StreamCdr(stream);
+    }
+    if (!stream) {
+        throw RuntimeError(" ");
+    }
+    return StreamCar(stream);
+}
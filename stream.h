@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "object.h"
+
+// Promises and lazy streams.
+//
+// A promise holds a computation that runs the first time it is forced; later
+// forces return the same value. `delay` makes one from an expression, the
+// stream combinators from a native step. Once forced, a promise drops its
+// computation and with it the scope or stream it captured.
+//
+// A stream is '() or a pair whose cdr is a promise of the rest of the stream,
+// as made by `cons-stream`. The combinators take one element at a time and
+// hold no reference to the part of their input already consumed, so memory
+// grows with what is forced, not with the length of the input.
+class Promise : public Object {
+public:
+    using Producer = std::function<std::shared_ptr<Object>()>;
+
+    explicit Promise(Producer producer) : producer_(std::move(producer)), forced_(false) {
+    }
+
+    ~Promise() override;
+
+    // An already forced promise.
+    static std::shared_ptr<Promise> MakeForced(std::shared_ptr<Object> value);
+
+    std::string Serialize() override {
+        return "";
+    }
+
+    std::shared_ptr<Object> Evaluate(std::shared_ptr<Scope> scope = nullptr) override {
+        return shared_from_this();
+    }
+
+    // Forcing happens outside the lock, so a promise that forces itself
+    // doesn't deadlock; if two threads force it at once, the first value
+    // stored wins.
+    std::shared_ptr<Object> Force();
+
+private:
+    std::mutex mutex_;
+    Producer producer_;
+    bool forced_;
+    std::shared_ptr<Object> value_;
+};
+
+// The value of a promise, or obj itself if it isn't one.
+std::shared_ptr<Object> ForceValue(const std::shared_ptr<Object>& obj);
+
+// The pair (first . promise), the promise producing the rest of the stream.
+std::shared_ptr<Object> MakeStreamPair(std::shared_ptr<Object> first, Promise::Producer rest);
+
+std::shared_ptr<Object> StreamCar(const std::shared_ptr<Object>& stream);
+std::shared_ptr<Object> StreamCdr(const std::shared_ptr<Object>& stream);
+
+std::shared_ptr<Object> StreamMap(std::shared_ptr<FunctionWrapper> func,
+                                  std::shared_ptr<Object> stream, std::shared_ptr<Scope> scope);
+std::shared_ptr<Object> StreamFilter(std::shared_ptr<FunctionWrapper> pred,
+                                     std::shared_ptr<Object> stream, std::shared_ptr<Scope> scope);
+// The list of the first count elements, or of all of them if there are fewer.
+std::shared_ptr<Object> StreamTake(std::shared_ptr<Object> stream, size_t count);
+std::shared_ptr<Object> StreamRef(std::shared_ptr<Object> stream, size_t index);
@@ -0,0 +1,195 @@
+#include "structural_index.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t kBlockSize = 64;
+
+enum ByteClass : uint8_t {
+    OPEN = 1,
+    CLOSE = 2,
+    QUOTE = 4,
+    DOT = 8,
+    WHITESPACE = 16,
+    DOUBLE_QUOTE = 32,
+    BACKSLASH = 64,
+};
+
+constexpr uint8_t kBoundary = OPEN | CLOSE | QUOTE | DOT | WHITESPACE | DOUBLE_QUOTE;
+
+constexpr std::array<uint8_t, 256> MakeClassTable() {
+    std::array<uint8_t, 256> table{};
+    table['('] = OPEN;
+    table[')'] = CLOSE;
+    table['\''] = QUOTE;
+    table['.'] = DOT;
+    table['"'] = DOUBLE_QUOTE;
+    table['\\'] = BACKSLASH;
+    // The characters std::isspace accepts.
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        table[static_cast<uint8_t>(c)] = WHITESPACE;
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> kClassTable = MakeClassTable();
+
+// Per-byte masks before token starts are derived.
+struct RawMasks {
+    uint64_t open;
+    uint64_t close;
+    uint64_t quote;
+    uint64_t dot;
+    uint64_t whitespace;
+    uint64_t double_quote;
+    uint64_t backslash;
+};
+
+RawMasks ClassifyScalar(const char* block) {
+    RawMasks masks{};
+    for (size_t i = 0; i < kBlockSize; ++i) {
+        uint8_t byte_class = kClassTable[static_cast<uint8_t>(block[i])];
+        uint64_t bit = uint64_t{1} << i;
+        masks.open |= byte_class & OPEN ? bit : 0;
+        masks.close |= byte_class & CLOSE ? bit : 0;
+        masks.quote |= byte_class & QUOTE ? bit : 0;
+        masks.dot |= byte_class & DOT ? bit : 0;
+        masks.whitespace |= byte_class & WHITESPACE ? bit : 0;
+        masks.double_quote |= byte_class & DOUBLE_QUOTE ? bit : 0;
+        masks.backslash |= byte_class & BACKSLASH ? bit : 0;
+    }
+    return masks;
+}
+
+#if defined(__x86_64__)
+
+RawMasks ClassifySse2(const char* block) {
+    RawMasks masks{};
+    for (size_t i = 0; i < kBlockSize; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        auto bits = [&](char c) -> uint64_t {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+            return static_cast<uint64_t>(static_cast<uint16_t>(mask)) << i;
+        };
+        masks.open |= bits('(');
+        masks.close |= bits(')');
+        masks.quote |= bits('\'');
+        masks.dot |= bits('.');
+        masks.double_quote |= bits('"');
+        masks.backslash |= bits('\\');
+        // '\t' to '\r' are 9 to 13: after subtracting 9 they are the bytes
+        // that an unsigned min with 4 leaves unchanged.
+        __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(9));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+        int whitespace = _mm_movemask_epi8(_mm_or_si128(control, space));
+        masks.whitespace |= static_cast<uint64_t>(static_cast<uint16_t>(whitespace)) << i;
+    }
+    return masks;
+}
+
+__attribute__((target("avx2"))) RawMasks ClassifyAvx2(const char* block) {
+    RawMasks masks{};
+    for (size_t i = 0; i < kBlockSize; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        auto bits = [&](char c) __attribute__((target("avx2"))) -> uint64_t {
+            int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)));
+            return static_cast<uint64_t>(static_cast<uint32_t>(mask)) << i;
+        };
+        masks.open |= bits('(');
+        masks.close |= bits(')');
+        masks.quote |= bits('\'');
+        masks.dot |= bits('.');
+        masks.double_quote |= bits('"');
+        masks.backslash |= bits('\\');
+        __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(9));
+        __m256i control =
+            _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        __m256i space = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+        int whitespace = _mm256_movemask_epi8(_mm256_or_si256(control, space));
+        masks.whitespace |= static_cast<uint64_t>(static_cast<uint32_t>(whitespace)) << i;
+    }
+    return masks;
+}
+
+#endif
+
+SimdLevel DetectSimdLevel() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+RawMasks ClassifyRaw(SimdLevel level, const char* block) {
+#if defined(__x86_64__)
+    if (level == SimdLevel::AVX2) {
+        return ClassifyAvx2(block);
+    }
+    if (level == SimdLevel::SSE2) {
+        return ClassifySse2(block);
+    }
+#endif
+    return ClassifyScalar(block);
+}
+
+}  // namespace
+
+SimdLevel GetSimdLevel() {
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+const char* GetSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+StructuralMasks ClassifyBlock(const char* data, size_t size, size_t offset) {
+    return ClassifyBlock(GetSimdLevel(), data, size, offset);
+}
+
+StructuralMasks ClassifyBlock(SimdLevel level, const char* data, size_t size, size_t offset) {
+    const char* block = data + offset;
+    char padded[kBlockSize];
+    if (size - offset < kBlockSize) {
+        std::memset(padded, ' ', kBlockSize);
+        std::memcpy(padded, block, size - offset);
+        block = padded;
+    }
+    RawMasks raw = ClassifyRaw(level, block);
+
+    StructuralMasks masks;
+    masks.open = raw.open;
+    masks.close = raw.close;
+    masks.quote = raw.quote;
+    masks.dot = raw.dot;
+    masks.whitespace = raw.whitespace;
+    masks.double_quote = raw.double_quote;
+    masks.backslash = raw.backslash;
+    uint64_t delimiters = raw.open | raw.close | raw.quote | raw.dot | raw.double_quote;
+    masks.boundary = delimiters | raw.whitespace;
+    // Whether the byte before the block ends a token, as the start of the
+    // source does.
+    uint64_t carry = offset == 0 || kClassTable[static_cast<uint8_t>(data[offset - 1])] & kBoundary;
+    uint64_t after_boundary = ((delimiters | raw.whitespace) << 1) | carry;
+    masks.token_start = (delimiters | after_boundary) & ~raw.whitespace;
+    return masks;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The first stage of the tokenizer: classifies 64 bytes of source at a time
+// into bitmasks, bit i standing for byte i of the block. The tokenizer jumps
+// over whitespace to the next set bit of token_start, to the end of an atom at
+// the next bit of boundary, and through a string to the next double quote or
+// backslash, instead of testing the bytes one by one.
+//
+// A token starts at every bracket, quote, dot and double quote, and at every
+// other non-whitespace byte that follows whitespace or one of those. Strings
+// and comments aren't recognized here: the tokenizer skips them itself and
+// ignores the bits inside.
+//
+// x86-64 builds classify with AVX2 when the CPU has it and with SSE2, which
+// every x86-64 CPU has, otherwise; other targets use a lookup table.
+
+struct StructuralMasks {
+    uint64_t open = 0;
+    uint64_t close = 0;
+    uint64_t quote = 0;
+    uint64_t dot = 0;
+    uint64_t whitespace = 0;
+    uint64_t double_quote = 0;
+    uint64_t backslash = 0;
+    // Whitespace and the bytes of the masks above but backslash: where an
+    // atom ends.
+    uint64_t boundary = 0;
+    uint64_t token_start = 0;
+};
+
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+// The best level this CPU supports, picked once.
+SimdLevel GetSimdLevel();
+
+const char* GetSimdLevelName(SimdLevel level);
+
+// Classifies data[offset, offset + 64), or up to size if that comes first;
+// bytes past size count as whitespace.
+StructuralMasks ClassifyBlock(const char* data, size_t size, size_t offset);
+
+// The same with a given level, for benchmarks. level must be supported.
+StructuralMasks ClassifyBlock(SimdLevel level, const char* data, size_t size, size_t offset);
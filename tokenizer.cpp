@@ -1,5 +1,10 @@
 #include "tokenizer.h"
 
+#include <cctype>
+#include <charconv>
+#include <iterator>
+#include "runtime_stats.h"
+
 bool QuoteToken::operator==(const QuoteToken &) const {
     return true;
 }
@@ -16,13 +21,69 @@ bool ConstantToken::operator==(const ConstantToken &other) const {
     return (value == other.value);
 }
 
+bool StringToken::operator==(const StringToken &other) const {
+    return (value == other.value);
+}
+
+namespace {
+
+constexpr size_t kNoBlock = static_cast<size_t>(-1);
+
+bool IsSpace(char c) {
+    return std::isspace(static_cast<unsigned char>(c));
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// The characters a symbol may start with, and those it may go on with.
+bool IsSymbolBegin(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '<' || c == '=' ||
+           c == '>' || c == '*' || c == '/' || c == '#';
+}
+
+bool IsSymbolChar(char c) {
+    return IsSymbolBegin(c) || IsDigit(c) || c == '?' || c == '!' || c == '-';
+}
+
+int ParseNumber(std::string_view digits) {
+    int value = 0;
+    auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+    if (error == std::errc() && end == digits.data() + digits.size()) {
+        return value;
+    }
+    // Out of range, or an atom like 5a1 that ReadAtom takes for a number:
+    // std::stoi reads it as it always has.
+    return std::stoi(std::string(digits));
+}
+
+}  // namespace
+
 Tokenizer::Tokenizer(std::istream *in)
-    : symbols_begin_regex_(std::regex("[a-zA-Z<=>*/#]")),
-      symbols_regex_(std::regex("[a-zA-Z<=>*/#0-9?!-]")),
-      numbers_regex_(std::regex("[0-9]")),
-      stream_(&(*in >> std::ws)),
-      token_(),
-      ended_(false) {
+    : owned_(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>()),
+      text_(owned_),
+      pos_(0),
+      token_offset_(0),
+      block_offset_(kNoBlock),
+      token_() {
+    CountRuntime(RuntimeCounter::TOKENIZER_BYTES, text_.size());
+    Next();
+}
+
+Tokenizer::Tokenizer(std::string_view text)
+    : text_(text), pos_(0), token_offset_(0), block_offset_(kNoBlock), token_() {
+    CountRuntime(RuntimeCounter::TOKENIZER_BYTES, text_.size());
+    Next();
+}
+
+void Tokenizer::Reset(std::string_view text) {
+    owned_.clear();
+    text_ = text;
+    pos_ = 0;
+    token_offset_ = 0;
+    block_offset_ = kNoBlock;
+    CountRuntime(RuntimeCounter::TOKENIZER_BYTES, text_.size());
     Next();
 }
 
@@ -31,106 +92,146 @@ bool Tokenizer::IsEnd() {
 }
 
 void Tokenizer::Next() {
-    token_ = Emptiness();
-    // while (std::isspace(stream_->peek()) && stream_) {
-    //     char dummy;
-    //     *stream_ >> dummy;
-    // }
-    *stream_ >> std::ws;
-    bool is_symbol = false;
-    bool is_value = false;
-    std::string buffer;
-    int res = stream_->peek();
-    while (res != ' ' && !stream_->eof()) {
-        if (res == EOF || res == '\n') {
-            if (!stream_->get()) {
-                ended_ = true;
-                break;
-            } else {
-                stream_->get();
-                res = stream_->peek();
-                continue;
-            }
+    ReadToken();
+    if (!IsEnd()) {
+        CountRuntime(RuntimeCounter::TOKENS);
+    }
+}
+
+template <class Select>
+size_t Tokenizer::NextMarked(size_t from, Select select) {
+    while (from < text_.size()) {
+        size_t block = from & ~size_t{63};
+        if (block != block_offset_) {
+            masks_ = ClassifyBlock(text_.data(), text_.size(), block);
+            block_offset_ = block;
         }
-        char next = res;
-        if (next == '.') {
-            if (!is_value && !is_symbol) {
-                token_ = DotToken();
-                stream_->get();
-            }
+        uint64_t marked = select(masks_) & (~uint64_t{0} << (from - block));
+        if (marked) {
+            return block + __builtin_ctzll(marked);
+        }
+        from = block + 64;
+    }
+    return text_.size();
+}
+
+void Tokenizer::SkipToToken() {
+    while (pos_ < text_.size()) {
+        char next = text_[pos_];
+        if (IsSpace(next)) {
+            pos_ = NextMarked(pos_ + 1, [](const StructuralMasks& masks) {
+                return masks.token_start;
+            });
+        } else if (next == ';') {
+            size_t line_end = text_.find('\n', pos_);
+            pos_ = line_end == std::string_view::npos ? text_.size() : line_end + 1;
+        } else {
+            return;
+        }
+    }
+}
+
+void Tokenizer::ReadToken() {
+    token_ = Emptiness();
+    SkipToToken();
+    token_offset_ = pos_;
+    if (pos_ == text_.size()) {
+        return;
+    }
+    switch (text_[pos_]) {
+        case '.':
+            token_ = DotToken();
+            ++pos_;
             break;
-        } else if (next == '\'') {
-            if (!is_value && !is_symbol) {
-                token_ = QuoteToken();
-                stream_->get();
-            }
+        case '\'':
+            token_ = QuoteToken();
+            ++pos_;
             break;
-        } else if (next == '(') {
-            if (!is_value && !is_symbol) {
-                token_ = BracketToken::OPEN;
-                stream_->get();
-            }
+        case '"':
+            ++pos_;
+            token_.emplace<StringToken>().value = ReadString();
             break;
-        } else if (next == ')') {
-            if (!is_value && !is_symbol) {
-                token_ = BracketToken::CLOSE;
-                stream_->get();
-            }
+        case '(':
+            token_ = BracketToken::OPEN;
+            ++pos_;
             break;
-        } else if (std::regex_match(&next, &next + 1, symbols_begin_regex_)) {
+        case ')':
+            token_ = BracketToken::CLOSE;
+            ++pos_;
+            break;
+        default:
+            ReadAtom();
+    }
+}
+
+// A number or a symbol. It ends before whitespace, a bracket, a quote, a dot,
+// or a sign that follows a number: the next boundary bit is the end unless
+// such a sign comes first. The token is made from the bytes in one go, in
+// place.
+void Tokenizer::ReadAtom() {
+    size_t begin = pos_;
+    size_t end = NextMarked(pos_, [](const StructuralMasks& masks) { return masks.boundary; });
+    bool is_symbol = false;
+    bool is_value = false;
+    // A + that a digit follows isn't part of the number.
+    bool drop_plus = false;
+    for (; pos_ < end; ++pos_) {
+        char next = text_[pos_];
+        if (IsSymbolBegin(next)) {
             is_symbol = true;
-            buffer.push_back(next);
         } else if ((next == '+' || next == '-') && !is_symbol && !is_value) {
             is_symbol = true;
             is_value = true;
-            buffer.push_back(next);
         } else if ((next == '+' || next == '-') && is_value) {
             break;
-        } else if (std::regex_match(&next, &next + 1, numbers_regex_)) {
+        } else if (IsDigit(next)) {
             if (is_value && is_symbol) {
                 is_symbol = false;
-                if (buffer.back() == '+') {
-                    buffer.pop_back();
-                }
-                buffer.push_back(next);
-            } else if (is_value || buffer.empty()) {
+                drop_plus = drop_plus || text_[pos_ - 1] == '+';
+            } else if (is_value || pos_ == begin) {
                 is_value = true;
-                buffer.push_back(next);
-            } else if (std::regex_match(&buffer.back(), symbols_begin_regex_)) {
+            } else if (IsSymbolBegin(text_[pos_ - 1])) {
                 is_value = false;
-                buffer.push_back(next);
-            } else if (is_symbol) {
-                buffer.push_back(next);
-            } else {
+            } else if (!is_symbol) {
                 throw SyntaxError(" ");
             }
-        } else if (std::regex_match(&next, &next + 1, symbols_regex_) && is_symbol) {
-            buffer.push_back(next);
-        } else {
+        } else if (!IsSymbolChar(next) || !is_symbol) {
             throw SyntaxError(" ");
         }
-        if (stream_->eof()) {
-            ended_ = true;
-            return;
-        }
-        stream_->get();
-        res = stream_->peek();
     }
-    if (res == EOF || res == '\n') {
-        if (!stream_->get()) {
-            ended_ = true;
-        }
-    }
-    if (stream_->eof()) {
-        ended_ = true;
+    std::string_view atom = text_.substr(begin + drop_plus, pos_ - begin - drop_plus);
+    if (is_value && !is_symbol) {
+        token_ = ConstantToken{ParseNumber(atom)};
+    } else {
+        token_.emplace<SymbolToken>().name.assign(atom);
     }
-    if (is_symbol && is_value) {
-        is_value = false;
-    }
-    if (is_value) {
-        token_ = ConstantToken{std::stoi(buffer)};
-    } else if (is_symbol) {
-        token_ = SymbolToken{buffer};
+}
+
+// Reads the rest of a string literal after its opening quote.
+std::string Tokenizer::ReadString() {
+    std::string value;
+    while (true) {
+        size_t special = NextMarked(pos_, [](const StructuralMasks& masks) {
+            return masks.double_quote | masks.backslash;
+        });
+        if (special == text_.size()) {
+            throw SyntaxError(" ");
+        }
+        value.append(text_.substr(pos_, special - pos_));
+        pos_ = special + 1;
+        if (text_[special] == '"') {
+            return value;
+        }
+        if (pos_ == text_.size()) {
+            throw SyntaxError(" ");
+        }
+        char next = text_[pos_++];
+        if (next == 'n') {
+            next = '\n';
+        } else if (next != '"' && next != '\\') {
+            throw SyntaxError(" ");
+        }
+        value.push_back(next);
     }
 }
 
@@ -3,8 +3,10 @@
 #include <variant>
 #include <optional>
 #include <istream>
-#include <regex>
+#include <string>
+#include <string_view>
 #include "error.h"
+#include "structural_index.h"
 
 struct SymbolToken {
     std::string name;
@@ -28,28 +30,63 @@ struct ConstantToken {
     bool operator==(const ConstantToken& other) const;
 };
 
+struct StringToken {
+    std::string value;
+
+    bool operator==(const StringToken& other) const;
+};
+
 struct Emptiness {
     bool operator==(const Emptiness& other) const;
 };
 
-using Token =
-    std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, Emptiness>;
+using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken,
+                           StringToken, Emptiness>;
 
+// Reads tokens from a buffer, jumping between the token starts and ends that
+// ClassifyBlock finds 64 bytes at a time.
 class Tokenizer {
 public:
+    // Reads the rest of the stream into a buffer of its own.
     Tokenizer(std::istream* in);
 
+    // text must outlive the tokenizer.
+    explicit Tokenizer(std::string_view text);
+
+    // Starts over on text, which must outlive the tokenizer as well.
+    void Reset(std::string_view text);
+
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
     bool IsEnd();
 
     void Next();
 
     Token GetToken();
 
+    // Where the current token starts in the text; the size of the text at the
+    // end.
+    size_t GetTokenOffset() const {
+        return token_offset_;
+    }
+
 private:
-    std::basic_regex<char> symbols_begin_regex_;
-    std::basic_regex<char> symbols_regex_;
-    std::basic_regex<char> numbers_regex_;
-    std::istream* stream_;
+    void ReadToken();
+    void SkipToToken();
+    // The first byte at or after from whose bit select(masks) sets, or the end
+    // of the text.
+    template <class Select>
+    size_t NextMarked(size_t from, Select select);
+    void ReadAtom();
+    std::string ReadString();
+
+    std::string owned_;
+    std::string_view text_;
+    size_t pos_;
+    size_t token_offset_;
+    // Masks of the block starting at block_offset_.
+    StructuralMasks masks_;
+    size_t block_offset_;
     Token token_;
-    bool ended_;
-};
\ No newline at end of file
+};
@@ -0,0 +1,214 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "error.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t ReadTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return Clock::now().time_since_epoch().count();
+#endif
+}
+
+struct Ring {
+    // Both words are atomics so that a dump racing with the owner reads stale or
+    // torn events rather than invoking undefined behavior; torn ones get dropped.
+    struct Slot {
+        std::atomic<uint64_t> ticks{0};
+        // name << 16 | category << 8 | begin
+        std::atomic<uint64_t> info{0};
+    };
+
+    Ring(size_t size, uint32_t id) : capacity(size), slots(new Slot[size]), thread(id) {
+    }
+
+    size_t capacity;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> written{0};
+    uint32_t thread;
+};
+
+struct TraceState {
+    std::mutex mutex;
+    // Rings are never freed, so a dump can read those of exited threads.
+    std::vector<Ring*> rings;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> name_ids;
+    std::atomic<size_t> capacity{size_t{1} << 16};
+    uint64_t start_ticks = 0;
+    Clock::time_point start_time;
+};
+
+TraceState& State() {
+    static TraceState* state = new TraceState();
+    return *state;
+}
+
+thread_local Ring* thread_ring = nullptr;
+thread_local std::unordered_map<std::string, uint32_t> thread_names;
+
+Ring* NewRing(size_t capacity) {
+    TraceState& state = State();
+    std::lock_guard lock(state.mutex);
+    auto* ring = new Ring(capacity, state.rings.size() + 1);
+    state.rings.push_back(ring);
+    return ring;
+}
+
+std::string Escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+const char* CategoryName(uint64_t category) {
+    switch (static_cast<TraceCategory>(category)) {
+        case TraceCategory::LAMBDA:
+            return "lambda";
+        case TraceCategory::BUILTIN:
+            return "builtin";
+        default:
+            return "parse";
+    }
+}
+
+}  // namespace
+
+void Tracer::Start(size_t events_per_thread) {
+    size_t capacity = 1;
+    while (capacity < events_per_thread) {
+        capacity <<= 1;
+    }
+    TraceState& state = State();
+    {
+        std::lock_guard lock(state.mutex);
+        state.capacity.store(capacity, std::memory_order_relaxed);
+        state.start_time = Clock::now();
+        state.start_ticks = ReadTicks();
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+uint32_t Tracer::Intern(const std::string& name) {
+    auto iter = thread_names.find(name);
+    if (iter != thread_names.end()) {
+        return iter->second;
+    }
+    TraceState& state = State();
+    uint32_t id;
+    {
+        std::lock_guard lock(state.mutex);
+        auto [global, inserted] = state.name_ids.insert({name, state.names.size()});
+        if (inserted) {
+            state.names.push_back(name);
+        }
+        id = global->second;
+    }
+    thread_names.emplace(name, id);
+    return id;
+}
+
+void Tracer::Record(uint32_t name, TraceCategory category, bool begin) {
+    Ring* ring = thread_ring;
+    size_t capacity = State().capacity.load(std::memory_order_relaxed);
+    if (!ring || ring->capacity != capacity) {
+        ring = thread_ring = NewRing(capacity);
+    }
+    uint64_t index = ring->written.load(std::memory_order_relaxed);
+    Ring::Slot& slot = ring->slots[index & (ring->capacity - 1)];
+    slot.ticks.store(ReadTicks(), std::memory_order_relaxed);
+    slot.info.store(uint64_t{name} << 16 | static_cast<uint64_t>(category) << 8 | begin,
+                    std::memory_order_relaxed);
+    ring->written.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::WriteChromeTrace(const std::string& path) {
+    TraceState& state = State();
+    std::lock_guard lock(state.mutex);
+    uint64_t now_ticks = ReadTicks();
+    double elapsed_us =
+        std::chrono::duration<double, std::micro>(Clock::now() - state.start_time).count();
+    double ticks_per_us = 1;
+    if (elapsed_us > 0 && now_ticks > state.start_ticks) {
+        ticks_per_us = (now_ticks - state.start_ticks) / elapsed_us;
+    }
+
+    std::ofstream out(path, std::ios::trunc);
+    out << "{\"traceEvents\": [";
+    bool first = true;
+    for (const Ring* ring : state.rings) {
+        uint64_t end = ring->written.load(std::memory_order_acquire);
+        uint64_t begin = end > ring->capacity ? end - ring->capacity : 0;
+        std::vector<std::pair<uint64_t, uint64_t>> events;
+        for (uint64_t index = begin; index < end; ++index) {
+            const Ring::Slot& slot = ring->slots[index & (ring->capacity - 1)];
+            events.emplace_back(slot.ticks.load(std::memory_order_relaxed),
+                                slot.info.load(std::memory_order_relaxed));
+        }
+        // Slots the owner reached while they were being copied may be torn.
+        uint64_t reached = ring->written.load(std::memory_order_acquire);
+        size_t skip = 0;
+        if (reached + 1 > begin + ring->capacity) {
+            skip = std::min<uint64_t>(events.size(), reached + 1 - begin - ring->capacity);
+        }
+        // Ends whose begin was overwritten or came before Start would confuse
+        // the viewers, so only matched ones are kept.
+        size_t depth = 0;
+        for (size_t i = skip; i < events.size(); ++i) {
+            auto [ticks, info] = events[i];
+            if (ticks < state.start_ticks) {
+                continue;
+            }
+            bool is_begin = info & 1;
+            if (!is_begin) {
+                if (depth == 0) {
+                    continue;
+                }
+                --depth;
+            } else {
+                ++depth;
+            }
+            uint64_t name = info >> 16;
+            char ts[32];
+            std::snprintf(ts, sizeof(ts), "%.3f", (ticks - state.start_ticks) / ticks_per_us);
+            out << (first ? "\n" : ",\n") << "{\"name\": \""
+                << (name < state.names.size() ? Escape(state.names[name]) : "?")
+                << "\", \"cat\": \"" << CategoryName((info >> 8) & 0xff)
+                << "\", \"ph\": \"" << (is_begin ? 'B' : 'E') << "\", \"ts\": " << ts
+                << ", \"pid\": 1, \"tid\": " << ring->thread << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    if (!out) {
+        throw RuntimeError(" ");
+    }
+}
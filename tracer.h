@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Event tracing for latency spikes that aggregate profiles hide.
+//
+// While tracing is on, every function application and the parse of every
+// top-level form leave a begin and an end event in a ring buffer of the
+// thread they run on. Only the owning thread writes a ring, with relaxed
+// atomic stores and no locks; once a ring is full the oldest events are
+// overwritten. Timestamps are raw TSC ticks, converted to microseconds only
+// when the rings are dumped as Chrome trace_event JSON, which Perfetto and
+// chrome://tracing open. With tracing off the cost is one relaxed load per call.
+
+enum class TraceCategory : uint8_t { LAMBDA, BUILTIN, PARSE };
+
+class Tracer {
+public:
+    static bool Enabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Starts recording; rings created from now on hold events_per_thread
+    // events (rounded up to a power of two). Events recorded before are dropped.
+    static void Start(size_t events_per_thread = size_t{1} << 16);
+
+    static void Stop();
+
+    // Writes the events of every thread still in their rings.
+    static void WriteChromeTrace(const std::string& path);
+
+    // Records a begin event now and the matching end event on destruction.
+    class Span {
+    public:
+        Span(const std::string& name, TraceCategory category)
+            : name_(Intern(name)), category_(category) {
+            Record(name_, category_, true);
+        }
+
+        ~Span() {
+            Record(name_, category_, false);
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        uint32_t name_;
+        TraceCategory category_;
+    };
+
+private:
+    static uint32_t Intern(const std::string& name);
+    static void Record(uint32_t name, TraceCategory category, bool begin);
+
+    static inline std::atomic<bool> enabled_ = false;
+};